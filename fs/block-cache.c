@@ -0,0 +1,484 @@
+/*
+ *      File: block-cache.c
+ *      Authors: Gonçalo Sampaio Bárias (ist1103124)
+ *               Pedro Perez Vieira (ist1100064)
+ *      Description: Bounded cache of the blocks of a storage, with CLOCK
+ *                   eviction, prefetching and background write-back.
+ */
+
+#include "block-cache.h"
+#include "config.h"
+#include "../utils/better-assert.h"
+#include "../utils/better-locks.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Max weight of a frame (so a hot block survives this many laps of the clock
+// hand after it stops being used)
+#define MAX_FRAME_WEIGHT (3)
+
+/**
+ * Find the frame that caches a block. Must be called with the cache mutex
+ * held.
+ *
+ * Returns the frame, or NULL if the block isn't cached.
+ */
+static cache_frame_t *frame_lookup(block_cache_t *cache, size_t block) {
+    cache_frame_t *frame = cache->buckets[block & cache->bucket_mask];
+    while (frame != NULL && frame->block != (ssize_t)block) {
+        frame = frame->next;
+    }
+
+    return frame;
+}
+
+/**
+ * Make a (free) frame cache a block. Must be called with the cache mutex held.
+ */
+static void frame_map(block_cache_t *cache, cache_frame_t *frame,
+                      size_t block) {
+    cache_frame_t **bucket = &cache->buckets[block & cache->bucket_mask];
+    frame->block = (ssize_t)block;
+    frame->next = *bucket;
+    *bucket = frame;
+}
+
+/**
+ * Make a frame free, dropping its contents (which frees overflow frames).
+ * Must be called with the cache mutex held.
+ */
+static void frame_unmap(block_cache_t *cache, cache_frame_t *frame) {
+    cache_frame_t **link =
+        &cache->buckets[(size_t)frame->block & cache->bucket_mask];
+    while (*link != frame) {
+        link = &(*link)->next;
+    }
+    *link = frame->next;
+
+    frame->block = -1;
+    frame->next = NULL;
+    frame->pins = 0;
+    frame->weight = 0;
+    frame->dirty = false;
+    if (frame->overflow) {
+        free(frame->data);
+        free(frame);
+    }
+}
+
+/**
+ * Write a dirty frame back to the storage, releasing the cache mutex during
+ * the I/O (the frame is marked as being written meanwhile, so it's neither
+ * evicted nor written by anyone else). Must be called with the cache mutex
+ * held.
+ *
+ * Returns 0 if successful, -1 otherwise (in which case it stays dirty).
+ */
+static int frame_write_back(block_cache_t *cache, cache_frame_t *frame) {
+    frame->writing = true;
+    frame->dirty = false;
+    mutex_unlock(&cache->mutex);
+    int result =
+        storage_block_write(cache->storage, (size_t)frame->block, frame->data);
+    mutex_lock(&cache->mutex);
+    frame->writing = false;
+    if (result != 0) {
+        frame->dirty = true;
+    }
+    cond_broadcast(&cache->frame_cond);
+
+    return result;
+}
+
+/**
+ * Find a free frame in the clock, evicting a block if there is none. The hand
+ * ages the frames it passes by, and evicts the first unused one without
+ * recent accesses (writing it back first, if it's dirty). Must be called with
+ * the cache mutex held (which may be released meanwhile).
+ *
+ * Returns the free frame, or NULL if every frame stayed in use.
+ */
+static cache_frame_t *frame_evict(block_cache_t *cache) {
+    // Enough laps for the hand to age every weight down to 0
+    size_t max_steps = (MAX_FRAME_WEIGHT + 2) * cache->frame_count;
+    for (size_t step = 0; step < max_steps; step++) {
+        cache_frame_t *frame = &cache->frames[cache->hand];
+        cache->hand = (cache->hand + 1) % cache->frame_count;
+
+        if (frame->block == -1) {
+            return frame;
+        }
+        if (frame->pins > 0 || frame->loading || frame->writing) {
+            continue;
+        }
+        if (frame->weight > 0) {
+            frame->weight--;
+            continue;
+        }
+        if (frame->dirty && (frame_write_back(cache, frame) != 0 ||
+                             frame->pins > 0 || frame->dirty)) {
+            continue; // couldn't be written, or was used meanwhile
+        }
+
+        frame_unmap(cache, frame);
+        return frame;
+    }
+
+    return NULL;
+}
+
+/**
+ * Read the blocks queued for prefetching into the cache (unless they are
+ * already cached). Must be called with the cache mutex held (which is released
+ * meanwhile).
+ */
+static void prefetch_queued(block_cache_t *cache) {
+    while (cache->prefetch_count > 0 && !cache->stopping) {
+        size_t block = cache->prefetch_queue[cache->prefetch_head];
+        cache->prefetch_head =
+            (cache->prefetch_head + 1) % BLOCK_CACHE_PREFETCH_QUEUE_SIZE;
+        cache->prefetch_count--;
+        if (frame_lookup(cache, block) != NULL) {
+            continue;
+        }
+
+        mutex_unlock(&cache->mutex);
+        if (block_cache_get(cache, block, true) != NULL) {
+            block_cache_release(cache, block, false);
+        }
+        mutex_lock(&cache->mutex);
+    }
+}
+
+/**
+ * Background worker of a cache, that reads the blocks queued for prefetching
+ * as soon as they are queued, and writes dirty blocks back. The write-back is
+ * rate limited to BLOCK_CACHE_WRITEBACK_BATCH blocks every
+ * BLOCK_CACHE_WRITEBACK_INTERVAL_MS milliseconds (so it doesn't saturate the
+ * storage), and also frees overflow frames nobody uses anymore.
+ */
+static void *worker_thread(void *arg) {
+    block_cache_t *cache = arg;
+
+    mutex_lock(&cache->mutex);
+    while (!cache->stopping) {
+        if (cond_timedwait(&cache->worker_cond, &cache->mutex,
+                           BLOCK_CACHE_WRITEBACK_INTERVAL_MS)) {
+            // Woken up to prefetch
+            prefetch_queued(cache);
+            continue;
+        }
+        prefetch_queued(cache);
+
+        size_t written = 0;
+        for (size_t i = 0; i <= cache->bucket_mask &&
+                           written < BLOCK_CACHE_WRITEBACK_BATCH &&
+                           !cache->stopping;
+             i++) {
+            cache_frame_t *frame = cache->buckets[i];
+            while (frame != NULL) {
+                cache_frame_t *next = frame->next;
+                if (frame->dirty && frame->pins == 0 && !frame->writing &&
+                    !frame->loading) {
+                    frame_write_back(cache, frame);
+                    written++;
+                    // The bucket may have changed meanwhile
+                    break;
+                }
+                if (frame->overflow && frame->pins == 0 && !frame->writing &&
+                    !frame->loading) {
+                    frame_unmap(cache, frame);
+                }
+                frame = next;
+            }
+        }
+    }
+    mutex_unlock(&cache->mutex);
+
+    return NULL;
+}
+
+/**
+ * Initialize a block cache.
+ *
+ * Input:
+ *   - cache: the cache
+ *   - storage: the storage whose blocks are cached
+ *   - frame_count: max number of blocks kept in the cache (more may be kept
+ *     temporarily, if they are all in use at the same time)
+ *   - table_flags: chunked_table_flags_t options for the memory of the frames
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int block_cache_init(block_cache_t *cache, storage_t *storage,
+                     size_t frame_count, int table_flags) {
+    if (frame_count == 0) {
+        return -1;
+    }
+
+    cache->storage = storage;
+    cache->frame_count = frame_count;
+    cache->hand = 0;
+    size_t bucket_count = 1;
+    while (bucket_count < frame_count) {
+        bucket_count *= 2;
+    }
+    cache->bucket_mask = bucket_count - 1;
+
+    cache->frames = calloc(frame_count, sizeof(cache_frame_t));
+    cache->buckets = calloc(bucket_count, sizeof(cache_frame_t *));
+    if (cache->frames == NULL || cache->buckets == NULL ||
+        chunked_table_init(&cache->frame_data, storage->block_size,
+                           frame_count, frame_count, table_flags) != 0) {
+        free(cache->frames);
+        free(cache->buckets);
+        chunked_table_destroy(&cache->frame_data);
+        return -1;
+    }
+    for (size_t i = 0; i < frame_count; i++) {
+        cache->frames[i].block = -1;
+        cache->frames[i].data = chunked_table_get(&cache->frame_data, i);
+    }
+
+    mutex_init(&cache->mutex);
+    cond_init(&cache->frame_cond);
+    cond_init(&cache->worker_cond);
+    cache->prefetch_head = 0;
+    cache->prefetch_count = 0;
+    cache->stopping = false;
+    if (pthread_create(&cache->worker, NULL, worker_thread, cache) != 0) {
+        mutex_destroy(&cache->mutex);
+        cond_destroy(&cache->frame_cond);
+        cond_destroy(&cache->worker_cond);
+        free(cache->frames);
+        free(cache->buckets);
+        chunked_table_destroy(&cache->frame_data);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Destroy a block cache, writing every dirty block back to the storage.
+ *
+ * Returns 0 if successful, -1 if some block couldn't be written back.
+ */
+int block_cache_destroy(block_cache_t *cache) {
+    mutex_lock(&cache->mutex);
+    cache->stopping = true;
+    cond_signal(&cache->worker_cond);
+    mutex_unlock(&cache->mutex);
+    pthread_join(cache->worker, NULL);
+
+    int result = block_cache_flush(cache);
+
+    // Frees the overflow frames left behind
+    for (size_t i = 0; i <= cache->bucket_mask; i++) {
+        while (cache->buckets[i] != NULL) {
+            frame_unmap(cache, cache->buckets[i]);
+        }
+    }
+
+    mutex_destroy(&cache->mutex);
+    cond_destroy(&cache->frame_cond);
+    cond_destroy(&cache->worker_cond);
+    free(cache->frames);
+    free(cache->buckets);
+    chunked_table_destroy(&cache->frame_data);
+
+    return result;
+}
+
+/**
+ * Obtain (and pin) the cached copy of a block, reading it from the storage
+ * if it isn't cached yet. Every call must be paired with a call to
+ * block_cache_release.
+ *
+ * Input:
+ *   - cache: the cache
+ *   - block: index of the block in the storage
+ *   - load: whether the storage holds the contents of the block (otherwise,
+ *     they start out undefined)
+ *
+ * Returns a pointer to the cached copy, or NULL if it couldn't be read.
+ */
+void *block_cache_get(block_cache_t *cache, size_t block, bool load) {
+    mutex_lock(&cache->mutex);
+    while (true) {
+        cache_frame_t *frame = frame_lookup(cache, block);
+        if (frame != NULL) {
+            if (frame->loading) {
+                cond_wait(&cache->frame_cond, &cache->mutex);
+                continue;
+            }
+            frame->pins++;
+            if (frame->weight < MAX_FRAME_WEIGHT) {
+                frame->weight++;
+            }
+            mutex_unlock(&cache->mutex);
+            return frame->data;
+        }
+
+        frame = frame_evict(cache);
+        if (frame == NULL) {
+            // Every frame is in use, so the block gets one of its own (which
+            // is dropped as soon as it isn't used anymore)
+            frame = calloc(1, sizeof(cache_frame_t));
+            if (frame != NULL) {
+                frame->data = malloc(cache->storage->block_size);
+                if (frame->data == NULL) {
+                    free(frame);
+                    frame = NULL;
+                }
+            }
+            if (frame == NULL) {
+                mutex_unlock(&cache->mutex);
+                return NULL;
+            }
+            frame->block = -1;
+            frame->overflow = true;
+        }
+        if (frame_lookup(cache, block) != NULL) {
+            // Another thread cached the block while the mutex was released
+            if (frame->overflow) {
+                free(frame->data);
+                free(frame);
+            }
+            continue;
+        }
+
+        // New blocks enter the cache without any weight, so blocks that are
+        // only used once (e.g. by a sequential scan) are the first to go
+        frame_map(cache, frame, block);
+        frame->pins = 1;
+        if (load) {
+            frame->loading = true;
+            mutex_unlock(&cache->mutex);
+            int result = storage_block_read(cache->storage, block, frame->data);
+            mutex_lock(&cache->mutex);
+            frame->loading = false;
+            cond_broadcast(&cache->frame_cond);
+            if (result != 0) {
+                frame_unmap(cache, frame);
+                mutex_unlock(&cache->mutex);
+                return NULL;
+            }
+        }
+        mutex_unlock(&cache->mutex);
+        return frame->data;
+    }
+}
+
+/**
+ * Release (unpin) the cached copy of a block, obtained with block_cache_get.
+ * Modified blocks are written back to the storage later.
+ *
+ * Input:
+ *   - cache: the cache
+ *   - block: index of the block in the storage
+ *   - dirty: whether the contents were modified
+ */
+void block_cache_release(block_cache_t *cache, size_t block, bool dirty) {
+    mutex_lock(&cache->mutex);
+    cache_frame_t *frame = frame_lookup(cache, block);
+    ALWAYS_ASSERT(frame != NULL && frame->pins > 0,
+                  "block_cache_release: block isn't pinned");
+
+    frame->dirty |= dirty;
+    frame->pins--;
+    if (frame->pins == 0) {
+        cond_broadcast(&cache->frame_cond);
+    }
+    if (frame->overflow && frame->pins == 0 && !frame->writing) {
+        // Overflow frames are dropped right away (if they can't be written,
+        // the worker tries again later)
+        if (!frame->dirty || frame_write_back(cache, frame) == 0) {
+            if (frame->pins == 0 && !frame->dirty && !frame->writing) {
+                frame_unmap(cache, frame);
+            }
+        }
+    }
+    mutex_unlock(&cache->mutex);
+}
+
+/**
+ * Drop a block from the cache, without writing it back (because it was
+ * freed). Waits for the worker, in case it's prefetching the block.
+ *
+ * Input:
+ *   - cache: the cache
+ *   - block: index of the block in the storage
+ */
+void block_cache_forget(block_cache_t *cache, size_t block) {
+    mutex_lock(&cache->mutex);
+    cache_frame_t *frame;
+    while ((frame = frame_lookup(cache, block)) != NULL &&
+           (frame->writing || frame->loading || frame->pins > 0)) {
+        cond_wait(&cache->frame_cond, &cache->mutex);
+    }
+    if (frame != NULL) {
+        frame_unmap(cache, frame);
+    }
+    mutex_unlock(&cache->mutex);
+}
+
+/**
+ * Make sure a block is cached by the time it's used next. Blocks that aren't
+ * cached are queued to be read in the background (unless the queue is full),
+ * and cached ones get the max weight, so they aren't evicted meanwhile.
+ *
+ * Input:
+ *   - cache: the cache
+ *   - block: index of the block in the storage (which must hold its contents)
+ */
+void block_cache_prefetch(block_cache_t *cache, size_t block) {
+    mutex_lock(&cache->mutex);
+    cache_frame_t *frame = frame_lookup(cache, block);
+    if (frame != NULL) {
+        frame->weight = MAX_FRAME_WEIGHT;
+    } else if (cache->prefetch_count < BLOCK_CACHE_PREFETCH_QUEUE_SIZE) {
+        size_t tail = (cache->prefetch_head + cache->prefetch_count) %
+                      BLOCK_CACHE_PREFETCH_QUEUE_SIZE;
+        cache->prefetch_queue[tail] = block;
+        cache->prefetch_count++;
+        cond_signal(&cache->worker_cond);
+    }
+    mutex_unlock(&cache->mutex);
+}
+
+/**
+ * Write every dirty block of a cache back to the storage.
+ *
+ * Returns 0 if successful, -1 if some block couldn't be written back.
+ */
+int block_cache_flush(block_cache_t *cache) {
+    int result = 0;
+
+    mutex_lock(&cache->mutex);
+    for (size_t i = 0; i <= cache->bucket_mask; i++) {
+        cache_frame_t *frame = cache->buckets[i];
+        while (frame != NULL) {
+            if (frame->writing) {
+                // Waits for the write back in progress, and starts over
+                cond_wait(&cache->frame_cond, &cache->mutex);
+                frame = cache->buckets[i];
+                continue;
+            }
+            if (frame->dirty) {
+                if (frame_write_back(cache, frame) != 0) {
+                    result = -1;
+                    frame = frame->next;
+                    continue;
+                }
+                // The bucket may have changed meanwhile
+                frame = cache->buckets[i];
+                continue;
+            }
+            frame = frame->next;
+        }
+    }
+    mutex_unlock(&cache->mutex);
+
+    return result;
+}
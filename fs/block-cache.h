@@ -0,0 +1,65 @@
+#ifndef BLOCK_CACHE_H
+#define BLOCK_CACHE_H
+
+#include "config.h"
+#include "storage.h"
+#include "../utils/chunked-table.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/**
+ * Block cache frame (a copy of a block of the storage).
+ */
+typedef struct cache_frame {
+    ssize_t block; // index of the cached block, or -1 if the frame is free
+    unsigned pins;
+    unsigned weight; // recent accesses, aged by the clock hand
+    bool dirty;
+    bool loading; // being read from the storage (the data isn't valid yet)
+    bool writing; // being written back to the storage
+    bool overflow; // allocated because every frame of the clock was pinned
+    struct cache_frame *next; // next frame in the same hash bucket
+    char *data;
+} cache_frame_t;
+
+/**
+ * Block cache, that keeps a bounded number of blocks of a storage (that isn't
+ * directly addressable) in primary memory, evicting them with a generalized
+ * CLOCK policy. A background worker reads blocks ahead of their use, when
+ * asked to, and writes dirty ones back.
+ */
+typedef struct {
+    storage_t *storage;
+
+    size_t frame_count;
+    cache_frame_t *frames; // the clock
+    chunked_table_t frame_data;
+    size_t hand;
+
+    cache_frame_t **buckets;
+    size_t bucket_mask;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t frame_cond; // a frame finished loading or being written
+
+    pthread_t worker;
+    pthread_cond_t worker_cond;
+    size_t prefetch_queue[BLOCK_CACHE_PREFETCH_QUEUE_SIZE];
+    size_t prefetch_head;
+    size_t prefetch_count;
+    bool stopping;
+} block_cache_t;
+
+int block_cache_init(block_cache_t *cache, storage_t *storage,
+                     size_t frame_count, int table_flags);
+int block_cache_destroy(block_cache_t *cache);
+
+void *block_cache_get(block_cache_t *cache, size_t block, bool load);
+void block_cache_release(block_cache_t *cache, size_t block, bool dirty);
+void block_cache_forget(block_cache_t *cache, size_t block);
+void block_cache_prefetch(block_cache_t *cache, size_t block);
+int block_cache_flush(block_cache_t *cache);
+
+#endif // BLOCK_CACHE_H
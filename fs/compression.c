@@ -0,0 +1,364 @@
+/*
+ *      File: compression.c
+ *      Authors: Gonçalo Sampaio Bárias (ist1103124)
+ *               Pedro Perez Vieira (ist1100064)
+ *      Description: Fast LZ compression, and the framed contents of the
+ *                   compressed files.
+ */
+
+#include "compression.h"
+#include "config.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+// The compressed data is a sequence of (literals, match) pairs, each starting
+// with a token that holds the number of literals in the upper 4 bits and the
+// match length (minus LZ_MIN_MATCH) in the lower 4, followed by the extra
+// bytes of those lengths when they don't fit (255 at a time), the literals,
+// and the 2 byte (little endian) offset of the match. The last pair has no
+// match.
+#define LZ_MIN_MATCH (4)
+#define LZ_MAX_OFFSET (65535)
+#define LZ_HASH_BITS (12)
+#define LZ_TOKEN_MAX (15)
+
+// Bit of the header of a sealed frame set when it's stored uncompressed
+// (because it doesn't compress)
+#define FRAME_RAW (UINT32_C(1) << 31)
+#define FRAME_HEADER_SIZE (sizeof(uint32_t))
+
+static inline uint32_t read32(uint8_t const *p) {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static inline size_t hash4(uint32_t sequence) {
+    return (sequence * UINT32_C(2654435761)) >> (32 - LZ_HASH_BITS);
+}
+
+/**
+ * Write the extra bytes of a length that doesn't fit in its token.
+ */
+static void lz_put_length(uint8_t *out, size_t *o, size_t length) {
+    while (length >= 255) {
+        out[(*o)++] = 255;
+        length -= 255;
+    }
+    out[(*o)++] = (uint8_t)length;
+}
+
+/**
+ * Read the extra bytes of a length that doesn't fit in its token.
+ *
+ * Returns false if the input ends first.
+ */
+static bool lz_get_length(uint8_t const *in, size_t *i, size_t len,
+                          size_t *length) {
+    uint8_t byte;
+    do {
+        if (*i >= len) {
+            return false;
+        }
+        byte = in[(*i)++];
+        *length += byte;
+    } while (byte == 255);
+
+    return true;
+}
+
+/**
+ * Write a (literals, match) pair, where a match_len of 0 means there's no
+ * match.
+ *
+ * Returns false if it doesn't fit.
+ */
+static bool lz_emit(uint8_t *out, size_t *o, size_t capacity,
+                    uint8_t const *literals, size_t literal_len, size_t offset,
+                    size_t match_len) {
+    // Worst case size of the pair
+    size_t size = 1 + literal_len / 255 + 1 + literal_len + 2 +
+                  match_len / 255 + 1;
+    if (*o + size > capacity) {
+        return false;
+    }
+
+    size_t literal_token =
+        literal_len < LZ_TOKEN_MAX ? literal_len : LZ_TOKEN_MAX;
+    size_t match_extra = match_len > 0 ? match_len - LZ_MIN_MATCH : 0;
+    size_t match_token =
+        match_extra < LZ_TOKEN_MAX ? match_extra : LZ_TOKEN_MAX;
+    out[(*o)++] = (uint8_t)(literal_token << 4 | match_token);
+    if (literal_token == LZ_TOKEN_MAX) {
+        lz_put_length(out, o, literal_len - LZ_TOKEN_MAX);
+    }
+    memcpy(out + *o, literals, literal_len);
+    *o += literal_len;
+
+    if (match_len > 0) {
+        out[(*o)++] = (uint8_t)(offset & 0xff);
+        out[(*o)++] = (uint8_t)(offset >> 8);
+        if (match_token == LZ_TOKEN_MAX) {
+            lz_put_length(out, o, match_extra - LZ_TOKEN_MAX);
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Compress data (greedily, finding matches through a hash table of the last
+ * position of each 4 byte sequence).
+ *
+ * Input:
+ *   - src: the data
+ *   - len: length of the data
+ *   - dst: where to store the compressed data
+ *   - capacity: size of dst
+ *
+ * Returns the length of the compressed data, or 0 if it doesn't fit in dst.
+ */
+static size_t lz_compress(void const *src, size_t len, void *dst,
+                          size_t capacity) {
+    uint8_t const *in = src;
+    uint8_t *out = dst;
+    uint32_t table[1 << LZ_HASH_BITS]; // position + 1, or 0 if none
+    memset(table, 0, sizeof(table));
+
+    size_t o = 0;
+    size_t anchor = 0; // first literal not emitted yet
+    size_t i = 0;
+    while (i + LZ_MIN_MATCH <= len) {
+        uint32_t sequence = read32(in + i);
+        size_t h = hash4(sequence);
+        size_t candidate = table[h];
+        table[h] = (uint32_t)(i + 1);
+        if (candidate == 0 || i - (candidate - 1) > LZ_MAX_OFFSET ||
+            read32(in + candidate - 1) != sequence) {
+            i++;
+            continue;
+        }
+
+        // Extends the match as far as it goes (it may overlap the bytes it
+        // produces, which is how runs are encoded)
+        size_t match = candidate - 1;
+        size_t match_len = LZ_MIN_MATCH;
+        while (i + match_len < len &&
+               in[match + match_len] == in[i + match_len]) {
+            match_len++;
+        }
+        if (!lz_emit(out, &o, capacity, in + anchor, i - anchor, i - match,
+                     match_len)) {
+            return 0;
+        }
+        i += match_len;
+        anchor = i;
+    }
+    if (!lz_emit(out, &o, capacity, in + anchor, len - anchor, 0, 0)) {
+        return 0;
+    }
+
+    return o;
+}
+
+/**
+ * Decompress data compressed with lz_compress.
+ *
+ * Input:
+ *   - src: the compressed data
+ *   - len: length of the compressed data
+ *   - dst: where to store the data
+ *   - capacity: size of dst
+ *
+ * Returns the length of the data, or -1 if the compressed data is corrupt (or
+ * the data doesn't fit in dst).
+ */
+static ssize_t lz_decompress(void const *src, size_t len, void *dst,
+                             size_t capacity) {
+    uint8_t const *in = src;
+    uint8_t *out = dst;
+
+    size_t i = 0;
+    size_t o = 0;
+    while (i < len) {
+        uint8_t token = in[i++];
+
+        size_t literal_len = token >> 4;
+        if (literal_len == LZ_TOKEN_MAX &&
+            !lz_get_length(in, &i, len, &literal_len)) {
+            return -1;
+        }
+        if (literal_len > len - i || literal_len > capacity - o) {
+            return -1;
+        }
+        memcpy(out + o, in + i, literal_len);
+        i += literal_len;
+        o += literal_len;
+        if (i == len) {
+            break; // the last pair has no match
+        }
+
+        if (len - i < 2) {
+            return -1;
+        }
+        size_t offset = (size_t)in[i] | (size_t)in[i + 1] << 8;
+        i += 2;
+        size_t match_len = token & LZ_TOKEN_MAX;
+        if (match_len == LZ_TOKEN_MAX &&
+            !lz_get_length(in, &i, len, &match_len)) {
+            return -1;
+        }
+        match_len += LZ_MIN_MATCH;
+        if (offset == 0 || offset > o || match_len > capacity - o) {
+            return -1;
+        }
+        // Byte by byte, since the match may overlap the bytes it produces
+        for (size_t j = 0; j < match_len; j++, o++) {
+            out[o] = out[o - offset];
+        }
+    }
+
+    return (ssize_t)o;
+}
+
+/**
+ * Returns the offset at which a frame (or the tail, if frame is the number of
+ * sealed frames) starts in framed contents.
+ */
+size_t framed_frame_offset(void const *stored, size_t frame) {
+    uint8_t const *in = stored;
+    size_t offset = 0;
+    for (size_t i = 0; i < frame; i++) {
+        offset += FRAME_HEADER_SIZE + (read32(in + offset) & ~FRAME_RAW);
+    }
+
+    return offset;
+}
+
+/**
+ * Returns the max number of bytes that contents of a given size take when
+ * framed.
+ */
+size_t framed_bound(size_t size) {
+    return size + size / COMPRESSION_FRAME_SIZE * FRAME_HEADER_SIZE;
+}
+
+/**
+ * Frame contents, sealing every whole frame.
+ *
+ * Input:
+ *   - src: the contents
+ *   - size: size of the contents
+ *   - dst: where to store the framed contents
+ *   - capacity: size of dst
+ *
+ * Returns the size of the framed contents, or -1 if they don't fit in dst.
+ */
+ssize_t framed_encode(void const *src, size_t size, void *dst,
+                      size_t capacity) {
+    uint8_t const *in = src;
+    uint8_t *out = dst;
+
+    size_t o = 0;
+    size_t i = 0;
+    for (; size - i >= COMPRESSION_FRAME_SIZE; i += COMPRESSION_FRAME_SIZE) {
+        if (capacity - o < FRAME_HEADER_SIZE) {
+            return -1;
+        }
+        // Frames that don't compress are kept as they are
+        size_t frame_capacity = capacity - o - FRAME_HEADER_SIZE;
+        if (frame_capacity > COMPRESSION_FRAME_SIZE - 1) {
+            frame_capacity = COMPRESSION_FRAME_SIZE - 1;
+        }
+        uint32_t header = (uint32_t)lz_compress(
+            in + i, COMPRESSION_FRAME_SIZE, out + o + FRAME_HEADER_SIZE,
+            frame_capacity);
+        if (header == 0) {
+            if (capacity - o - FRAME_HEADER_SIZE < COMPRESSION_FRAME_SIZE) {
+                return -1;
+            }
+            memcpy(out + o + FRAME_HEADER_SIZE, in + i,
+                   COMPRESSION_FRAME_SIZE);
+            header = COMPRESSION_FRAME_SIZE | FRAME_RAW;
+        }
+        memcpy(out + o, &header, FRAME_HEADER_SIZE);
+        o += FRAME_HEADER_SIZE + (header & ~FRAME_RAW);
+    }
+
+    if (capacity - o < size - i) {
+        return -1;
+    }
+    memcpy(out + o, in + i, size - i);
+
+    return (ssize_t)(o + size - i);
+}
+
+/**
+ * Read part of framed contents, decompressing only the frames it overlaps.
+ *
+ * Input:
+ *   - stored: the framed contents
+ *   - stored_size: size of the framed contents
+ *   - size: size of the contents
+ *   - offset: offset of the part to read, in the contents
+ *   - buffer: where to store the part
+ *   - len: length of the part (which must not go past the contents)
+ *
+ * Returns len, or -1 if the framed contents are corrupt.
+ */
+ssize_t framed_read(void const *stored, size_t stored_size, size_t size,
+                    size_t offset, void *buffer, size_t len) {
+    uint8_t const *in = stored;
+    uint8_t *out = buffer;
+    size_t end = offset + len;
+    size_t sealed = size / COMPRESSION_FRAME_SIZE;
+
+    size_t s = 0; // offset in the framed contents
+    for (size_t frame = 0; frame < sealed; frame++) {
+        size_t first = frame * COMPRESSION_FRAME_SIZE;
+        if (first >= end) {
+            return (ssize_t)len;
+        }
+        if (stored_size - s < FRAME_HEADER_SIZE) {
+            return -1;
+        }
+        uint32_t header = read32(in + s);
+        size_t frame_len = header & ~FRAME_RAW;
+        s += FRAME_HEADER_SIZE;
+        if (stored_size - s < frame_len) {
+            return -1;
+        }
+
+        size_t last = first + COMPRESSION_FRAME_SIZE;
+        if (last > offset) {
+            // Copies the part of the frame that overlaps the one being read
+            uint8_t frame_data[COMPRESSION_FRAME_SIZE];
+            uint8_t const *data = in + s;
+            if (!(header & FRAME_RAW)) {
+                if (lz_decompress(in + s, frame_len, frame_data,
+                                  sizeof(frame_data)) !=
+                    COMPRESSION_FRAME_SIZE) {
+                    return -1;
+                }
+                data = frame_data;
+            }
+            size_t from = offset > first ? offset : first;
+            size_t to = end < last ? end : last;
+            memcpy(out + (from - offset), data + (from - first), to - from);
+        }
+        s += frame_len;
+    }
+
+    // The tail is stored as is
+    size_t first = sealed * COMPRESSION_FRAME_SIZE;
+    if (end > first) {
+        size_t from = offset > first ? offset : first;
+        if (stored_size - s < end - first) {
+            return -1;
+        }
+        memcpy(out + (from - offset), in + s + (from - first), end - from);
+    }
+
+    return (ssize_t)len;
+}
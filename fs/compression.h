@@ -0,0 +1,23 @@
+#ifndef COMPRESSION_H
+#define COMPRESSION_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/**
+ * Framed contents (of compressed files).
+ *
+ * The contents are split into frames of COMPRESSION_FRAME_SIZE bytes, where
+ * every whole frame is sealed: compressed on its own, and stored after a
+ * header with its stored length. The last (partial) frame, if any, is the
+ * tail, which is stored as is after the sealed frames, so appending to the
+ * contents only rewrites the tail (and seals it once it fills up).
+ */
+size_t framed_frame_offset(void const *stored, size_t frame);
+size_t framed_bound(size_t size);
+ssize_t framed_encode(void const *src, size_t size, void *dst,
+                      size_t capacity);
+ssize_t framed_read(void const *stored, size_t stored_size, size_t size,
+                    size_t offset, void *buffer, size_t len);
+
+#endif // COMPRESSION_H
@@ -7,7 +7,51 @@
 // Max file name for a given file in the FS
 #define MAX_FILE_NAME (40)
 
-// Delay used when accessing the internal tables of the FS
-#define DELAY (5000)
+// Max size of the contents stored directly inside an inode (symbolic link
+// targets and tiny files), without allocating a data block
+#define INODE_INLINE_DATA_SIZE (64)
+
+// Max number of extra block size classes (besides the main one) in the FS
+#define MAX_BLOCK_CLASSES (4)
+
+// The block cache writes at most BLOCK_CACHE_WRITEBACK_BATCH dirty blocks back
+// to the storage every BLOCK_CACHE_WRITEBACK_INTERVAL_MS milliseconds
+#define BLOCK_CACHE_WRITEBACK_INTERVAL_MS (50)
+#define BLOCK_CACHE_WRITEBACK_BATCH (64)
+
+// Max number of blocks queued for prefetching in the block cache
+#define BLOCK_CACHE_PREFETCH_QUEUE_SIZE (64)
+
+// Number of consecutive reads through an open file after which its reads are
+// considered sequential (and its contents are prefetched)
+#define SEQUENTIAL_READ_THRESHOLD (2)
+
+// Compressed files are compressed in frames of COMPRESSION_FRAME_SIZE bytes,
+// each of them once it's full
+#define COMPRESSION_FRAME_SIZE (4096)
+
+// Max number of symbolic links followed when opening a file (so cycles of
+// them fail instead of being followed forever)
+#define MAX_SYM_LINK_HOPS (8)
+
+// Files are written to the OS' file system in chunks of EXTERNAL_CHUNK_SIZE
+// bytes, up to EXTERNAL_CHUNK_BATCH of them in a single system call
+#define EXTERNAL_CHUNK_SIZE (64 * 1024)
+#define EXTERNAL_CHUNK_BATCH (16)
+
+// Max number of snapshots of the FS that exist at the same time
+#define MAX_SNAPSHOTS (16)
+
+// Size of the write buffer of the files opened with TFS_O_BUFFERED (writes at
+// least this big bypass it)
+#define OPEN_FILE_WRITE_BUFFER_SIZE (512)
+
+// Max number of accesses to the simulated device a thread queues (to be
+// merged) in the course of an FS operation, before dispatching them
+#define IO_PLUG_QUEUE_SIZE (32)
+
+// Latency of every access to the default simulated device (about what the
+// busy loop it replaced took)
+#define DEFAULT_DEVICE_LATENCY_NS (2000)
 
 #endif // CONFIG_H
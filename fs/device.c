@@ -0,0 +1,222 @@
+/*
+ *      File: device.c
+ *      Authors: Gonçalo Sampaio Bárias (ist1103124)
+ *               Pedro Perez Vieira (ist1100064)
+ *      Description: Simulated secondary memory device, that delays the
+ *                   accesses to the FS state kept in primary memory.
+ */
+
+#include "device.h"
+#include "../utils/better-assert.h"
+#include "../utils/better-locks.h"
+#include <errno.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define NS_PER_S (1000000000u)
+
+/**
+ * Returns the current time of the monotonic clock, in nanoseconds.
+ */
+static uint64_t now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * NS_PER_S + (uint64_t)now.tv_nsec;
+}
+
+/**
+ * Wait until a given time of the monotonic clock.
+ *
+ * Input:
+ *   - wait: how to wait
+ *   - deadline: the time (in nanoseconds)
+ */
+static void wait_until(tfs_device_wait_t wait, uint64_t deadline) {
+    switch (wait) {
+    case TFS_DEVICE_SPIN:
+        while (now_ns() < deadline) {
+        }
+        break;
+    case TFS_DEVICE_YIELD:
+        while (now_ns() < deadline) {
+            sched_yield();
+        }
+        break;
+    case TFS_DEVICE_SLEEP: {
+        struct timespec until = {
+            .tv_sec = (time_t)(deadline / NS_PER_S),
+            .tv_nsec = (long)(deadline % NS_PER_S),
+        };
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL) ==
+               EINTR) {
+        }
+    } break;
+    default:
+        PANIC("wait_until: unknown wait mode");
+    }
+}
+
+/**
+ * Initialize a simulated device.
+ *
+ * Input:
+ *   - device: the device
+ *   - model: the model it follows
+ *
+ * Returns 0 if successful, -1 otherwise.
+ *
+ * Possible errors:
+ *   - Unknown wait mode.
+ *   - malloc failure when allocating the channels.
+ */
+int device_init(device_t *device, tfs_device_model const *model) {
+    if (model->wait != TFS_DEVICE_SPIN && model->wait != TFS_DEVICE_YIELD &&
+        model->wait != TFS_DEVICE_SLEEP) {
+        return -1;
+    }
+
+    device->model = *model;
+    device->queued = 0;
+    device->channel_free_at = NULL;
+    if (model->channels > 0) {
+        device->channel_free_at = calloc(model->channels, sizeof(uint64_t));
+        if (device->channel_free_at == NULL) {
+            return -1;
+        }
+    }
+    mutex_init(&device->mutex);
+    cond_init(&device->queue_cond);
+
+    return 0;
+}
+
+/**
+ * Destroy a simulated device.
+ *
+ * Input:
+ *   - device: the device
+ */
+void device_destroy(device_t *device) {
+    mutex_destroy(&device->mutex);
+    cond_destroy(&device->queue_cond);
+    free(device->channel_free_at);
+    device->channel_free_at = NULL;
+}
+
+/**
+ * Returns how long the device takes to serve an access (in nanoseconds).
+ */
+static uint64_t service_time(tfs_device_model const *model,
+                             device_request_t const *request) {
+    uint64_t service = 0;
+    switch (request->access) {
+    case DEVICE_METADATA:
+        service = model->metadata_latency_ns;
+        break;
+    case DEVICE_DATA_READ:
+        service = model->read_latency_ns;
+        break;
+    case DEVICE_DATA_WRITE:
+        service = model->write_latency_ns;
+        break;
+    default:
+        PANIC("service_time: unknown access class");
+    }
+    if (model->bandwidth > 0) {
+        service += (uint64_t)request->bytes * NS_PER_S / model->bandwidth;
+    }
+
+    return service;
+}
+
+/**
+ * Submit a batch of accesses to a simulated device at once, waiting until
+ * they're all served. They're served in parallel, as far as the channels go
+ * (and as many at a time as fit in the queue).
+ *
+ * Input:
+ *   - device: the device
+ *   - requests: the accesses
+ *   - count: number of accesses
+ */
+void device_dispatch(device_t *device, device_request_t const *requests,
+                     size_t count) {
+    tfs_device_model const *model = &device->model;
+    // Without limits on the queue nor the channels, accesses never wait for
+    // one another
+    bool shared = model->queue_depth > 0 || model->channels > 0;
+
+    size_t batch;
+    for (size_t first = 0; first < count; first += batch) {
+        batch = count - first;
+        if (model->queue_depth > 0 && batch > model->queue_depth) {
+            batch = model->queue_depth;
+        }
+
+        uint64_t longest = 0;
+        for (size_t i = first; i < first + batch; i++) {
+            uint64_t service = service_time(model, &requests[i]);
+            longest = service > longest ? service : longest;
+        }
+        if (longest == 0) {
+            continue;
+        }
+        if (!shared) {
+            wait_until(model->wait, now_ns() + longest);
+            continue;
+        }
+
+        mutex_lock(&device->mutex);
+        while (model->queue_depth > 0 &&
+               device->queued + batch > model->queue_depth) {
+            cond_wait(&device->queue_cond, &device->mutex);
+        }
+        device->queued += batch;
+        uint64_t start = now_ns();
+        uint64_t done = start + longest;
+        if (model->channels > 0) {
+            done = start;
+            for (size_t i = first; i < first + batch; i++) {
+                size_t channel = 0;
+                for (size_t c = 1; c < model->channels; c++) {
+                    if (device->channel_free_at[c] <
+                        device->channel_free_at[channel]) {
+                        channel = c;
+                    }
+                }
+                uint64_t free_at = device->channel_free_at[channel];
+                device->channel_free_at[channel] =
+                    (free_at > start ? free_at : start) +
+                    service_time(model, &requests[i]);
+                if (device->channel_free_at[channel] > done) {
+                    done = device->channel_free_at[channel];
+                }
+            }
+        }
+        mutex_unlock(&device->mutex);
+
+        wait_until(model->wait, done);
+
+        mutex_lock(&device->mutex);
+        device->queued -= batch;
+        cond_broadcast(&device->queue_cond);
+        mutex_unlock(&device->mutex);
+    }
+}
+
+/**
+ * Access a simulated device, waiting for as long as the access takes (its
+ * latency and transfer time, once there's a free slot in the queue and a free
+ * channel for it).
+ *
+ * Input:
+ *   - device: the device
+ *   - access: class of the access
+ *   - bytes: number of bytes transferred
+ */
+void device_access(device_t *device, device_access_t access, size_t bytes) {
+    device_request_t request = {.access = access, .bytes = bytes};
+    device_dispatch(device, &request, 1);
+}
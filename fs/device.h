@@ -0,0 +1,49 @@
+#ifndef DEVICE_H
+#define DEVICE_H
+
+#include "operations.h"
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Classes of accesses to the simulated device.
+ */
+typedef enum {
+    DEVICE_METADATA, // a trip to the metadata (on a metadata cache miss)
+    DEVICE_DATA_READ,
+    DEVICE_DATA_WRITE,
+} device_access_t;
+
+/**
+ * Access to the simulated device.
+ */
+typedef struct {
+    device_access_t access;
+    size_t bytes;
+} device_request_t;
+
+/**
+ * Simulated secondary memory device, that delays each access by the time the
+ * device would take to serve it (see tfs_device_model).
+ *
+ * The accesses are served by the channels in turn, each of them by the one
+ * that frees up first, so the time they take is computed when they're
+ * submitted and the device only has to be locked for that.
+ */
+typedef struct {
+    tfs_device_model model;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t queue_cond; // an access finished (freeing a queue slot)
+    uint64_t *channel_free_at; // when each channel finishes its accesses (ns)
+    size_t queued;             // accesses submitted but not finished yet
+} device_t;
+
+int device_init(device_t *device, tfs_device_model const *model);
+void device_destroy(device_t *device);
+void device_access(device_t *device, device_access_t access, size_t bytes);
+void device_dispatch(device_t *device, device_request_t const *requests,
+                     size_t count);
+
+#endif // DEVICE_H
@@ -0,0 +1,185 @@
+/*
+ *      File: io-scheduler.c
+ *      Authors: Gonçalo Sampaio Bárias (ist1103124)
+ *               Pedro Perez Vieira (ist1100064)
+ *      Description: Scheduler of the accesses to the simulated device, that
+ *                   merges those made in the course of an FS operation.
+ */
+
+#include "io-scheduler.h"
+#include "config.h"
+#include <stdlib.h>
+
+/**
+ * Access queued while a thread is plugged.
+ */
+typedef struct {
+    device_access_t access;
+    uint64_t block; // address of the block in the device
+    size_t bytes;
+} io_request_t;
+
+/**
+ * Plug of a thread (the accesses it queued, and how many times it was plugged
+ * without being unplugged, since plugs nest).
+ */
+typedef struct {
+    size_t depth;
+    size_t count;
+    io_request_t queue[IO_PLUG_QUEUE_SIZE];
+} io_plug_t;
+
+static _Thread_local io_plug_t plug;
+
+/**
+ * Initialize an I/O scheduler.
+ *
+ * Input:
+ *   - scheduler: the scheduler
+ *   - device: the device it dispatches the accesses to
+ */
+void io_scheduler_init(io_scheduler_t *scheduler, device_t *device) {
+    scheduler->device = device;
+    atomic_init(&scheduler->requests, 0);
+    atomic_init(&scheduler->dispatches, 0);
+    atomic_init(&scheduler->bytes, 0);
+}
+
+/**
+ * Orders queued accesses by class, then by block.
+ */
+static int request_compare(void const *a, void const *b) {
+    io_request_t const *first = a, *second = b;
+    if (first->access != second->access) {
+        return first->access < second->access ? -1 : 1;
+    }
+    if (first->block != second->block) {
+        return first->block < second->block ? -1 : 1;
+    }
+
+    return 0;
+}
+
+/**
+ * Dispatch the accesses queued by the calling thread, merging those of the
+ * same class to the same or adjacent blocks (a block accessed again is only
+ * transferred once).
+ *
+ * Input:
+ *   - scheduler: the scheduler
+ */
+static void plug_flush(io_scheduler_t *scheduler) {
+    if (plug.count == 0) {
+        return;
+    }
+
+    qsort(plug.queue, plug.count, sizeof(io_request_t), request_compare);
+    device_request_t merged[IO_PLUG_QUEUE_SIZE];
+    size_t merged_count = 0;
+    size_t bytes = 0;
+    for (size_t i = 0; i < plug.count; i++) {
+        io_request_t const *request = &plug.queue[i];
+        if (i > 0 && request->access == plug.queue[i - 1].access &&
+            request->block <= plug.queue[i - 1].block + 1) {
+            if (request->block != plug.queue[i - 1].block) {
+                merged[merged_count - 1].bytes += request->bytes;
+                bytes += request->bytes;
+            }
+            continue;
+        }
+
+        merged[merged_count].access = request->access;
+        merged[merged_count].bytes = request->bytes;
+        merged_count++;
+        bytes += request->bytes;
+    }
+    plug.count = 0;
+
+    atomic_fetch_add_explicit(&scheduler->dispatches, merged_count,
+                              memory_order_relaxed);
+    atomic_fetch_add_explicit(&scheduler->bytes, bytes, memory_order_relaxed);
+    device_dispatch(scheduler->device, merged, merged_count);
+}
+
+/**
+ * Plug the calling thread, so its accesses are queued (to be merged) until
+ * it's unplugged as many times.
+ *
+ * Input:
+ *   - scheduler: the scheduler
+ */
+void io_plug(io_scheduler_t *scheduler) {
+    (void)scheduler;
+    plug.depth++;
+}
+
+/**
+ * Unplug the calling thread, dispatching the accesses it queued once it's no
+ * longer plugged.
+ *
+ * Input:
+ *   - scheduler: the scheduler
+ */
+void io_unplug(io_scheduler_t *scheduler) {
+    plug.depth--;
+    if (plug.depth == 0) {
+        plug_flush(scheduler);
+    }
+}
+
+/**
+ * Submit an access to the device, which is queued if the calling thread is
+ * plugged (and dispatched right away otherwise).
+ *
+ * Input:
+ *   - scheduler: the scheduler
+ *   - access: class of the access
+ *   - block: address of the block accessed (consecutive ones are adjacent in
+ *     the device)
+ *   - bytes: number of bytes transferred
+ */
+void io_submit(io_scheduler_t *scheduler, device_access_t access,
+               uint64_t block, size_t bytes) {
+    atomic_fetch_add_explicit(&scheduler->requests, 1, memory_order_relaxed);
+    if (plug.depth == 0) {
+        atomic_fetch_add_explicit(&scheduler->dispatches, 1,
+                                  memory_order_relaxed);
+        atomic_fetch_add_explicit(&scheduler->bytes, bytes,
+                                  memory_order_relaxed);
+        device_access(scheduler->device, access, bytes);
+        return;
+    }
+
+    // A full queue is dispatched before it takes any more accesses
+    if (plug.count == IO_PLUG_QUEUE_SIZE) {
+        plug_flush(scheduler);
+    }
+    plug.queue[plug.count].access = access;
+    plug.queue[plug.count].block = block;
+    plug.queue[plug.count].bytes = bytes;
+    plug.count++;
+}
+
+/**
+ * Submit accesses that have no address in the device (so they can't be
+ * merged), which are dispatched one by one right away, even if the calling
+ * thread is plugged.
+ *
+ * Input:
+ *   - scheduler: the scheduler
+ *   - access: class of the accesses
+ *   - count: number of accesses
+ *   - bytes: number of bytes transferred by each of them
+ */
+void io_submit_unaddressed(io_scheduler_t *scheduler, device_access_t access,
+                           size_t count, size_t bytes) {
+    atomic_fetch_add_explicit(&scheduler->requests, count,
+                              memory_order_relaxed);
+    atomic_fetch_add_explicit(&scheduler->dispatches, count,
+                              memory_order_relaxed);
+    atomic_fetch_add_explicit(&scheduler->bytes, count * bytes,
+                              memory_order_relaxed);
+    for (size_t i = 0; i < count; i++) {
+        device_access(scheduler->device, access, bytes);
+    }
+}
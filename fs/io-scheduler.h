@@ -0,0 +1,34 @@
+#ifndef IO_SCHEDULER_H
+#define IO_SCHEDULER_H
+
+#include "device.h"
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * I/O scheduler, that merges the accesses to the simulated device made while
+ * a thread is plugged (in the course of a single FS operation): they're
+ * queued until it's unplugged, then sorted, and those to the same or adjacent
+ * blocks are merged into a single access, before they're dispatched to the
+ * device as one batch.
+ *
+ * The queues are per thread, so submitting never takes a lock.
+ */
+typedef struct {
+    device_t *device;
+
+    _Atomic size_t requests;   // accesses submitted
+    _Atomic size_t dispatches; // accesses dispatched to the device
+    _Atomic size_t bytes;      // bytes dispatched to the device
+} io_scheduler_t;
+
+void io_scheduler_init(io_scheduler_t *scheduler, device_t *device);
+void io_plug(io_scheduler_t *scheduler);
+void io_unplug(io_scheduler_t *scheduler);
+void io_submit(io_scheduler_t *scheduler, device_access_t access,
+               uint64_t block, size_t bytes);
+void io_submit_unaddressed(io_scheduler_t *scheduler, device_access_t access,
+                           size_t count, size_t bytes);
+
+#endif // IO_SCHEDULER_H
@@ -0,0 +1,121 @@
+/*
+ *      File: metadata-cache.c
+ *      Authors: Gonçalo Sampaio Bárias (ist1103124)
+ *               Pedro Perez Vieira (ist1100064)
+ *      Description: Cache of the FS metadata, that decides which accesses
+ *                   to it pay the latency of secondary memory.
+ */
+
+#include "metadata-cache.h"
+#include <stdlib.h>
+
+// Number of entries in each set of the cache
+#define METADATA_CACHE_WAYS (4)
+
+/**
+ * Initialize a metadata cache.
+ *
+ * Input:
+ *   - cache: the cache
+ *   - entry_count: number of metadata entries the cache holds (rounded up to
+ *     a power of 2), or 0 to disable the cache (so every access misses)
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int metadata_cache_init(metadata_cache_t *cache, size_t entry_count) {
+    atomic_init(&cache->next_victim, 0);
+    atomic_init(&cache->hits, 0);
+    atomic_init(&cache->misses, 0);
+    atomic_init(&cache->write_backs, 0);
+    cache->slots = NULL;
+    cache->set_mask = 0;
+    if (entry_count == 0) {
+        return 0;
+    }
+
+    size_t set_count = 1;
+    while (set_count * METADATA_CACHE_WAYS < entry_count) {
+        set_count *= 2;
+    }
+    cache->slots = calloc(set_count * METADATA_CACHE_WAYS, sizeof(uint64_t));
+    if (cache->slots == NULL) {
+        return -1;
+    }
+    cache->set_mask = set_count - 1;
+
+    return 0;
+}
+
+/**
+ * Destroy a metadata cache, writing back the modified metadata it holds.
+ *
+ * Returns the number of write-backs (so the caller can pay their latency).
+ */
+size_t metadata_cache_destroy(metadata_cache_t *cache) {
+    size_t dirty = 0;
+    if (cache->slots != NULL) {
+        size_t slot_count = (cache->set_mask + 1) * METADATA_CACHE_WAYS;
+        for (size_t i = 0; i < slot_count; i++) {
+            dirty += atomic_load(&cache->slots[i]) & 1;
+        }
+        free(cache->slots);
+        cache->slots = NULL;
+    }
+    atomic_fetch_add(&cache->write_backs, dirty);
+
+    return dirty;
+}
+
+/**
+ * Access some metadata through the cache, caching it on a miss (which evicts
+ * another entry of its set).
+ *
+ * Input:
+ *   - cache: the cache
+ *   - kind: kind of the metadata
+ *   - id: identifier of the metadata (among those of its kind)
+ *   - write: whether the metadata is modified
+ *
+ * Returns the number of trips to secondary memory the access takes: 0 on a
+ * hit, 1 on a miss, and 2 on a miss that evicts modified metadata.
+ */
+size_t metadata_cache_access(metadata_cache_t *cache, metadata_kind_t kind,
+                             uint64_t id, bool write) {
+    if (cache->slots == NULL) {
+        atomic_fetch_add_explicit(&cache->misses, 1, memory_order_relaxed);
+        return 1;
+    }
+
+    uint64_t key = (uint64_t)kind << 56 | id;
+    uint64_t tag = (key + 1) << 1;
+    // Fibonacci hashing, so consecutive ids spread over the sets
+    size_t set = (size_t)((key * 0x9E3779B97F4A7C15u) >> 32) & cache->set_mask;
+    _Atomic uint64_t *ways = &cache->slots[set * METADATA_CACHE_WAYS];
+
+    for (size_t i = 0; i < METADATA_CACHE_WAYS; i++) {
+        uint64_t slot = atomic_load_explicit(&ways[i], memory_order_relaxed);
+        if ((slot & ~(uint64_t)1) == tag) {
+            if (write && !(slot & 1)) {
+                atomic_fetch_or_explicit(&ways[i], 1, memory_order_relaxed);
+            }
+            atomic_fetch_add_explicit(&cache->hits, 1, memory_order_relaxed);
+            return 0;
+        }
+    }
+
+    // Evicts the ways of the sets in turn (cheaper than tracking recency, and
+    // close enough with a few ways)
+    size_t victim = atomic_fetch_add_explicit(&cache->next_victim, 1,
+                                              memory_order_relaxed) %
+                    METADATA_CACHE_WAYS;
+    uint64_t evicted = atomic_exchange_explicit(
+        &ways[victim], tag | (write ? 1 : 0), memory_order_relaxed);
+    atomic_fetch_add_explicit(&cache->misses, 1, memory_order_relaxed);
+    if (evicted & 1) {
+        atomic_fetch_add_explicit(&cache->write_backs, 1,
+                                  memory_order_relaxed);
+        return 2;
+    }
+
+    return 1;
+}
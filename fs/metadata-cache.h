@@ -0,0 +1,44 @@
+#ifndef METADATA_CACHE_H
+#define METADATA_CACHE_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Kinds of FS metadata that live in secondary memory.
+ */
+typedef enum {
+    META_INODE = 1,
+    META_DIR_BLOCK,
+    META_FREE_INODE_MAP, // a block of the free inode map
+    META_FREE_BLOCK_MAP, // a block of the free block map of a pool
+} metadata_kind_t;
+
+/**
+ * Metadata cache, that tracks which metadata (inodes, directory blocks and
+ * free maps) would currently be cached in primary memory, so only the accesses
+ * that miss it (and the write-backs of the modified metadata it evicts) pay
+ * the latency of secondary memory.
+ *
+ * It's a set associative cache of tags, that can be used without locks (in
+ * the rare case of concurrent misses to the same metadata, it may briefly be
+ * cached twice, which only costs an extra miss later).
+ */
+typedef struct {
+    _Atomic uint64_t *slots; // (key + 1) << 1 | dirty, or 0 if empty
+    size_t set_mask;
+    _Atomic size_t next_victim;
+
+    _Atomic size_t hits;
+    _Atomic size_t misses;
+    _Atomic size_t write_backs;
+} metadata_cache_t;
+
+int metadata_cache_init(metadata_cache_t *cache, size_t entry_count);
+size_t metadata_cache_destroy(metadata_cache_t *cache);
+size_t metadata_cache_access(metadata_cache_t *cache, metadata_kind_t kind,
+                             uint64_t id, bool write);
+
+#endif // METADATA_CACHE_H
@@ -5,16 +5,26 @@
  *      Description: All the possible operations on the TecnicoFS.
  */
 
+// pwritev is not part of POSIX
+#define _DEFAULT_SOURCE
+
 #include "operations.h"
 #include "../utils/better-assert.h"
 #include "../utils/better-locks.h"
 #include "config.h"
 #include "state.h"
+#include <errno.h>
+#include <fcntl.h>
 #include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
 
 static pthread_mutex_t open_mutex;
 static pthread_rwlock_t link_lock;
@@ -28,11 +38,67 @@ tfs_params tfs_default_params() {
         .max_inode_count = 64,
         .max_block_count = 1024,
         .max_open_files_count = 16,
+        .inode_count_limit = 0,
+        .block_count_limit = 0,
+        .open_files_count_limit = 0,
         .block_size = 1024,
+        .block_class_count = 0,
+        .use_huge_pages = false,
+        .prefault_memory = false,
+        .storage_backend = TFS_STORAGE_MEMORY,
+        .storage_path = NULL,
+        .block_cache_size = 0,
+        .metadata_cache_size = 256,
+        // Blocks are accessed (and read) before they're written to, which is
+        // all a write costs, as with the busy loop this model replaced
+        .device =
+            {
+                .metadata_latency_ns = DEFAULT_DEVICE_LATENCY_NS,
+                .read_latency_ns = DEFAULT_DEVICE_LATENCY_NS,
+                .write_latency_ns = 0,
+                .bandwidth = 0,
+                .queue_depth = 0,
+                .channels = 0,
+                .wait = TFS_DEVICE_SPIN,
+            },
     };
     return params;
 }
 
+tfs_device_model tfs_device_preset(tfs_device_kind_t kind) {
+    tfs_device_model model = {.wait = TFS_DEVICE_SLEEP};
+    switch (kind) {
+    case TFS_DEVICE_RAM:
+        // Too fast to sleep for
+        model.metadata_latency_ns = 100;
+        model.read_latency_ns = 100;
+        model.write_latency_ns = 100;
+        model.bandwidth = 20000000000u;
+        model.wait = TFS_DEVICE_SPIN;
+        break;
+    case TFS_DEVICE_NVME:
+        model.metadata_latency_ns = 80000;
+        model.read_latency_ns = 80000;
+        model.write_latency_ns = 20000;
+        model.bandwidth = 3000000000u;
+        model.queue_depth = 1024;
+        model.channels = 8;
+        break;
+    case TFS_DEVICE_SATA_SSD:
+        model.metadata_latency_ns = 150000;
+        model.read_latency_ns = 150000;
+        model.write_latency_ns = 60000;
+        model.bandwidth = 550000000u;
+        model.queue_depth = 32;
+        model.channels = 4;
+        break;
+    default:
+        PANIC("tfs_device_preset: unknown device kind");
+    }
+
+    return model;
+}
+
 int tfs_init(tfs_params const *params_ptr) {
     tfs_params params;
     if (params_ptr != NULL) {
@@ -76,7 +142,7 @@ int tfs_destroy() {
  * Returns the inumber of the file, -1 if unsuccessful.
  */
 static int tfs_lookup(char const *name, inode_t const *root_inode) {
-    if (root_inode == NULL || root_inode->i_data_block != 0) {
+    if (root_inode == NULL || root_inode->i_node_type != T_DIRECTORY) {
         return -1; // root_inode is not the actual root inode
     }
 
@@ -91,84 +157,292 @@ static int tfs_lookup(char const *name, inode_t const *root_inode) {
     return find_in_dir(root_inode, name);
 }
 
-int tfs_open(char const *name, tfs_file_mode_t mode) {
+/**
+ * Resolve a path name, following symbolic links up to MAX_SYM_LINK_HOPS. The
+ * final target of the first link followed is cached, so following it again
+ * (until a directory entry is removed or renamed) takes a single lookup. It
+ * takes no lock other than those of the links followed, so the file found may
+ * be deleted as soon as it's returned.
+ *
+ * Input:
+ *   - path: the path name (a buffer of MAX_FILE_NAME + 1 chars), which is
+ *     replaced by the target path of every link followed
+ *
+ * Returns the inumber of the file the path name resolves to, -1 if it doesn't
+ * exist (in which case path holds the path name that doesn't exist), or -2 if
+ * it can't be resolved (too many links were followed, or a target path is too
+ * long to exist).
+ */
+static int path_resolve(char *path) {
+    inode_t *root_dir_inode = inode_get(ROOT_DIR_INUM);
+    ALWAYS_ASSERT(root_dir_inode != NULL,
+                  "path_resolve: root dir inode must exist");
+
+    // The generation is obtained first, so the resolution is never cached as
+    // valid if an entry is removed or renamed while it's underway
+    uint32_t generation = namespace_generation_get();
+    int inum = tfs_lookup(path, root_dir_inode);
+    int link_inum = -1; // the first link followed
+    for (size_t hops = 0; inum != -1; hops++) {
+        rwlock_rdlock(inode_lock_get(inum));
+        inode_t *inode = inode_get(inum);
+        if (inode->i_node_type != T_SYM_LINK) {
+            rwlock_unlock(inode_lock_get(inum));
+            if (link_inum != -1) {
+                sym_link_cache_put(link_inum, generation, inum);
+            }
+            return inum;
+        }
+        if (link_inum == -1) {
+            link_inum = inum;
+            int target_inum = sym_link_cache_get(inum);
+            if (target_inum != -1) {
+                rwlock_unlock(inode_lock_get(inum));
+                return target_inum;
+            }
+        }
+        if (hops == MAX_SYM_LINK_HOPS || inode->i_size > MAX_FILE_NAME + 1) {
+            rwlock_unlock(inode_lock_get(inum));
+            return -2;
+        }
+
+        // Copies the target path, since the link may be deleted as soon as
+        // the inode is unlocked
+        char const *data = inode_data_get(inode);
+        ALWAYS_ASSERT(data != NULL,
+                      "path_resolve: data block deleted mid-read");
+        memcpy(path, data, inode->i_size);
+        inode_data_release(inode, false);
+        rwlock_unlock(inode_lock_get(inum));
+        inum = tfs_lookup(path, root_dir_inode);
+    }
+
+    return -1;
+}
+
+/**
+ * Create a file in the root directory. Must be called with open_mutex locked.
+ *
+ * Input:
+ *   - sub_name: name of the file
+ *   - mode: the mode it's created with (where only TFS_O_COMPRESS matters)
+ *
+ * Returns the inumber of the file, or -1 if it can't be created (including
+ * if the name already exists).
+ */
+static int file_create(char const *sub_name, tfs_file_mode_t mode) {
+    inode_t *root_dir_inode = inode_get(ROOT_DIR_INUM);
+    ALWAYS_ASSERT(root_dir_inode != NULL,
+                  "file_create: root dir inode must exist");
+
+    // Create inode
+    int inum = inode_create(T_FILE);
+    if (inum == -1) {
+        return -1; // no space in inode table
+    }
+    if (mode & TFS_O_COMPRESS) {
+        inode_get(inum)->i_compressed = true;
+    }
+
+    // Add entry in the root directory
+    if (add_dir_entry(root_dir_inode, sub_name, inum) == -1) {
+        inode_delete(inum);
+        return -1; // no space in directory, or the name already exists
+    }
+
+    return inum;
+}
+
+/**
+ * Prepare an existing file to be opened, truncating it if requested.
+ *
+ * Input:
+ *   - inum: inumber of the file
+ *   - mode: the mode it's opened with
+ *   - generation: generation its inode must be in, or -1 for any (where the
+ *     generation it's in is stored)
+ *
+ * Returns the initial offset of the file, -1 if it can't be opened (it isn't
+ * a file), or -2 if it no longer exists (in the given generation).
+ */
+static ssize_t file_open_existing(int inum, tfs_file_mode_t mode,
+                                  int64_t *generation) {
+    rwlock_wrlock(inode_lock_get(inum));
+    inode_t *inode = inode_get(inum);
+    if (!inode_exists(inum) ||
+        (*generation != -1 && inode_generation_get(inum) != *generation)) {
+        rwlock_unlock(inode_lock_get(inum));
+        return -2;
+    }
+    if (inode->i_node_type != T_FILE) {
+        rwlock_unlock(inode_lock_get(inum));
+        return -1;
+    }
+    *generation = inode_generation_get(inum);
+
+    // Truncate (if requested), preserving the contents for the snapshots
+    // first
+    if (mode & TFS_O_TRUNC) {
+        if (inode_preserve(inum) != 0) {
+            rwlock_unlock(inode_lock_get(inum));
+            return -1;
+        }
+        if (inode->i_data_block != -1) {
+            data_block_free(inode->i_data_block);
+            inode->i_data_block = -1;
+        }
+        inode->i_size = 0;
+        inode->i_data_size = 0;
+        inode->i_stored_size = 0;
+    }
+    // Determine initial offset
+    size_t offset = 0;
+    if (mode & TFS_O_APPEND) {
+        offset = inode->i_size;
+    } else if (inode->i_data_block != -1) {
+        // The file is most likely opened to be read from the start, so its
+        // contents start being read in the background right away
+        data_block_prefetch(inode->i_data_block);
+    }
+    rwlock_unlock(inode_lock_get(inum));
+
+    return (ssize_t)offset;
+}
+
+/**
+ * Open an existing file, without looking it up.
+ *
+ * Input:
+ *   - inum: inumber of the file
+ *   - mode: the mode it's opened with
+ *   - generation: generation its inode must be in, or -1 for any
+ *
+ * Returns the file handle, -1 if it can't be opened, or -2 if it no longer
+ * exists (in the given generation).
+ */
+static int file_open_inum(int inum, tfs_file_mode_t mode, int64_t generation) {
+    ssize_t offset = file_open_existing(inum, mode, &generation);
+    if (offset < 0) {
+        return (int)offset;
+    }
+
+    return add_to_open_file_table(inum, (size_t)offset, mode & TFS_O_BUFFERED,
+                                  -1, generation);
+}
+
+int tfs_create(char const *name, tfs_file_mode_t mode) {
     // Checks if the path name is valid
-    if (!valid_pathname(name)) {
+    if (!valid_pathname(name) || strlen(name) > MAX_FILE_NAME) {
+        return -1;
+    }
+
+    state_io_plug();
+    mutex_lock(&open_mutex);
+    int inum = file_create(name + 1, mode);
+    mutex_unlock(&open_mutex);
+    state_io_unplug();
+
+    return inum;
+}
+
+/**
+ * Open a file (see tfs_open).
+ */
+static int file_open(char const *name, tfs_file_mode_t mode) {
+    // Checks if the path name is valid (longer ones can't exist, nor be
+    // created)
+    if (!valid_pathname(name) || strlen(name) > MAX_FILE_NAME) {
         return -1;
     }
 
     inode_t *root_dir_inode = inode_get(ROOT_DIR_INUM);
     ALWAYS_ASSERT(root_dir_inode != NULL,
-                  "tfs_open: root dir inode must exist");
-    // We need to lock until we make sure the file is created if it doesn't
-    // exist
-    mutex_lock(&open_mutex);
-    int inum = tfs_lookup(name, root_dir_inode);
-    size_t offset = 0;
+                  "file_open: root dir inode must exist");
+    char path[MAX_FILE_NAME + 1];
+    bool exclusive = (mode & TFS_O_CREAT) && (mode & TFS_O_EXCL);
+    while (true) {
+        // Existing files are looked up without locking (if the name must be
+        // new, it's added without being looked up first, since adding it
+        // fails if it exists)
+        strcpy(path, name);
+        int inum = exclusive ? -1 : path_resolve(path);
 
-    if (inum >= 0) {
-        // The file already exists
-        mutex_unlock(&open_mutex);
-        rwlock_wrlock(&inode_locks[inum]);
-        inode_t *inode = inode_get(inum);
-        ALWAYS_ASSERT(inode != NULL,
-                      "tfs_open: directory files must have an inode");
-        ALWAYS_ASSERT(inode->i_node_type != T_DIRECTORY,
-                      "tfs_open: directories cannot be opened this way");
-
-        // If the file is a symbolic link, it opens the stored file path
-        if (inode->i_node_type == T_SYM_LINK) {
-            char *target = (char *)data_block_get(inode->i_data_block);
-            ALWAYS_ASSERT(target != NULL,
-                          "tfs_open: data block deleted mid-read");
-            rwlock_unlock(&inode_locks[inum]);
-            return tfs_open(target, mode);
-        }
+        if (inum == -1 && (mode & TFS_O_CREAT)) {
+            // The file does not exist; the mode specified that it should be
+            // created. We need to lock until we make sure it's created if it
+            // still doesn't exist (following symbolic links, so the file
+            // created is the target of the last one)
+            mutex_lock(&open_mutex);
+            if (!exclusive) {
+                strcpy(path, name);
+                inum = path_resolve(path);
+            }
+            if (inum == -1) {
+                inum = file_create(path + 1, mode);
+                mutex_unlock(&open_mutex);
+                if (inum == -1) {
+                    return -1;
+                }
 
-        // Truncate (if requested)
-        if (mode & TFS_O_TRUNC) {
-            if (inode->i_size > 0) {
-                data_block_free(inode->i_data_block);
-                inode->i_size = 0;
+                // Finally, add entry to the open file table and return the
+                // corresponding handle
+                int fhandle = add_to_open_file_table(
+                    inum, 0, mode & TFS_O_BUFFERED, -1, -1);
+                return fhandle < 0 ? -1 : fhandle;
+
+                // Note: for simplification, if file was created with
+                // TFS_O_CREAT and there is an error adding an entry to the
+                // open file table, the file is not opened but it remains
+                // created
             }
-        }
-        // Determine initial offset
-        if (mode & TFS_O_APPEND) {
-            offset = inode->i_size;
-        }
-        rwlock_unlock(&inode_locks[inum]);
-    } else if (mode & TFS_O_CREAT) {
-        // The file does not exist; the mode specified that it should be created
-        // Create inode
-        inum = inode_create(T_FILE);
-        if (inum == -1) {
             mutex_unlock(&open_mutex);
-            return -1; // no space in inode table
         }
 
-        // Add entry in the root directory
-        if (add_dir_entry(root_dir_inode, name + 1, inum) == -1) {
-            mutex_unlock(&open_mutex);
-            inode_delete(inum);
-            return -1; // no space in directory
+        if (inum < 0) {
+            return -1;
+        }
+
+        // The file already exists, and is opened unless it's deleted before
+        // that (in which case it's looked up again, so a file replaced by
+        // another one is never found missing)
+        int fhandle = file_open_inum(inum, mode, -1);
+        if (fhandle != -2) {
+            return fhandle;
         }
-        mutex_unlock(&open_mutex);
-    } else {
-        mutex_unlock(&open_mutex);
-        return -1;
     }
+}
+
+int tfs_open(char const *name, tfs_file_mode_t mode) {
+    // The accesses to the root directory and the file's inode are merged
+    state_io_plug();
+    int fhandle = file_open(name, mode);
+    state_io_unplug();
+
+    return fhandle;
+}
 
-    // Finally, add entry to the open file table and return the corresponding
-    // handle
-    return add_to_open_file_table(inum, offset);
+int tfs_open_inum(int inumber, uint32_t generation, tfs_file_mode_t mode) {
+    // The file is already known, so it's neither looked up nor created
+    if (!inode_exists(inumber)) {
+        return -1;
+    }
+    int fhandle = file_open_inum(inumber, mode, generation);
 
-    // Note: for simplification, if file was created with TFS_O_CREAT and there
-    // is an error adding an entry to the open file table, the file is not
-    // opened but it remains created
+    return fhandle < 0 ? -1 : fhandle;
 }
 
 int tfs_close(int fhandle) { return remove_from_open_file_table(fhandle); }
 
+int tfs_flush(int fhandle) { return flush_open_file(fhandle); }
+
+int tfs_ftruncate(int fhandle, size_t length) {
+    return truncate_open_file(fhandle, length);
+}
+
+int tfs_fallocate(int fhandle, size_t length) {
+    return allocate_open_file(fhandle, length);
+}
+
 ssize_t tfs_write(int fhandle, void const *buffer, size_t to_write) {
     return write_to_open_file(fhandle, buffer, to_write);
 }
@@ -185,8 +459,15 @@ int tfs_sym_link(char const *target, char const *link) {
         return -1;
     }
 
+    // The target path (with the '\0') must fit in a single data block
+    size_t target_size = strlen(target) + 1;
+    if (target_size > state_block_size()) {
+        return -1;
+    }
+
     rwlock_rdlock(&link_lock);
-    // Creates the symbolic link inode and alocates memory for the target path
+    // Creates the symbolic link inode, which keeps short target paths inline
+    // and only allocates a data block for the longer ones
     int link_inum = inode_create(T_SYM_LINK);
     if (link_inum == -1) {
         rwlock_unlock(&link_lock);
@@ -198,18 +479,27 @@ int tfs_sym_link(char const *target, char const *link) {
         rwlock_unlock(&link_lock);
         return -1;
     }
-    int bnum = data_block_alloc();
-    if (bnum == -1) {
+    if (target_size > INODE_INLINE_DATA_SIZE) {
+        int bnum = data_block_alloc(target_size);
+        if (bnum == -1) {
+            inode_delete(link_inum);
+            rwlock_unlock(&link_lock);
+            return -1;
+        }
+        link_inode->i_data_block = bnum;
+    }
+
+    // Writes the target path into the symbolic link contents
+    char *data = inode_data_get(link_inode);
+    ALWAYS_ASSERT(data != NULL, "tfs_sym_link: data block deleted mid-write");
+    memcpy(data, target, target_size);
+    link_inode->i_size = target_size;
+    link_inode->i_data_size = target_size;
+    if (inode_data_release(link_inode, true) != 0) {
         inode_delete(link_inum);
         rwlock_unlock(&link_lock);
         return -1;
     }
-    link_inode->i_data_block = bnum;
-
-    // Writes the target path into the symbolic link data block
-    char *block = data_block_get(link_inode->i_data_block);
-    ALWAYS_ASSERT(block != NULL, "tfs_sym_link: data block deleted mid-write");
-    memcpy(block, target, strlen(target) + 1);
 
     // Adds a directory entry for the symbolic link
     inode_t *root_dir_inode = inode_get(ROOT_DIR_INUM);
@@ -225,6 +515,40 @@ int tfs_sym_link(char const *target, char const *link) {
     return 0;
 }
 
+/**
+ * Drop a hard link to each of many files (whose directory entries are already
+ * gone), deleting every file whose last one it was and that isn't open. Must
+ * be called with link_lock write-locked.
+ *
+ * Input:
+ *   - inumbers: inumbers of the files (the ones that are -1 are skipped)
+ *   - count: number of inumbers
+ */
+static void drop_hard_links(int const *inumbers, size_t count) {
+    mutex_lock(&free_open_file_entries_mutex);
+    for (size_t i = 0; i < count; i++) {
+        if (inumbers[i] == -1) {
+            continue;
+        }
+        inode_t *inode = inode_get(inumbers[i]);
+        ALWAYS_ASSERT(inode != NULL,
+                      "drop_hard_links: linked inode must exist");
+
+        // Decreases the hard link counter and when it reaches 0 the file is
+        // deleted if it's not open (needs to lock inode because it changed
+        // the hard link counter)
+        rwlock_wrlock(inode_lock_get(inumbers[i]));
+        inode->i_hard_links--;
+        if (inode->i_hard_links == 0 && is_file_open(inumbers[i]) == 0) {
+            rwlock_unlock(inode_lock_get(inumbers[i]));
+            inode_delete(inumbers[i]);
+        } else {
+            rwlock_unlock(inode_lock_get(inumbers[i]));
+        }
+    }
+    mutex_unlock(&free_open_file_entries_mutex);
+}
+
 int tfs_link(char const *target, char const *link) {
     // Checks if the path names are valid
     if (!valid_pathname(target) || !valid_pathname(link)) {
@@ -254,57 +578,282 @@ int tfs_link(char const *target, char const *link) {
         rwlock_unlock(&link_lock);
         return -1;
     }
-    rwlock_wrlock(&inode_locks[target_inum]);
+    rwlock_wrlock(inode_lock_get(target_inum));
     target_inode->i_hard_links++;
-    rwlock_unlock(&inode_locks[target_inum]);
+    rwlock_unlock(inode_lock_get(target_inum));
     rwlock_unlock(&link_lock);
 
     return 0;
 }
 
 int tfs_unlink(char const *target) {
+    return tfs_unlink_many(&target, 1) == 1 ? 0 : -1;
+}
+
+ssize_t tfs_unlink_many(char const *const *targets, size_t count) {
+    if (targets == NULL && count > 0) {
+        return -1;
+    }
+
+    // Skips the initial '/' character of the valid path names
+    char const **names = malloc(count * sizeof(char const *));
+    int *inumbers = malloc(count * sizeof(int));
+    if ((names == NULL || inumbers == NULL) && count > 0) {
+        free(names);
+        free(inumbers);
+        return -1;
+    }
+    for (size_t i = 0; i < count; i++) {
+        names[i] = valid_pathname(targets[i]) ? targets[i] + 1 : NULL;
+    }
+
+    // Clears every directory entry at once, then drops the links they were
+    // (the tecnico fs can only unlink files and symbolic links, since the
+    // root is the only directory)
+    state_io_plug();
+    rwlock_wrlock(&link_lock);
+    inode_t *root_dir_inode = inode_get(ROOT_DIR_INUM);
+    ALWAYS_ASSERT(root_dir_inode != NULL,
+                  "tfs_unlink_many: root dir inode must exist");
+    ssize_t unlinked =
+        clear_dir_entries(root_dir_inode, names, count, inumbers);
+    if (unlinked > 0) {
+        drop_hard_links(inumbers, count);
+    }
+    rwlock_unlock(&link_lock);
+    state_io_unplug();
+    free(names);
+    free(inumbers);
+
+    return unlinked;
+}
+
+int tfs_rename(char const *old_name, char const *new_name) {
     // Checks if the path names are valid
-    if (!valid_pathname(target)) {
+    if (!valid_pathname(old_name) || !valid_pathname(new_name)) {
         return -1;
     }
 
+    // The link replaced by the new name (if any) is dropped like an unlinked
+    // one, so no other link may be added to its file meanwhile
+    state_io_plug();
     rwlock_wrlock(&link_lock);
-    // Gets the target file inode
     inode_t *root_dir_inode = inode_get(ROOT_DIR_INUM);
     ALWAYS_ASSERT(root_dir_inode != NULL,
-                  "tfs_unlink: root dir inode must exist");
-    int target_inum = tfs_lookup(target, root_dir_inode);
-    if (target_inum == -1) {
-        rwlock_unlock(&link_lock);
+                  "tfs_rename: root dir inode must exist");
+
+    // The directory entry is moved in a single step, so every lookup finds
+    // the file under either name (and the new name never goes missing)
+    int replaced_inum;
+    int renamed = rename_dir_entry(root_dir_inode, old_name + 1, new_name + 1,
+                                   &replaced_inum);
+    if (renamed != -1) {
+        drop_hard_links(&replaced_inum, 1);
+    }
+    rwlock_unlock(&link_lock);
+    state_io_unplug();
+
+    return renamed == -1 ? -1 : 0;
+}
+
+int tfs_snapshot(void) { return snapshot_create(); }
+
+int tfs_snapshot_open(int snapshot, char const *name) {
+    // Checks if the path name is valid, and keeps the snapshot from being
+    // deleted meanwhile
+    if (!valid_pathname(name) || strlen(name) > MAX_FILE_NAME ||
+        !snapshot_acquire(snapshot)) {
         return -1;
     }
-    inode_t *target_inode = inode_get(target_inum);
-    // The tecnico fs can only unlink files and symbolic links
-    if (target_inode == NULL) {
-        rwlock_unlock(&link_lock);
+
+    // If the file is a symbolic link, it opens the stored file path (in the
+    // same snapshot), following up to MAX_SYM_LINK_HOPS links
+    char path[MAX_FILE_NAME + 1];
+    strcpy(path, name);
+    int inum;
+    for (size_t hops = 0;; hops++) {
+        inum = snapshot_lookup(snapshot, path + 1);
+        if (inum == -1) {
+            snapshot_release(snapshot);
+            return -1;
+        }
+        rwlock_rdlock(inode_lock_get(inum));
+        inode_t *inode = inode_snapshot_get(inum, snapshot);
+        if (inode == NULL || (inode->i_node_type == T_SYM_LINK &&
+                              (hops == MAX_SYM_LINK_HOPS ||
+                               inode->i_size > MAX_FILE_NAME + 1))) {
+            rwlock_unlock(inode_lock_get(inum));
+            snapshot_release(snapshot);
+            return -1;
+        }
+        if (inode->i_node_type != T_SYM_LINK) {
+            rwlock_unlock(inode_lock_get(inum));
+            break;
+        }
+
+        char const *data = inode_data_get(inode);
+        ALWAYS_ASSERT(data != NULL,
+                      "tfs_snapshot_open: data block deleted mid-read");
+        memcpy(path, data, inode->i_size);
+        inode_data_release(inode, false);
+        rwlock_unlock(inode_lock_get(inum));
+    }
+
+    int fhandle = add_to_open_file_table(inum, 0, false, snapshot, -1);
+    if (fhandle < 0) {
+        snapshot_release(snapshot);
+    }
+
+    return fhandle;
+}
+
+int tfs_snapshot_delete(int snapshot) { return snapshot_delete(snapshot); }
+
+int tfs_stat(char const *name, tfs_file_stat *stat) {
+    // Checks if the path name is valid (the root directory has no entry of
+    // its own)
+    if (stat == NULL || name == NULL) {
+        return -1;
+    }
+    if (strcmp(name, "/") == 0) {
+        return inode_stat(ROOT_DIR_INUM, -1, stat);
+    }
+    if (!valid_pathname(name)) {
         return -1;
     }
-    ALWAYS_ASSERT(target_inode->i_node_type != T_DIRECTORY,
-                  "tfs_unlink: directories cannot be unlinked");
 
-    if (clear_dir_entry(root_dir_inode, target + 1) == -1) {
-        rwlock_unlock(&link_lock);
+    state_io_plug();
+    inode_t *root_dir_inode = inode_get(ROOT_DIR_INUM);
+    ALWAYS_ASSERT(root_dir_inode != NULL,
+                  "tfs_stat: root dir inode must exist");
+    int inum = tfs_lookup(name, root_dir_inode);
+
+    // Fails if the file was deleted in the meantime
+    int result = inum == -1 ? -1 : inode_stat(inum, -1, stat);
+    state_io_unplug();
+
+    return result;
+}
+
+int tfs_fstat(int fhandle, tfs_file_stat *stat) {
+    if (stat == NULL) {
         return -1;
     }
-    mutex_lock(&free_open_file_entries_mutex);
-    // Decreases the hard link counter and when it reaches 0 the file is
-    // deleted if it's not open (needs to lock inode because it changed the hard
-    // link counter)
-    rwlock_wrlock(&inode_locks[target_inum]);
-    target_inode->i_hard_links--;
-    if (target_inode->i_hard_links == 0 && is_file_open(target_inum) == 0) {
-        rwlock_unlock(&inode_locks[target_inum]);
-        inode_delete(target_inum);
-    } else {
-        rwlock_unlock(&inode_locks[target_inum]);
+
+    return stat_open_file(fhandle, stat);
+}
+
+ssize_t tfs_readdir(size_t *cursor, tfs_dir_entry *entries, size_t count) {
+    if (cursor == NULL || (entries == NULL && count > 0)) {
+        return -1;
+    }
+
+    dir_entry_t *dir_entries = malloc(count * sizeof(dir_entry_t));
+    if (dir_entries == NULL && count > 0) {
+        return -1;
     }
-    mutex_unlock(&free_open_file_entries_mutex);
-    rwlock_unlock(&link_lock);
+
+    state_io_plug();
+    inode_t *root_dir_inode = inode_get(ROOT_DIR_INUM);
+    ALWAYS_ASSERT(root_dir_inode != NULL,
+                  "tfs_readdir: root dir inode must exist");
+
+    // Copies the entries first, so the removed ones can be reused while the
+    // metadata of their files is obtained (skipping the files deleted in the
+    // meantime)
+    size_t returned = 0;
+    while (returned < count) {
+        size_t read = read_dir_entries(root_dir_inode, cursor, dir_entries,
+                                       count - returned);
+        if (read == 0) {
+            break;
+        }
+        for (size_t i = 0; i < read; i++) {
+            if (inode_stat(dir_entries[i].d_inumber, -1,
+                           &entries[returned].stat) == 0) {
+                memcpy(entries[returned].name, dir_entries[i].d_name,
+                       MAX_FILE_NAME);
+                returned++;
+            }
+        }
+    }
+    state_io_unplug();
+    free(dir_entries);
+
+    return (ssize_t)returned;
+}
+
+int tfs_get_metadata_stats(tfs_metadata_stats *stats) {
+    if (stats == NULL) {
+        return -1;
+    }
+
+    state_metadata_stats(stats);
+    return 0;
+}
+
+int tfs_get_io_stats(tfs_io_stats *stats) {
+    if (stats == NULL) {
+        return -1;
+    }
+
+    state_io_stats(stats);
+    return 0;
+}
+
+/**
+ * Write the contents of an external file into an open file, mapping them
+ * into memory when possible, so they're copied straight into its data block.
+ *
+ * Input:
+ *   - source_fd: file descriptor of the external file
+ *   - source_stat: metadata of the external file
+ *   - dest_file: file handle of the destination file
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+static int copy_external_contents(int source_fd, struct stat const *source_stat,
+                                  int dest_file) {
+    if (S_ISREG(source_stat->st_mode)) {
+        size_t size = (size_t)source_stat->st_size;
+        if (size == 0) {
+            return 0;
+        }
+        // Reserves the whole block up front, so the file is never moved
+        // while it's written
+        if (tfs_fallocate(dest_file, size) != 0) {
+            return -1;
+        }
+        void *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, source_fd, 0);
+        if (data != MAP_FAILED) {
+            // It's read sequentially, so the OS can read ahead more
+            // aggressively (it's only a hint, so failing is fine)
+            posix_madvise(data, size, POSIX_MADV_SEQUENTIAL);
+            ssize_t written = tfs_write(dest_file, data, size);
+            munmap(data, size); // since the data was read, it can't fail
+            return written == size ? 0 : -1;
+        }
+        posix_fadvise(source_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+
+    // Files that can't be mapped are read a block at a time
+    size_t block_size = state_block_size();
+    char *buffer = malloc(block_size);
+    if (buffer == NULL) {
+        return -1;
+    }
+    ssize_t bytes_read;
+    while ((bytes_read = read(source_fd, buffer, block_size)) != 0) {
+        if (bytes_read == -1 && errno == EINTR) {
+            continue;
+        }
+        if (bytes_read == -1 ||
+            tfs_write(dest_file, buffer, (size_t)bytes_read) != bytes_read) {
+            free(buffer);
+            return -1;
+        }
+    }
+    free(buffer);
 
     return 0;
 }
@@ -315,34 +864,35 @@ int tfs_copy_from_external_fs(char const *source_path, char const *dest_path) {
         return -1;
     }
 
-    // Opens the file from the external fs
-    FILE *source_file = fopen(source_path, "r");
-    if (source_file == NULL) {
+    // Opens the file from the external fs, which can't be copied if it's
+    // larger than any file can be
+    int source_fd = open(source_path, O_RDONLY);
+    if (source_fd == -1) {
+        return -1;
+    }
+    struct stat source_stat;
+    if (fstat(source_fd, &source_stat) != 0 ||
+        (S_ISREG(source_stat.st_mode) &&
+         (size_t)source_stat.st_size > state_block_size())) {
+        close(source_fd); // since we return -1, we can ignore the result
         return -1;
     }
 
     // Opens the destination file in the FS
     int dest_file = tfs_open(dest_path, TFS_O_CREAT | TFS_O_TRUNC);
     if (dest_file == -1) {
-        fclose(source_file); // since we return -1, we can ignore the result
+        close(source_fd); // since we return -1, we can ignore the result
         return -1;
     }
 
-    // Buffers the file data
-    size_t block_size = state_block_size();
-    char buffer[block_size];
-    size_t read;
-    while ((read = fread(buffer, sizeof(char), block_size, source_file)) > 0) {
-        // Writes the data into the file in TecnicoFS
-        if (tfs_write(dest_file, buffer, read) != read) {
-            fclose(source_file);
-            tfs_close(dest_file);
-            return -1;
-        }
+    if (copy_external_contents(source_fd, &source_stat, dest_file) != 0) {
+        close(source_fd);
+        tfs_close(dest_file);
+        return -1;
     }
 
     // Closes the files
-    if (fclose(source_file) != 0) {
+    if (close(source_fd) != 0) {
         tfs_close(dest_file); // since we return -1, we can ignore the result
         return -1;
     }
@@ -352,3 +902,205 @@ int tfs_copy_from_external_fs(char const *source_path, char const *dest_path) {
 
     return 0;
 }
+
+/**
+ * Copies shared by the threads of a tfs_copy_many_from_external_fs call.
+ */
+typedef struct {
+    char const *const *source_paths;
+    char const *const *dest_paths;
+    size_t count;
+    _Atomic size_t next; // index of the next file to be copied
+    _Atomic bool failed;
+} copy_batch_t;
+
+/**
+ * Copy files of a batch until there are none left.
+ *
+ * Input:
+ *   - arg: the batch
+ *
+ * Returns NULL.
+ */
+static void *copy_batch_worker(void *arg) {
+    copy_batch_t *batch = arg;
+
+    size_t i;
+    while ((i = atomic_fetch_add(&batch->next, 1)) < batch->count) {
+        if (tfs_copy_from_external_fs(batch->source_paths[i],
+                                      batch->dest_paths[i]) != 0) {
+            atomic_store(&batch->failed, true);
+        }
+    }
+
+    return NULL;
+}
+
+int tfs_copy_many_from_external_fs(char const *const *source_paths,
+                                   char const *const *dest_paths, size_t count,
+                                   size_t thread_count) {
+    if ((count > 0 && (source_paths == NULL || dest_paths == NULL)) ||
+        thread_count == 0) {
+        return -1;
+    }
+
+    copy_batch_t batch = {
+        .source_paths = source_paths,
+        .dest_paths = dest_paths,
+        .count = count,
+    };
+    atomic_init(&batch.next, 0);
+    atomic_init(&batch.failed, false);
+
+    // The calling thread copies too, besides the threads it starts (as many
+    // as can be started, up to one per file)
+    if (thread_count > count) {
+        thread_count = count > 0 ? count : 1;
+    }
+    pthread_t *threads = malloc((thread_count - 1) * sizeof(pthread_t));
+    size_t started = 0;
+    if (threads != NULL) {
+        while (started < thread_count - 1 &&
+               pthread_create(&threads[started], NULL, copy_batch_worker,
+                              &batch) == 0) {
+            started++;
+        }
+    }
+    copy_batch_worker(&batch);
+    for (size_t i = 0; i < started; i++) {
+        ALWAYS_ASSERT(pthread_join(threads[i], NULL) == 0,
+                      "tfs_copy_many_from_external_fs: failed to join thread");
+    }
+    free(threads);
+
+    return atomic_load(&batch.failed) ? -1 : 0;
+}
+
+/**
+ * Write a buffer to an external file, from its beginning, in chunks of
+ * EXTERNAL_CHUNK_SIZE bytes (as many of them at a time as a single pwritev
+ * takes).
+ *
+ * Input:
+ *   - fd: file descriptor of the external file
+ *   - buffer: the buffer
+ *   - size: size of the buffer
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+static int external_write(int fd, char const *buffer, size_t size) {
+    size_t written = 0;
+    while (written < size) {
+        struct iovec chunks[EXTERNAL_CHUNK_BATCH];
+        int chunk_count = 0;
+        for (size_t offset = written;
+             offset < size && chunk_count < EXTERNAL_CHUNK_BATCH;
+             offset += EXTERNAL_CHUNK_SIZE, chunk_count++) {
+            chunks[chunk_count].iov_base = (void *)(buffer + offset);
+            chunks[chunk_count].iov_len = size - offset < EXTERNAL_CHUNK_SIZE
+                                              ? size - offset
+                                              : EXTERNAL_CHUNK_SIZE;
+        }
+
+        // Writing nothing at all would never make progress
+        ssize_t result = pwritev(fd, chunks, chunk_count, (off_t)written);
+        if ((result == -1 && errno != EINTR) || result == 0) {
+            return -1;
+        }
+        if (result > 0) {
+            written += (size_t)result;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Copy the contents of a file in TécnicoFS to a file in the OS' file system,
+ * leaving its trailing hole (if any) as a hole.
+ *
+ * Input:
+ *   - source_path: absolute path name of the source file (in TécnicoFS)
+ *   - dest_path: path name of the destination file (in the OS' file system)
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+static int copy_file_to_external(char const *source_path,
+                                 char const *dest_path) {
+    int source_file = tfs_open(source_path, 0);
+    if (source_file == -1) {
+        return -1;
+    }
+    int dest_fd = open(dest_path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (dest_fd == -1) {
+        tfs_close(source_file); // since we return -1, we can ignore the result
+        return -1;
+    }
+
+    // The contents are written straight from the file's data block
+    void const *contents;
+    size_t data_size, size;
+    int result = open_file_contents_get(source_file, &contents, &data_size,
+                                        &size);
+    if (result == 0) {
+        result = external_write(dest_fd, contents, data_size);
+        open_file_contents_release(source_file, contents);
+    }
+    if (result == 0 && size > data_size) {
+        result = ftruncate(dest_fd, (off_t)size);
+    }
+
+    if (close(dest_fd) != 0) {
+        result = -1;
+    }
+    if (tfs_close(source_file) == -1) {
+        result = -1;
+    }
+
+    return result == 0 ? 0 : -1;
+}
+
+int tfs_copy_to_external_fs(char const *source_path, char const *dest_path) {
+    if (source_path == NULL || dest_path == NULL || source_path[0] != '/') {
+        return -1;
+    }
+    if (strcmp(source_path, "/") != 0) {
+        return copy_file_to_external(source_path, dest_path);
+    }
+
+    // The whole root directory is copied into a directory, file by file
+    if (mkdir(dest_path, 0777) != 0 && errno != EEXIST) {
+        return -1;
+    }
+    size_t dest_path_len = strlen(dest_path);
+    char *file_dest_path = malloc(dest_path_len + MAX_FILE_NAME + 1);
+    if (file_dest_path == NULL) {
+        return -1;
+    }
+    memcpy(file_dest_path, dest_path, dest_path_len);
+    file_dest_path[dest_path_len] = '/';
+
+    int result = 0;
+    size_t cursor = 0;
+    tfs_dir_entry entries[16];
+    ssize_t count;
+    while ((count = tfs_readdir(&cursor, entries,
+                                sizeof(entries) / sizeof(*entries))) > 0) {
+        for (ssize_t i = 0; i < count; i++) {
+            if (entries[i].stat.type != TFS_T_FILE) {
+                continue; // symbolic links are only names for other files
+            }
+            char file_path[MAX_FILE_NAME + 1] = "/";
+            strcpy(file_path + 1, entries[i].name);
+            strcpy(file_dest_path + dest_path_len + 1, entries[i].name);
+            // Files deleted in the meantime aren't copied
+            if (copy_file_to_external(file_path, file_dest_path) != 0 &&
+                tfs_stat(file_path, &entries[i].stat) == 0) {
+                result = -1;
+            }
+        }
+    }
+    free(file_dest_path);
+
+    return count == -1 ? -1 : result;
+}
@@ -2,19 +2,188 @@
 #define OPERATIONS_H
 
 #include "config.h"
+#include <stdbool.h>
+#include <stdint.h>
 #include <sys/types.h>
 
+/**
+ * TécnicoFS block size class (a separate pool of blocks of the same size).
+ */
+typedef struct {
+    size_t block_size;
+    size_t block_count;
+    size_t block_count_limit;
+} tfs_block_class;
+
+/**
+ * TécnicoFS storage backends (where the data blocks live).
+ */
+typedef enum {
+    // Primary memory (simulating the latency of secondary memory)
+    TFS_STORAGE_MEMORY = 0,
+    // A file mapped into memory
+    TFS_STORAGE_MAPPED_FILE,
+    // A file accessed with direct I/O (bypassing the page cache) through
+    // io_uring
+    TFS_STORAGE_DIRECT_FILE,
+} tfs_storage_t;
+
+/**
+ * How the threads accessing the simulated device wait for it.
+ */
+typedef enum {
+    // Busy wait (the most accurate, but burns the CPU while waiting)
+    TFS_DEVICE_SPIN = 0,
+    // Yield the CPU to other threads while waiting
+    TFS_DEVICE_YIELD,
+    // Sleep until the access is done (the cheapest, but the OS may oversleep
+    // short accesses)
+    TFS_DEVICE_SLEEP,
+} tfs_device_wait_t;
+
+/**
+ * Kinds of devices with a preset model (see tfs_device_preset).
+ */
+typedef enum {
+    TFS_DEVICE_RAM,
+    TFS_DEVICE_NVME,
+    TFS_DEVICE_SATA_SSD,
+} tfs_device_kind_t;
+
+/**
+ * TécnicoFS simulated device model.
+ *
+ * The FS state kept in primary memory (the metadata that misses the metadata
+ * cache, and the data blocks of the memory backend) is accessed as if it
+ * lived in this device. Each access takes the latency of its class plus the
+ * time its bytes take to transfer at the device's bandwidth (0 meaning
+ * unlimited).
+ *
+ * Up to queue_depth accesses are submitted to the device at once (the others
+ * wait for one of them to finish first), and they're served by channels
+ * channels in parallel (each access by the first one to free up); 0 means no
+ * limit on either, in which case accesses never wait for one another.
+ */
+typedef struct {
+    uint64_t metadata_latency_ns;
+    uint64_t read_latency_ns;
+    uint64_t write_latency_ns;
+    uint64_t bandwidth; // in bytes per second
+
+    size_t queue_depth;
+    size_t channels;
+
+    tfs_device_wait_t wait;
+} tfs_device_model;
+
 /**
  * TécnicoFS parameters.
+ *
+ * The main pool has max_block_count blocks of block_size bytes, which is also
+ * the max size of a file. Optionally, up to MAX_BLOCK_CLASSES pools of smaller
+ * blocks (sorted by increasing block size) can be added, in which case small
+ * files and directories use the smallest block that fits their contents, and
+ * files move to bigger blocks as they grow.
+ *
+ * The inode table, the block pools and the open file table start out with the
+ * given counts, and grow online (in chunks of that same size) up to the given
+ * limits, once they fill up. A limit below the initial count means the table
+ * never grows.
+ *
+ * Latency sensitive deployments can back the data blocks and the tables with
+ * huge pages (to spare TLB misses), and prefault all of their memory up front
+ * (to spare page faults on the hot path, at the cost of a slower init).
+ *
+ * The data blocks live in primary memory by default. File storage backends keep
+ * the blocks of each pool in the file storage_path.<pool index> (where the
+ * pools of the block size classes come first), which is created or overwritten.
+ * The direct file backend keeps up to block_cache_size bytes of blocks (split
+ * evenly among the pools) cached in primary memory, or every block if it's 0.
+ *
+ * Up to metadata_cache_size inodes, directory blocks and blocks of the free
+ * maps are cached in primary memory, so only the accesses that miss the cache
+ * (and the write-backs of modified metadata) pay the latency of secondary
+ * memory. A size of 0 disables the cache.
+ *
+ * That latency is the one of the simulated device (see tfs_device_model).
  */
 typedef struct {
     size_t max_inode_count;
     size_t max_block_count;
     size_t max_open_files_count;
 
+    size_t inode_count_limit;
+    size_t block_count_limit;
+    size_t open_files_count_limit;
+
     size_t block_size;
+
+    size_t block_class_count;
+    tfs_block_class block_classes[MAX_BLOCK_CLASSES];
+
+    bool use_huge_pages;
+    bool prefault_memory;
+
+    tfs_storage_t storage_backend;
+    char const *storage_path;
+    size_t block_cache_size;
+
+    size_t metadata_cache_size;
+
+    tfs_device_model device;
 } tfs_params;
 
+/**
+ * TécnicoFS metadata cache statistics (since the FS was initialized).
+ */
+typedef struct {
+    size_t hits;
+    size_t misses;
+    size_t write_backs;
+} tfs_metadata_stats;
+
+/**
+ * TécnicoFS I/O scheduler statistics (since the FS was initialized).
+ *
+ * The accesses to secondary memory made in the course of an FS operation are
+ * merged (those to the same or adjacent blocks), so requests - dispatches of
+ * them were spared, and the I/O amplification of an operation is how many
+ * dispatches (and bytes) it takes.
+ */
+typedef struct {
+    size_t requests;
+    size_t dispatches;
+    size_t bytes;
+} tfs_io_stats;
+
+/**
+ * TécnicoFS file types.
+ */
+typedef enum {
+    TFS_T_FILE,
+    TFS_T_DIRECTORY,
+    TFS_T_SYM_LINK,
+} tfs_file_type_t;
+
+/**
+ * TécnicoFS file metadata.
+ */
+typedef struct {
+    int inumber;
+    tfs_file_type_t type;
+    size_t size;
+    size_t hard_links;
+    uint32_t generation;
+} tfs_file_stat;
+
+/**
+ * TécnicoFS directory entry, along with the metadata of its file.
+ */
+typedef struct {
+    char name[MAX_FILE_NAME];
+    tfs_file_stat stat;
+} tfs_dir_entry;
+
 /**
  * TécnicoFS file opening modes.
  */
@@ -22,6 +191,9 @@ typedef enum {
     TFS_O_CREAT = 0b001,
     TFS_O_TRUNC = 0b010,
     TFS_O_APPEND = 0b100,
+    TFS_O_BUFFERED = 0b1000,
+    TFS_O_COMPRESS = 0b10000,
+    TFS_O_EXCL = 0b100000,
 } tfs_file_mode_t;
 
 /**
@@ -29,6 +201,12 @@ typedef enum {
  */
 tfs_params tfs_default_params();
 
+/**
+ * Return the model of a given kind of device (roughly, for one of its typical
+ * representatives), to use in the parameters of tecnicofs.
+ */
+tfs_device_model tfs_device_preset(tfs_device_kind_t kind);
+
 /**
  * Initialize tecnicofs, optionally with a given configuration.
  * Returns 0 if successful, -1 otherwise.
@@ -42,7 +220,8 @@ int tfs_init(tfs_params const *params);
 int tfs_destroy();
 
 /**
- * Open a file.
+ * Open a file. Symbolic links are followed (up to MAX_SYM_LINK_HOPS of them),
+ * and if the last target doesn't exist, it's the one created.
  *
  * Input:
  *   - name: absolute path name
@@ -50,10 +229,48 @@ int tfs_destroy();
  *     - append mode (TFS_O_APPEND)
  *     - truncate file contents (TFS_O_TRUNC)
  *     - create file if it does not exist (TFS_O_CREAT)
+ *     - buffer small writes (TFS_O_BUFFERED), so many of them cost about the
+ *       same as a single big one; they only reach the file (and become
+ *       visible to other handles) once the buffer fills up, or the handle is
+ *       read from, flushed or closed
+ *     - compress the file contents (TFS_O_COMPRESS), when the file is created
+ *       by this call; its contents are compressed in frames (so they take a
+ *       smaller block), as each of them fills up, which suits files that are
+ *       mostly appended to
+ *     - fail if the file already exists (TFS_O_EXCL), along with TFS_O_CREAT;
+ *       checking and creating it is a single step, where a symbolic link
+ *       with the name counts as an existing file (and isn't followed)
  *
  * Returns file handle of the opened file if successful, -1 otherwise.
  */
 int tfs_open(char const *name, tfs_file_mode_t mode);
+
+/**
+ * Open a file by its inumber (as obtained from tfs_stat, tfs_fstat or
+ * tfs_readdir, along with its generation), without looking it up.
+ *
+ * Input:
+ *   - inumber: inumber of the file
+ *   - generation: generation of the file's inode, so a file deleted since
+ *     (whose inode may be reused by another one) isn't mistaken for it
+ *   - mode: as in tfs_open (except that the file is never created)
+ *
+ * Returns file handle of the opened file if successful, -1 otherwise.
+ */
+int tfs_open_inum(int inumber, uint32_t generation, tfs_file_mode_t mode);
+
+/**
+ * Create a file, without opening it, failing if it already exists (as
+ * tfs_open with TFS_O_CREAT | TFS_O_EXCL, but without taking a file handle).
+ *
+ * Input:
+ *   - name: absolute path name
+ *   - mode: either 0 or compress the file contents (TFS_O_COMPRESS)
+ *
+ * Returns the inumber of the file created if successful, -1 otherwise.
+ */
+int tfs_create(char const *name, tfs_file_mode_t mode);
+
 /**
  * Close a file.
  *
@@ -64,6 +281,42 @@ int tfs_open(char const *name, tfs_file_mode_t mode);
  */
 int tfs_close(int fhandle);
 
+/**
+ * Flush the writes buffered by an open file (opened with TFS_O_BUFFERED) to
+ * the file.
+ *
+ * Input:
+ *   - fhandle: file handle (obtained from a previous call to tfs_open)
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_flush(int fhandle);
+
+/**
+ * Change the size of an open file. Cutting it short discards the end of its
+ * contents, and extending it leaves a hole, that reads as zeros (and takes no
+ * space until it's written to). The offset of the file handle is kept.
+ *
+ * Input:
+ *   - fhandle: file handle (obtained from a previous call to tfs_open)
+ *   - length: the new size (up to the maximum file size)
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_ftruncate(int fhandle, size_t length);
+
+/**
+ * Reserve space for the contents of an open file, so writing it up to a given
+ * size doesn't have to allocate any more space. The size of the file is kept.
+ *
+ * Input:
+ *   - fhandle: file handle (obtained from a previous call to tfs_open)
+ *   - length: size to reserve space for (up to the maximum file size)
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_fallocate(int fhandle, size_t length);
+
 /**
  * Write to an open file, starting at the current offset.
  *
@@ -123,6 +376,123 @@ int tfs_link(char const *target, char const *link);
  */
 int tfs_unlink(char const *target);
 
+/**
+ * Delete many links (and the files whose last link they were) that exist in
+ * TécnicoFS, changing the directory once for all of them.
+ *
+ * Input:
+ *   - targets: path names of the targets (in TécnicoFS)
+ *   - count: number of targets
+ *
+ * Returns the number of links deleted (the targets that don't exist or are
+ * invalid are skipped), or -1 if errors occur.
+ */
+ssize_t tfs_unlink_many(char const *const *targets, size_t count);
+
+/**
+ * Rename a file, symbolic link or hard link that exists in TécnicoFS,
+ * atomically. If a link with the new path name already exists, it's replaced
+ * (as if it was unlinked).
+ *
+ * Input:
+ *   - old_name: path name of the link to rename (in TécnicoFS)
+ *   - new_name: the new path name (in TécnicoFS)
+ *
+ * Returns 0 if successful, -1 otherwise
+ */
+int tfs_rename(char const *old_name, char const *new_name);
+
+/**
+ * Take a snapshot of TécnicoFS: a read-only view of every file as it is now,
+ * which later changes don't affect. Taking it copies nothing (the contents
+ * that change afterwards are copied on write instead), and each file is seen
+ * with every write to it either fully applied or not at all.
+ *
+ * Returns the snapshot if successful, -1 otherwise (if MAX_SNAPSHOTS of them
+ * already exist).
+ */
+int tfs_snapshot(void);
+
+/**
+ * Open a file of a snapshot, for reading (with tfs_read, from the start).
+ *
+ * Input:
+ *   - snapshot: the snapshot (obtained from a previous call to tfs_snapshot)
+ *   - name: absolute path name, in the snapshot
+ *
+ * Returns file handle of the opened file if successful, -1 otherwise.
+ */
+int tfs_snapshot_open(int snapshot, char const *name);
+
+/**
+ * Delete a snapshot, freeing the contents that only it still used.
+ *
+ * Input:
+ *   - snapshot: the snapshot (obtained from a previous call to tfs_snapshot)
+ *
+ * Returns 0 if successful, -1 otherwise (if it has files open).
+ */
+int tfs_snapshot_delete(int snapshot);
+
+/**
+ * Obtain the metadata of a file, symbolic link (which isn't followed) or
+ * directory that exists in TécnicoFS.
+ *
+ * Input:
+ *   - name: absolute path name
+ *   - stat: where to store the metadata
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_stat(char const *name, tfs_file_stat *stat);
+
+/**
+ * Obtain the metadata of an open file (including the writes it buffered).
+ *
+ * Input:
+ *   - fhandle: file handle (obtained from a previous call to tfs_open)
+ *   - stat: where to store the metadata
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_fstat(int fhandle, tfs_file_stat *stat);
+
+/**
+ * Read the entries of the root directory, along with the metadata of their
+ * files, resuming from a cursor. Entries added, renamed or removed while the
+ * directory is being read may or may not be returned.
+ *
+ * Input:
+ *   - cursor: where to resume from (0 to read from the first entry), which is
+ *     advanced past the entries returned
+ *   - entries: where to store the entries
+ *   - count: max number of entries to return
+ *
+ * Returns the number of entries returned (0 once every entry was), or -1 in
+ * case of error.
+ */
+ssize_t tfs_readdir(size_t *cursor, tfs_dir_entry *entries, size_t count);
+
+/**
+ * Obtain the statistics of the metadata cache.
+ *
+ * Input:
+ *   - stats: where to store the statistics
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_get_metadata_stats(tfs_metadata_stats *stats);
+
+/**
+ * Obtain the statistics of the I/O scheduler.
+ *
+ * Input:
+ *   - stats: where to store the statistics
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_get_io_stats(tfs_io_stats *stats);
+
 /**
  * Copy the contents of a file that exists in the OS' file system tree
  * (outside TécnicoFS) to the TécnicoFS.
@@ -136,4 +506,38 @@ int tfs_unlink(char const *target);
  */
 int tfs_copy_from_external_fs(char const *source_path, char const *dest_path);
 
+/**
+ * Copy many files that exist in the OS' file system tree to the TécnicoFS,
+ * in parallel (as tfs_copy_from_external_fs would, one at a time).
+ *
+ * Input:
+ *   - source_paths: path names of the source files
+ *   - dest_paths: absolute path names of the destination files, one for each
+ *     source file
+ *   - count: number of files
+ *   - thread_count: max number of threads copying them (counting the caller)
+ *
+ * Returns 0 if every file was copied, -1 otherwise (in which case the others
+ * are still copied).
+ */
+int tfs_copy_many_from_external_fs(char const *const *source_paths,
+                                   char const *const *dest_paths, size_t count,
+                                   size_t thread_count);
+
+/**
+ * Copy the contents of a file in TécnicoFS to the OS' file system tree, or
+ * every file in TécnicoFS if the source is the root directory (into a
+ * directory, with the same names, skipping the symbolic links).
+ *
+ * Input:
+ *   - source_path: absolute path name of the source file (in TécnicoFS), or
+ *     "/" for the root directory
+ *   - dest_path: path name of the destination file (from the OS' file
+ *     system), which is created if needed, and overwritten if it already
+ *     exists (or of the destination directory, which is created if needed)
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_copy_to_external_fs(char const *source_path, char const *dest_path);
+
 #endif // OPERATIONS_H
@@ -6,10 +6,22 @@
  */
 
 #include "state.h"
+#include "block-cache.h"
+#include "compression.h"
+#include "device.h"
+#include "io-scheduler.h"
+#include "metadata-cache.h"
+#include "storage.h"
 #include "../utils/better-assert.h"
 #include "../utils/better-locks.h"
+#include "../utils/chunked-table.h"
+#include <limits.h>
 #include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -22,80 +34,273 @@
  */
 static tfs_params fs_params;
 
+// The tables below start with the sizes given in tfs_params and grow online,
+// one chunk (of their initial size) at a time, up to the given limits
+
+// Version of an inode that was replaced, but that is still seen by snapshots
+typedef struct inode_version {
+    size_t since; // epoch in which it became the current version
+    allocation_state_t state;
+    inode_t inode;
+    dir_entry_t *dir_entries; // copy of the entries, for directories
+    struct inode_version *next; // next older version
+} inode_version_t;
+
 // Inode table
-static inode_t *inode_table;
-pthread_rwlock_t *inode_locks;
-static allocation_state_t *freeinode_ts;
+typedef struct {
+    inode_t inode;
+    pthread_rwlock_t lock;
+    allocation_state_t state;
+    size_t epoch; // epoch in which the current version of the inode began
+    inode_version_t *versions; // older versions, newest first
+    // Cached resolution of a symbolic link: the namespace generation it was
+    // resolved in (in the upper half) and the inumber of its final target
+    _Atomic uint64_t resolution;
+    // Number of times the inode was deleted, which tells apart the files that
+    // used it
+    uint32_t generation;
+} inode_table_entry_t;
+
+static chunked_table_t inode_table;
 static pthread_rwlock_t freeinode_ts_lock;
 
-// Data blocks
-static char *fs_data; // # blocks * block size
-static pthread_rwlock_t *dir_locks;
-static allocation_state_t *free_blocks;
-static pthread_mutex_t free_blocks_mutex;
+// Namespace generation, advanced every time a directory entry is removed or
+// renamed (which invalidates every cached symbolic link resolution, so they
+// never need to be tracked down; new entries can't change a resolution that
+// succeeded)
+static _Atomic uint32_t namespace_generation;
+
+// Directory entries are read without locking their directory, so the ones
+// removed are only freed once every reader that may be looking at them is
+// done: readers count themselves (in one of the slots, spread among threads)
+// under the current reader epoch, and the writer advances the epoch and waits
+// for the readers counted under the previous one
+#define DIR_READER_SLOTS (64)
+
+typedef struct {
+    _Alignas(64) _Atomic size_t readers[2]; // indexed by the epoch's parity
+} dir_reader_slot_t;
+
+static dir_reader_slot_t dir_reader_slots[DIR_READER_SLOTS];
+static _Atomic size_t dir_reader_epoch;
+static _Atomic size_t dir_reader_next_slot;
+static _Thread_local size_t dir_reader_slot = SIZE_MAX;
+static pthread_mutex_t dir_reclaim_mutex;
+
+// Snapshots of the FS, each of them seeing the versions of the inodes that
+// were current in a given epoch (the epoch advances every time one is taken,
+// so taking one copies nothing: the inodes preserve their current version
+// the first time they're modified afterwards, sharing their data block with
+// it until one of them is written)
+typedef struct {
+    bool taken;
+    size_t epoch;
+    size_t open_files;
+} snapshot_t;
+
+static snapshot_t snapshots[MAX_SNAPSHOTS];
+static size_t fs_epoch;
+static pthread_mutex_t snapshots_mutex;
+
+// A version that says the inode was free (for snapshots that predate every
+// preserved version)
+static inode_version_t free_version = {.state = FREE};
+
+// Data blocks (one pool per block size class, sorted by increasing block size,
+// where the last one is the main pool)
+typedef struct {
+    pthread_rwlock_t dir_lock;
+    allocation_state_t state;
+    bool stored; // whether the storage holds the contents of the block
+    size_t shares; // # of preserved inode versions that also use the block
+} block_table_entry_t;
+
+typedef struct {
+    size_t block_size;
+    storage_t storage;
+    // Caches the blocks in primary memory, when the storage isn't directly
+    // addressable
+    block_cache_t cache;
+    chunked_table_t blocks;
+    pthread_mutex_t free_blocks_mutex;
+} block_pool_t;
+
+static block_pool_t block_pools[MAX_BLOCK_CLASSES + 1];
+static size_t block_pool_count;
 
 // Volatile FS state
-static open_file_entry_t *open_file_table;
-static allocation_state_t *free_open_file_entries;
+typedef struct {
+    open_file_entry_t file;
+    allocation_state_t state;
+    // Handle of the open file while the entry is taken (or anything that
+    // isn't a handle otherwise), so handles are checked without locking
+    _Atomic int fhandle;
+    int generation; // generation of the next handle of the entry
+} open_file_table_entry_t;
+
+static chunked_table_t open_file_table;
 pthread_mutex_t free_open_file_entries_mutex;
 
+static metadata_cache_t metadata_cache;
+
+// Simulated device where the metadata (and the data blocks of the memory
+// backend) would live
+static device_t device;
+static io_scheduler_t io_scheduler;
+
+// Whether zeroed memory already holds ready to use locks, in which case the
+// (zeroed) tables don't need their locks initialized or destroyed one by one
+static bool zeroed_locks;
+
 // Convenience macros
-#define INODE_TABLE_SIZE (fs_params.max_inode_count)
-#define DATA_BLOCKS (fs_params.max_block_count)
-#define MAX_OPEN_FILES (fs_params.max_open_files_count)
+#define INODE_TABLE_SIZE (chunked_table_size(&inode_table))
+#define MAX_OPEN_FILES (chunked_table_size(&open_file_table))
 #define BLOCK_SIZE (fs_params.block_size)
-#define MAX_DIR_ENTRIES (BLOCK_SIZE / sizeof(dir_entry_t))
+#define MAX_DIR_ENTRIES(inode) ((inode)->i_size / sizeof(dir_entry_t))
+
+// A block number holds the index of its pool in the upper bits, and the index
+// of the block inside that pool in the lower BLOCK_INDEX_BITS bits
+#define BLOCK_INDEX_BITS (24)
+#define BLOCK_INDEX_MASK ((1 << BLOCK_INDEX_BITS) - 1)
+#define BLOCK_POOL(block_number)                                               \
+    (&block_pools[(block_number) >> BLOCK_INDEX_BITS])
+#define BLOCK_INDEX(block_number) ((size_t)((block_number)&BLOCK_INDEX_MASK))
+
+static inline inode_table_entry_t *inode_table_entry(int inumber) {
+    return chunked_table_get(&inode_table, (size_t)inumber);
+}
+
+// A file handle holds the index of its entry in the open file table in the
+// lower FILE_HANDLE_INDEX_BITS bits, and the generation of the entry in the
+// upper ones (which advances, skipping 0, every time the entry is freed, so
+// the handles of closed files don't refer to the files that reuse it)
+#define FILE_HANDLE_INDEX_BITS (16)
+#define FILE_HANDLE_INDEX_MASK ((1 << FILE_HANDLE_INDEX_BITS) - 1)
+#define FILE_HANDLE_GENERATIONS (1 << (31 - FILE_HANDLE_INDEX_BITS))
+#define FILE_HANDLE_INDEX(fhandle) ((size_t)((fhandle)&FILE_HANDLE_INDEX_MASK))
+
+static inline block_table_entry_t *block_table_entry(int block_number) {
+    return chunked_table_get(&BLOCK_POOL(block_number)->blocks,
+                             BLOCK_INDEX(block_number));
+}
+
+static inline open_file_table_entry_t *open_file_table_entry(size_t index) {
+    return chunked_table_get(&open_file_table, index);
+}
 
 static inline bool valid_inumber(int inumber) {
     return inumber >= 0 && inumber < INODE_TABLE_SIZE;
 }
 
 static inline bool valid_block_number(int block_number) {
-    return block_number >= 0 && block_number < DATA_BLOCKS;
+    return block_number >= 0 &&
+           (size_t)(block_number >> BLOCK_INDEX_BITS) < block_pool_count &&
+           BLOCK_INDEX(block_number) <
+               chunked_table_size(&BLOCK_POOL(block_number)->blocks);
 }
 
 static inline bool valid_file_handle(int file_handle) {
-    return file_handle >= 0 && file_handle < MAX_OPEN_FILES;
+    return file_handle >= 0 && FILE_HANDLE_INDEX(file_handle) < MAX_OPEN_FILES;
 }
 
 static inline bool valid_file_content(int inumber) {
-    return valid_inumber(inumber) && freeinode_ts[inumber] == TAKEN;
+    return valid_inumber(inumber) && inode_table_entry(inumber)->state == TAKEN;
 }
 
 /**
- * Do nothing, while preventing the compiler from performing any optimizations.
- *
- * We need to defeat the optimizer for the insert_delay() function.
- * Under optimization, the empty loop would be completely optimized away.
- * This function tells the compiler that the assembly code being run (which is
- * none) might potentially change *all memory in the process*.
- *
- * This prevents the optimizer from optimizing this code away, because it does
- * not know what it does and it may have side effects.
+ * Access FS metadata through the metadata cache, simulating the latency of
+ * secondary memory for every trip to it that the access takes.
  *
- * Reference with more information: https://youtu.be/nXaxk27zwlk?t=2775
+ * Input:
+ *   - kind: kind of the metadata
+ *   - id: identifier of the metadata (among those of its kind)
+ *   - write: whether the metadata is modified
+ */
+static void metadata_access(metadata_kind_t kind, uint64_t id, bool write) {
+    size_t trips = metadata_cache_access(&metadata_cache, kind, id, write);
+    if (trips == 0) {
+        return;
+    }
+
+    // Each kind of metadata has a region of the device of its own (the data
+    // blocks take the first one), where the inodes are packed into blocks
+    uint64_t block =
+        kind == META_INODE ? id * sizeof(inode_t) / BLOCK_SIZE : id;
+    for (size_t i = 0; i < trips; i++) {
+        io_submit(&io_scheduler, DEVICE_METADATA, (uint64_t)kind << 56 | block,
+                  BLOCK_SIZE);
+    }
+}
+
+/**
+ * Identifier of the block of the free map of a pool that holds the state of
+ * a given entry (of the inode table, when pool_i is 0 and kind is
+ * META_FREE_INODE_MAP).
+ */
+static inline uint64_t free_map_block(size_t pool_i, size_t i) {
+    return (uint64_t)pool_i << 32 |
+           (i * sizeof(allocation_state_t) / BLOCK_SIZE);
+}
+
+/**
+ * Initialize the locks of the entries of a table, from first up to (but not
+ * including) last. Does nothing when the zeroed entries already hold ready to
+ * use locks.
  *
- * Exercise: try removing this function and look at the assembly generated to
- * compare.
+ * Input:
+ *   - table: the table
+ *   - lock_offset: offset of the lock inside an entry
+ *   - is_rwlock: whether the lock is a rwlock (or a mutex)
+ *   - first, last: range of entries
  */
-static void touch_all_memory(void) { __asm volatile("" : : : "memory"); }
+static void table_locks_init(chunked_table_t *table, size_t lock_offset,
+                             bool is_rwlock, size_t first, size_t last) {
+    if (zeroed_locks) {
+        return;
+    }
+
+    for (size_t i = first; i < last; i++) {
+        void *lock = (char *)chunked_table_get(table, i) + lock_offset;
+        if (is_rwlock) {
+            rwlock_init(lock);
+        } else {
+            mutex_init(lock);
+        }
+    }
+}
 
 /**
- * Artifically delay execution (busy loop).
+ * Destroy the locks of all the entries of a table. Does nothing when the
+ * locks were never initialized one by one.
  *
- * Auxiliary function to insert a delay.
- * Used in accesses to persistent FS state as a way of emulating access
- * latencies as if such data structures were really stored in secondary memory.
+ * Input:
+ *   - table: the table
+ *   - lock_offset: offset of the lock inside an entry
+ *   - is_rwlock: whether the lock is a rwlock (or a mutex)
  */
-static void insert_delay(void) {
-    for (int i = 0; i < DELAY; i++) {
-        touch_all_memory();
+static void table_locks_destroy(chunked_table_t *table, size_t lock_offset,
+                                bool is_rwlock) {
+    if (zeroed_locks) {
+        return;
+    }
+
+    for (size_t i = 0; i < chunked_table_size(table); i++) {
+        void *lock = (char *)chunked_table_get(table, i) + lock_offset;
+        if (is_rwlock) {
+            rwlock_destroy(lock);
+        } else {
+            mutex_destroy(lock);
+        }
     }
 }
 
 /**
  * Initialize FS state.
  *
+ * The tables are zeroed on demand by the kernel and, where the platform allows
+ * it, their locks are ready to use as zeroed memory, so the cost doesn't
+ * depend on the size of the tables.
+ *
  * Input:
  *   - params: TécnicoFS parameters
  *
@@ -103,47 +308,120 @@ static void insert_delay(void) {
  *
  * Possible errors:
  *   - TFS already initialized.
+ *   - Invalid block size classes, or device model.
+ *   - Too many blocks or open files.
  *   - malloc failure when allocating TFS structures.
  */
 int state_init(tfs_params params) {
     fs_params = params;
 
-    if (inode_table != NULL) {
+    if (inode_table.chunks != NULL) {
         return -1; // already initialized
     }
+    zeroed_locks = locks_zero_initialized();
+    // Zeroed resolutions are from generation 0, so they're never valid
+    atomic_store(&namespace_generation, 1);
+
+    // Makes sure the block size classes are sorted and smaller than the main
+    // block size
+    if (params.block_class_count > MAX_BLOCK_CLASSES) {
+        return -1;
+    }
+    for (size_t i = 0; i < params.block_class_count; i++) {
+        size_t next_block_size = i + 1 < params.block_class_count
+                                     ? params.block_classes[i + 1].block_size
+                                     : params.block_size;
+        if (params.block_classes[i].block_size == 0 ||
+            params.block_classes[i].block_size >= next_block_size) {
+            return -1;
+        }
+    }
 
-    inode_table = malloc(INODE_TABLE_SIZE * sizeof(inode_t));
-    inode_locks = malloc(INODE_TABLE_SIZE * sizeof(pthread_rwlock_t));
-    freeinode_ts = malloc(INODE_TABLE_SIZE * sizeof(allocation_state_t));
-    fs_data = malloc(DATA_BLOCKS * BLOCK_SIZE);
-    dir_locks = malloc(DATA_BLOCKS * sizeof(pthread_rwlock_t));
-    free_blocks = malloc(DATA_BLOCKS * sizeof(allocation_state_t));
-    open_file_table = malloc(MAX_OPEN_FILES * sizeof(open_file_entry_t));
-    free_open_file_entries =
-        malloc(MAX_OPEN_FILES * sizeof(allocation_state_t));
+    if (params.max_open_files_count > FILE_HANDLE_INDEX_MASK + 1 ||
+        params.open_files_count_limit > FILE_HANDLE_INDEX_MASK + 1) {
+        return -1; // file handles wouldn't fit in an int
+    }
 
-    if (!inode_table || !inode_locks || !freeinode_ts || !fs_data ||
-        !dir_locks || !free_blocks || !open_file_table ||
-        !free_open_file_entries) {
+    int table_flags = (params.use_huge_pages ? CHUNKED_TABLE_HUGE_PAGES : 0) |
+                      (params.prefault_memory ? CHUNKED_TABLE_PREFAULT : 0);
+    if (device_init(&device, &params.device) != 0 ||
+        metadata_cache_init(&metadata_cache, params.metadata_cache_size) !=
+            0 ||
+        chunked_table_init(&inode_table, sizeof(inode_table_entry_t),
+                           params.max_inode_count, params.inode_count_limit,
+                           table_flags) != 0 ||
+        chunked_table_init(&open_file_table, sizeof(open_file_table_entry_t),
+                           params.max_open_files_count,
+                           params.open_files_count_limit, table_flags) != 0) {
         return -1; // allocation failed
     }
+    io_scheduler_init(&io_scheduler, &device);
+
+    block_pool_count = params.block_class_count + 1;
+    for (size_t i = 0; i < block_pool_count; i++) {
+        block_pool_t *pool = &block_pools[i];
+        size_t block_count, block_count_limit;
+        if (i < params.block_class_count) {
+            pool->block_size = params.block_classes[i].block_size;
+            block_count = params.block_classes[i].block_count;
+            block_count_limit = params.block_classes[i].block_count_limit;
+        } else {
+            pool->block_size = params.block_size;
+            block_count = params.max_block_count;
+            block_count_limit = params.block_count_limit;
+        }
+        if (block_count > BLOCK_INDEX_MASK + 1 ||
+            block_count_limit > BLOCK_INDEX_MASK + 1) {
+            return -1; // block numbers wouldn't fit in an int
+        }
 
-    for (size_t i = 0; i < INODE_TABLE_SIZE; i++) {
-        freeinode_ts[i] = FREE;
-        rwlock_init(&inode_locks[i]);
+        char path[PATH_MAX];
+        if (params.storage_path != NULL &&
+            snprintf(path, sizeof(path), "%s.%zu", params.storage_path, i) >=
+                sizeof(path)) {
+            return -1; // storage path too long
+        }
+        if (storage_open(&pool->storage, params.storage_backend,
+                         params.storage_path != NULL ? path : NULL,
+                         pool->block_size, block_count, block_count_limit,
+                         table_flags) != 0) {
+            return -1; // storage failure
+        }
+        // The cache budget is split evenly among the pools
+        size_t frame_count = pool->storage.block_count_limit;
+        if (params.block_cache_size > 0 &&
+            params.block_cache_size / block_pool_count / pool->block_size <
+                frame_count) {
+            frame_count =
+                params.block_cache_size / block_pool_count / pool->block_size;
+            frame_count = frame_count > 0 ? frame_count : 1;
+        }
+        if ((!storage_addressable(&pool->storage) &&
+             block_cache_init(&pool->cache, &pool->storage, frame_count,
+                              table_flags) != 0) ||
+            chunked_table_init(&pool->blocks, sizeof(block_table_entry_t),
+                               block_count, block_count_limit,
+                               table_flags) != 0) {
+            return -1; // allocation failed
+        }
+        table_locks_init(&pool->blocks, offsetof(block_table_entry_t, dir_lock),
+                         true, 0, block_count);
+        mutex_init(&pool->free_blocks_mutex);
     }
+
+    // The tables start out zeroed, so every entry is already FREE
+    table_locks_init(&inode_table, offsetof(inode_table_entry_t, lock), true,
+                     0, params.max_inode_count);
     rwlock_init(&freeinode_ts_lock);
 
-    for (size_t i = 0; i < DATA_BLOCKS; i++) {
-        free_blocks[i] = FREE;
-        rwlock_init(&dir_locks[i]);
-    }
-    mutex_init(&free_blocks_mutex);
+    memset(snapshots, 0, sizeof(snapshots));
+    fs_epoch = 0;
+    mutex_init(&snapshots_mutex);
+    mutex_init(&dir_reclaim_mutex);
 
-    for (size_t i = 0; i < MAX_OPEN_FILES; i++) {
-        free_open_file_entries[i] = FREE;
-        mutex_init(&open_file_table[i].mutex);
-    }
+    table_locks_init(&open_file_table,
+                     offsetof(open_file_table_entry_t, file.mutex), false, 0,
+                     params.max_open_files_count);
     mutex_init(&free_open_file_entries_mutex);
 
     return 0;
@@ -155,76 +433,170 @@ int state_init(tfs_params params) {
  * Returns 0 if successful, -1 otherwise.
  */
 int state_destroy(void) {
-    if (inode_table == NULL) {
+    if (inode_table.chunks == NULL) {
         return -1; // already destroyed
     }
 
+    // The writes buffered by the files left open still reach them
+    for (size_t i = 0; i < MAX_OPEN_FILES; i++) {
+        open_file_table_entry_t *entry = open_file_table_entry(i);
+        if (entry->state != TAKEN) {
+            continue;
+        }
+        int fhandle = atomic_load(&entry->fhandle);
+        if (flush_open_file(fhandle) == -1) {
+            WARN("failed to flush the writes buffered by file handle %d",
+                 fhandle);
+        }
+        free(entry->file.of_write_buffer);
+        entry->file.of_write_buffer = NULL;
+    }
+
+    // The preserved versions only hold memory (their blocks go away with the
+    // pools)
     for (size_t i = 0; i < INODE_TABLE_SIZE; i++) {
-        rwlock_destroy(&inode_locks[i]);
+        inode_version_t *version = inode_table_entry((int)i)->versions;
+        while (version != NULL) {
+            inode_version_t *next = version->next;
+            free(version->dir_entries);
+            free(version);
+            version = next;
+        }
     }
+    mutex_destroy(&snapshots_mutex);
+    mutex_destroy(&dir_reclaim_mutex);
+
+    table_locks_destroy(&inode_table, offsetof(inode_table_entry_t, lock),
+                        true);
     rwlock_destroy(&freeinode_ts_lock);
 
-    for (size_t i = 0; i < DATA_BLOCKS; i++) {
-        rwlock_destroy(&dir_locks[i]);
-    }
-    mutex_destroy(&free_blocks_mutex);
+    for (size_t i = 0; i < block_pool_count; i++) {
+        block_pool_t *pool = &block_pools[i];
+        table_locks_destroy(&pool->blocks,
+                            offsetof(block_table_entry_t, dir_lock), true);
+        mutex_destroy(&pool->free_blocks_mutex);
 
-    for (size_t i = 0; i < MAX_OPEN_FILES; i++) {
-        mutex_destroy(&open_file_table[i].mutex);
+        if (pool->storage.ops != NULL &&
+            !storage_addressable(&pool->storage) &&
+            block_cache_destroy(&pool->cache) != 0) {
+            WARN("failed to write back the cache of block pool %zu", i);
+        }
+        if (storage_close(&pool->storage) != 0) {
+            WARN("failed to flush the storage of block pool %zu", i);
+        }
+        chunked_table_destroy(&pool->blocks);
     }
+    block_pool_count = 0;
+
+    table_locks_destroy(&open_file_table,
+                        offsetof(open_file_table_entry_t, file.mutex), false);
     mutex_destroy(&free_open_file_entries_mutex);
 
-    free(inode_table);
-    free(inode_locks);
-    free(freeinode_ts);
-    free(fs_data);
-    free(dir_locks);
-    free(free_blocks);
-    free(open_file_table);
-    free(free_open_file_entries);
-
-    inode_table = NULL;
-    inode_locks = NULL;
-    freeinode_ts = NULL;
-    fs_data = NULL;
-    dir_locks = NULL;
-    free_blocks = NULL;
-    open_file_table = NULL;
-    free_open_file_entries = NULL;
+    chunked_table_destroy(&inode_table);
+    chunked_table_destroy(&open_file_table);
+
+    // Writes back the metadata modified since it was cached (the cache only
+    // counts it, so the write-backs have no address and aren't merged)
+    io_submit_unaddressed(&io_scheduler, DEVICE_METADATA,
+                          metadata_cache_destroy(&metadata_cache), BLOCK_SIZE);
+    device_destroy(&device);
 
     return 0;
 }
 
 size_t state_block_size(void) { return BLOCK_SIZE; }
 
+/**
+ * Obtain the statistics of the metadata cache.
+ *
+ * Input:
+ *   - stats: where to store the statistics
+ */
+void state_metadata_stats(tfs_metadata_stats *stats) {
+    stats->hits = atomic_load(&metadata_cache.hits);
+    stats->misses = atomic_load(&metadata_cache.misses);
+    stats->write_backs = atomic_load(&metadata_cache.write_backs);
+}
+
+/**
+ * Obtain the statistics of the I/O scheduler.
+ *
+ * Input:
+ *   - stats: where to store the statistics
+ */
+void state_io_stats(tfs_io_stats *stats) {
+    stats->requests = atomic_load(&io_scheduler.requests);
+    stats->dispatches = atomic_load(&io_scheduler.dispatches);
+    stats->bytes = atomic_load(&io_scheduler.bytes);
+}
+
+/**
+ * Start an FS operation, whose accesses to secondary memory are merged (see
+ * io_plug). Operations nest.
+ */
+void state_io_plug(void) { io_plug(&io_scheduler); }
+
+/**
+ * End an FS operation, paying for its (merged) accesses to secondary memory
+ * once it's the outermost one.
+ */
+void state_io_unplug(void) { io_unplug(&io_scheduler); }
+
 /**
  * (Try to) Allocate a new inode in the inode table, without initializing its
- * data.
+ * data. When the table is full, it grows (up to its limit).
  *
  * Returns the inumber of the newly allocated inode, or -1 in the case of error.
  *
  * Possible errors:
- *   - No free slots in inode table.
+ *   - No free slots in inode table, and it can't grow anymore.
  */
 static int inode_alloc(void) {
     rwlock_wrlock(&freeinode_ts_lock);
     for (size_t inumber = 0; inumber < INODE_TABLE_SIZE; inumber++) {
         if ((inumber * sizeof(allocation_state_t) % BLOCK_SIZE) == 0) {
-            insert_delay(); // simulate storage access delay (to freeinode_ts)
+            // access to freeinode_ts
+            metadata_access(META_FREE_INODE_MAP, free_map_block(0, inumber),
+                            false);
         }
 
         // Finds first free entry in inode table
-        if (freeinode_ts[inumber] == FREE) {
-            // Found a free entry, so takes it for the new inode
-            freeinode_ts[inumber] = TAKEN;
+        inode_table_entry_t *entry = inode_table_entry((int)inumber);
+        if (entry->state == FREE) {
+            // Found a free entry, so takes it for the new inode (the
+            // snapshots may need to know it was free)
+            rwlock_wrlock(&entry->lock);
+            if (inode_preserve((int)inumber) != 0) {
+                rwlock_unlock(&entry->lock);
+                rwlock_unlock(&freeinode_ts_lock);
+                return -1;
+            }
+            metadata_access(META_FREE_INODE_MAP, free_map_block(0, inumber),
+                            true);
+            entry->state = TAKEN;
+            rwlock_unlock(&entry->lock);
             rwlock_unlock(&freeinode_ts_lock);
 
             return (int)inumber;
         }
     }
+
+    // No free entries, so tries to grow the table and takes the first new one
+    ssize_t first = chunked_table_grow(&inode_table);
+    if (first == -1) {
+        rwlock_unlock(&freeinode_ts_lock);
+        return -1; // no free inodes
+    }
+    table_locks_init(&inode_table, offsetof(inode_table_entry_t, lock), true,
+                     (size_t)first, INODE_TABLE_SIZE);
+    metadata_access(META_FREE_INODE_MAP, free_map_block(0, (size_t)first),
+                    true);
+    // New entries have no older versions, so it only records the epoch
+    inode_preserve((int)first);
+    inode_table_entry((int)first)->state = TAKEN;
     rwlock_unlock(&freeinode_ts_lock);
 
-    return -1; // no free inodes
+    return (int)first;
 }
 
 /**
@@ -232,8 +604,10 @@ static int inode_alloc(void) {
  *
  * Allocates and initializes a new inode.
  * Directories will have their data block allocated and initialized, with i_size
- * set to BLOCK_SIZE. Regular files will not have their data block allocated
- * (i_size will be set to 0, i_data_block to -1).
+ * set to the size of that block (the smallest one that fits an entry for every
+ * inode, if there is one). Regular files and symbolic links will not have their
+ * data block allocated (i_size will be set to 0, i_data_block to -1), since
+ * their contents start out inline.
  *
  * Input:
  *   - i_type: the type of the node (file or directory)
@@ -250,46 +624,61 @@ int inode_create(inode_type i_type) {
         return -1; // no free slots in inode table
     }
 
-    inode_t *inode = &inode_table[inumber];
-    insert_delay(); // simulate storage access delay (to inode)
+    // Its inumber may still be held by whoever looked up the inode it
+    // replaces, so it's initialized with the inode locked
+    inode_t *inode = &inode_table_entry(inumber)->inode;
+    rwlock_wrlock(inode_lock_get(inumber));
+    metadata_access(META_INODE, (uint64_t)inumber, true);
 
     inode->i_node_type = i_type;
     switch (i_type) {
     case T_DIRECTORY: {
         // Initializes directory (filling its block with empty entries, labeled
         // with inumber==-1)
-        int b = data_block_alloc();
+        int b = data_block_alloc(inode_table_size() * sizeof(dir_entry_t));
         if (b == -1) {
             // ensure fields are initialized
             inode->i_size = 0;
+            inode->i_data_size = 0;
             inode->i_data_block = -1;
+            rwlock_unlock(inode_lock_get(inumber));
 
             // run regular deletion process
             inode_delete(inumber);
             return -1;
         }
 
-        inode_table[inumber].i_size = BLOCK_SIZE;
-        inode_table[inumber].i_data_block = b;
+        inode->i_size = data_block_size(b);
+        inode->i_data_size = inode->i_size;
+        inode->i_data_block = b;
 
         dir_entry_t *dir_entry = (dir_entry_t *)data_block_get(b);
         ALWAYS_ASSERT(dir_entry != NULL,
                       "inode_create: data block freed while in use");
 
-        for (size_t i = 0; i < MAX_DIR_ENTRIES; i++) {
+        for (size_t i = 0; i < MAX_DIR_ENTRIES(inode); i++) {
             dir_entry[i].d_inumber = -1;
         }
+        if (data_block_release(b, true) != 0) {
+            rwlock_unlock(inode_lock_get(inumber));
+            inode_delete(inumber);
+            return -1;
+        }
     } break;
     case T_FILE:
     case T_SYM_LINK:
         // In case of a new file or symbolic link, simply sets its size to 0
-        inode_table[inumber].i_size = 0;
-        inode_table[inumber].i_data_block = -1;
+        inode->i_size = 0;
+        inode->i_data_size = 0;
+        inode->i_data_block = -1;
         break;
     default:
         PANIC("inode_create: unknown file type");
     }
-    inode_table[inumber].i_hard_links = 1;
+    inode->i_hard_links = 1;
+    inode->i_compressed = false;
+    inode->i_stored_size = 0;
+    rwlock_unlock(inode_lock_get(inumber));
 
     return inumber;
 }
@@ -301,26 +690,31 @@ int inode_create(inode_type i_type) {
  *   - inumber: inode's number
  */
 void inode_delete(int inumber) {
-    // simulate storage access delay (to inode and freeinode_ts)
-    insert_delay();
-    insert_delay();
-
     ALWAYS_ASSERT(valid_inumber(inumber), "inode_delete: invalid inumber");
 
+    // access to inode and freeinode_ts
+    metadata_access(META_INODE, (uint64_t)inumber, true);
+    metadata_access(META_FREE_INODE_MAP, free_map_block(0, (size_t)inumber),
+                    true);
+
+    inode_table_entry_t *entry = inode_table_entry(inumber);
     rwlock_wrlock(&freeinode_ts_lock);
-    ALWAYS_ASSERT(freeinode_ts[inumber] == TAKEN,
-                  "inode_delete: inode already freed");
+    ALWAYS_ASSERT(entry->state == TAKEN, "inode_delete: inode already freed");
 
-    rwlock_wrlock(&inode_locks[inumber]);
-    if (inode_table[inumber].i_size > 0) {
-        data_block_free(inode_table[inumber].i_data_block);
+    rwlock_wrlock(&entry->lock);
+    ALWAYS_ASSERT(inode_preserve(inumber) == 0,
+                  "inode_delete: failed to preserve the inode for snapshots");
+    if (entry->inode.i_data_block != -1) {
+        data_block_free(entry->inode.i_data_block);
     }
-    inode_table[inumber].i_size = 0;
-    inode_table[inumber].i_data_block = -1;
-    inode_table[inumber].i_hard_links = 1;
-
-    freeinode_ts[inumber] = FREE;
-    rwlock_unlock(&inode_locks[inumber]);
+    entry->inode.i_size = 0;
+    entry->inode.i_data_size = 0;
+    entry->inode.i_data_block = -1;
+    entry->inode.i_hard_links = 1;
+
+    entry->state = FREE;
+    entry->generation++;
+    rwlock_unlock(&entry->lock);
     rwlock_unlock(&freeinode_ts_lock);
 }
 
@@ -335,11 +729,336 @@ void inode_delete(int inumber) {
 inode_t *inode_get(int inumber) {
     ALWAYS_ASSERT(valid_inumber(inumber), "inode_get: invalid inumber");
 
-    insert_delay(); // simulate storage access delay to inode
-    return &inode_table[inumber];
+    metadata_access(META_INODE, (uint64_t)inumber, false);
+    return &inode_table_entry(inumber)->inode;
+}
+
+/**
+ * Check whether an inumber is valid and its inode exists (which can only be
+ * relied on while the inode is locked).
+ *
+ * Input:
+ *   - inumber: the inumber
+ *
+ * Returns true if the inode exists, false otherwise.
+ */
+bool inode_exists(int inumber) {
+    return valid_inumber(inumber) &&
+           inode_table_entry(inumber)->state == TAKEN;
+}
+
+/**
+ * Obtain the generation of an inode, which advances every time it's deleted
+ * (so it tells apart the files that used it). Must be called with the inode
+ * locked.
+ *
+ * Input:
+ *   - inumber: the inumber
+ *
+ * Returns the generation.
+ */
+uint32_t inode_generation_get(int inumber) {
+    ALWAYS_ASSERT(valid_inumber(inumber),
+                  "inode_generation_get: invalid inumber");
+
+    return inode_table_entry(inumber)->generation;
+}
+
+/**
+ * Obtain the metadata of an inode (or of the version of it that a snapshot
+ * sees).
+ *
+ * Input:
+ *   - inumber: inode's number
+ *   - snapshot: the snapshot, or -1 for the current version of the inode
+ *   - stat: where to store the metadata
+ *
+ * Returns 0 if successful, -1 otherwise (if the inode doesn't exist).
+ */
+int inode_stat(int inumber, int snapshot, tfs_file_stat *stat) {
+    ALWAYS_ASSERT(valid_inumber(inumber), "inode_stat: invalid inumber");
+
+    rwlock_rdlock(inode_lock_get(inumber));
+    inode_t const *inode = NULL;
+    if (snapshot != -1) {
+        inode = inode_snapshot_get(inumber, snapshot);
+    } else if (inode_table_entry(inumber)->state == TAKEN) {
+        inode = inode_get(inumber);
+    }
+    if (inode == NULL) {
+        rwlock_unlock(inode_lock_get(inumber));
+        return -1;
+    }
+
+    stat->inumber = inumber;
+    switch (inode->i_node_type) {
+    case T_FILE:
+        stat->type = TFS_T_FILE;
+        break;
+    case T_DIRECTORY:
+        stat->type = TFS_T_DIRECTORY;
+        break;
+    case T_SYM_LINK:
+        stat->type = TFS_T_SYM_LINK;
+        break;
+    default:
+        PANIC("inode_stat: unknown file type");
+    }
+    // The size of a symbolic link is the length of its target path (without
+    // the terminator stored along with it)
+    stat->size = inode->i_node_type == T_SYM_LINK ? inode->i_size - 1
+                                                  : inode->i_size;
+    stat->hard_links = inode->i_hard_links;
+    stat->generation = inode_table_entry(inumber)->generation;
+    rwlock_unlock(inode_lock_get(inumber));
+
+    return 0;
+}
+
+/**
+ * Returns the current namespace generation, in which symbolic links being
+ * resolved from now on are resolved.
+ */
+uint32_t namespace_generation_get(void) {
+    return atomic_load(&namespace_generation);
+}
+
+/**
+ * Obtain the cached final target of a symbolic link.
+ *
+ * Input:
+ *   - inumber: inumber of the symbolic link
+ *
+ * Returns the inumber of the final target, or -1 if the link isn't cached
+ * (or a directory entry was removed or renamed since it was).
+ */
+int sym_link_cache_get(int inumber) {
+    ALWAYS_ASSERT(valid_inumber(inumber),
+                  "sym_link_cache_get: invalid inumber");
+
+    uint64_t resolution = atomic_load_explicit(
+        &inode_table_entry(inumber)->resolution, memory_order_acquire);
+    if ((uint32_t)(resolution >> 32) != atomic_load(&namespace_generation)) {
+        return -1;
+    }
+
+    return (int)(uint32_t)resolution;
+}
+
+/**
+ * Cache the final target of a symbolic link.
+ *
+ * Input:
+ *   - inumber: inumber of the symbolic link
+ *   - generation: namespace generation the link was resolved in (obtained
+ *     before resolving it, so it's never valid if an entry was removed or
+ *     renamed since)
+ *   - target: inumber of the final target
+ */
+void sym_link_cache_put(int inumber, uint32_t generation, int target) {
+    ALWAYS_ASSERT(valid_inumber(inumber) && valid_inumber(target),
+                  "sym_link_cache_put: invalid inumber");
+
+    atomic_store_explicit(&inode_table_entry(inumber)->resolution,
+                          (uint64_t)generation << 32 | (uint32_t)target,
+                          memory_order_release);
+}
+
+/**
+ * Obtain the lock of an inode from its inumber.
+ *
+ * Input:
+ *   - inumber: inode's number
+ *
+ * Returns pointer to the lock.
+ */
+pthread_rwlock_t *inode_lock_get(int inumber) {
+    ALWAYS_ASSERT(valid_inumber(inumber), "inode_lock_get: invalid inumber");
+
+    return &inode_table_entry(inumber)->lock;
+}
+
+/**
+ * Obtain a pointer to the contents of an inode, which are either stored inline
+ * or in its data block.
+ *
+ * Input:
+ *   - inode: the inode
+ *
+ * Returns a pointer to the first byte of the inode contents.
+ */
+void *inode_data_get(inode_t *inode) {
+    ALWAYS_ASSERT(inode != NULL, "inode_data_get: inode must be non-NULL");
+
+    if (inode->i_data_block == -1) {
+        return inode->i_inline_data;
+    }
+
+    return data_block_get(inode->i_data_block);
+}
+
+/**
+ * Release the contents of an inode, obtained with inode_data_get. Must be
+ * called before the inode is unlocked.
+ *
+ * Input:
+ *   - inode: the inode
+ *   - dirty: whether the contents were modified
+ *
+ * Returns 0 if successful, -1 otherwise.
+ *
+ * Possible errors:
+ *   - The modified contents couldn't be written to the storage.
+ */
+int inode_data_release(inode_t *inode, bool dirty) {
+    ALWAYS_ASSERT(inode != NULL, "inode_data_release: inode must be non-NULL");
+
+    if (inode->i_data_block == -1) {
+        return 0; // inline contents are part of the inode itself
+    }
+
+    return data_block_release(inode->i_data_block, dirty);
+}
+
+/**
+ * Returns the max number of inodes the inode table can grow to.
+ */
+size_t inode_table_size(void) { return chunked_table_max_size(&inode_table); }
+
+/**
+ * Obtain the lock of the directory that uses a given block (taken by its
+ * writers and by snapshot lookups, since its current entries are read
+ * without it).
+ *
+ * Input:
+ *   - block_number: the block number of the directory
+ *
+ * Returns pointer to the lock.
+ */
+static pthread_rwlock_t *dir_lock_get(int block_number) {
+    ALWAYS_ASSERT(valid_block_number(block_number),
+                  "dir_lock_get: invalid block number");
+
+    return &block_table_entry(block_number)->dir_lock;
+}
+
+/**
+ * Begin reading directory entries without locking their directory, which
+ * keeps the entries removed meanwhile from being reused until dir_read_end.
+ *
+ * Returns the counter the reader counted itself in (to be passed to
+ * dir_read_end).
+ */
+static _Atomic size_t *dir_read_begin(void) {
+    if (dir_reader_slot == SIZE_MAX) {
+        dir_reader_slot =
+            atomic_fetch_add(&dir_reader_next_slot, 1) % DIR_READER_SLOTS;
+    }
+    dir_reader_slot_t *slot = &dir_reader_slots[dir_reader_slot];
+
+    while (true) {
+        size_t epoch = atomic_load(&dir_reader_epoch);
+        _Atomic size_t *readers = &slot->readers[epoch % 2];
+        atomic_fetch_add(readers, 1);
+        // If the epoch advanced before the reader was counted, the writer
+        // advancing it may not wait for the reader, so it counts itself again
+        if (atomic_load(&dir_reader_epoch) == epoch) {
+            return readers;
+        }
+        atomic_fetch_sub(readers, 1);
+    }
+}
+
+/**
+ * End reading directory entries, begun with dir_read_begin.
+ *
+ * Input:
+ *   - readers: the counter returned by dir_read_begin
+ */
+static void dir_read_end(_Atomic size_t *readers) {
+    atomic_fetch_sub_explicit(readers, 1, memory_order_release);
+}
+
+/**
+ * Make the removed entries of a directory free to be reused, waiting until
+ * every reader that may still see them is done. Must be called with the
+ * directory write-locked (and outside of any read of directory entries).
+ *
+ * Input:
+ *   - dir_entry: the directory entries
+ *   - entry_count: number of entries
+ *
+ * Returns whether any entry was freed.
+ */
+static bool dir_entries_reclaim(dir_entry_t *dir_entry, size_t entry_count) {
+    bool removed = false;
+    for (size_t i = 0; i < entry_count && !removed; i++) {
+        removed = dir_entry[i].d_inumber == DIR_ENTRY_REMOVED;
+    }
+    if (!removed) {
+        return false;
+    }
+
+    // Readers that begin from now on count themselves under the next epoch,
+    // so only the ones counted under the current one are waited for
+    mutex_lock(&dir_reclaim_mutex);
+    size_t epoch = atomic_fetch_add(&dir_reader_epoch, 1);
+    for (size_t i = 0; i < DIR_READER_SLOTS; i++) {
+        while (atomic_load(&dir_reader_slots[i].readers[epoch % 2]) > 0) {
+            sched_yield();
+        }
+    }
+    mutex_unlock(&dir_reclaim_mutex);
+
+    for (size_t i = 0; i < entry_count; i++) {
+        if (dir_entry[i].d_inumber == DIR_ENTRY_REMOVED) {
+            atomic_store_explicit(&dir_entry[i].d_inumber, -1,
+                                  memory_order_relaxed);
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Look for a free entry in a directory, reclaiming the removed ones if there
+ * is none. Must be called with the directory write-locked.
+ *
+ * Input:
+ *   - dir_entry: the directory entries
+ *   - entry_count: number of entries
+ *
+ * Returns the index of the entry, or entry_count if the directory is full.
+ */
+static size_t dir_entries_find_free(dir_entry_t *dir_entry,
+                                    size_t entry_count) {
+    do {
+        for (size_t i = 0; i < entry_count; i++) {
+            if (dir_entry[i].d_inumber == -1) {
+                return i;
+            }
+        }
+    } while (dir_entries_reclaim(dir_entry, entry_count));
+
+    return entry_count;
 }
 
-size_t inode_table_size(void) { return INODE_TABLE_SIZE; }
+/**
+ * Fill a free directory entry, making it visible to readers once it's
+ * complete. Must be called with the directory write-locked.
+ *
+ * Input:
+ *   - entry: the directory entry
+ *   - sub_name: sub file name
+ *   - sub_inumber: inumber of the sub inode
+ */
+static void dir_entry_publish(dir_entry_t *entry, char const *sub_name,
+                              int sub_inumber) {
+    strncpy(entry->d_name, sub_name, MAX_FILE_NAME - 1);
+    entry->d_name[MAX_FILE_NAME - 1] = '\0';
+    atomic_store_explicit(&entry->d_inumber, sub_inumber,
+                          memory_order_release);
+}
 
 /**
  * Store the inumber for a sub file in a directory.
@@ -365,39 +1084,59 @@ int add_dir_entry(inode_t *inode, char const *sub_name, int sub_inumber) {
         return -1; // invalid sub_name or invalid sub_inumber
     }
 
-    insert_delay(); // simulate storage access delay to inode with inumber
     if (inode->i_node_type != T_DIRECTORY) {
         return -1; // not a directory
     }
+    metadata_access(META_DIR_BLOCK, (uint64_t)inode->i_data_block, false);
 
     // Locates the block containing the entries of the directory
     dir_entry_t *dir_entry = (dir_entry_t *)data_block_get(inode->i_data_block);
     ALWAYS_ASSERT(dir_entry != NULL,
                   "add_dir_entry: directory must have a data block");
 
-    rwlock_wrlock(&dir_locks[inode->i_data_block]);
-    // Makes sure another entry with the same name doesn't exist
-    for (size_t i = 0; i < MAX_DIR_ENTRIES; i++) {
-        if ((dir_entry[i].d_inumber != -1) &&
-            (strcmp(dir_entry[i].d_name, sub_name) == 0)) {
-            rwlock_unlock(&dir_locks[inode->i_data_block]);
+    rwlock_wrlock(dir_lock_get(inode->i_data_block));
+    // Makes sure another entry with the same name doesn't exist, finding the
+    // first free entry in the same pass
+    size_t entry_count = MAX_DIR_ENTRIES(inode);
+    size_t i = entry_count;
+    for (size_t j = 0; j < entry_count; j++) {
+        int entry_inumber = dir_entry[j].d_inumber;
+        if (entry_inumber >= 0 && strcmp(dir_entry[j].d_name, sub_name) == 0) {
+            data_block_release(inode->i_data_block, false);
+            rwlock_unlock(dir_lock_get(inode->i_data_block));
             return -1;
         }
+        if (entry_inumber == -1 && i == entry_count) {
+            i = j;
+        }
     }
 
-    // Finds and fills the first empty entry
-    for (size_t i = 0; i < MAX_DIR_ENTRIES; i++) {
-        if (dir_entry[i].d_inumber == -1) {
-            dir_entry[i].d_inumber = sub_inumber;
-            strncpy(dir_entry[i].d_name, sub_name, MAX_FILE_NAME - 1);
-            dir_entry[i].d_name[MAX_FILE_NAME - 1] = '\0';
-            rwlock_unlock(&dir_locks[inode->i_data_block]);
-            return 0;
-        }
+    // Fills the free entry (reclaiming the removed ones if there is none, and
+    // preserving the entries for the snapshots first, where the root is the
+    // only directory)
+    if (i == entry_count) {
+        i = dir_entries_find_free(dir_entry, entry_count);
+    }
+    if (i == entry_count || inode_preserve(ROOT_DIR_INUM) != 0) {
+        data_block_release(inode->i_data_block, false);
+        rwlock_unlock(dir_lock_get(inode->i_data_block));
+        return -1; // no space for entry
+    }
+    // A new name can't change the resolutions that succeeded, so the cached
+    // ones stay valid
+    dir_entry_publish(&dir_entry[i], sub_name, sub_inumber);
+    metadata_access(META_DIR_BLOCK, (uint64_t)inode->i_data_block, true);
+    if (data_block_release(inode->i_data_block, true) != 0) {
+        // Readers may have seen the entry already (and resolved links
+        // through it)
+        dir_entry[i].d_inumber = DIR_ENTRY_REMOVED;
+        atomic_fetch_add(&namespace_generation, 1);
+        rwlock_unlock(dir_lock_get(inode->i_data_block));
+        return -1;
     }
-    rwlock_unlock(&dir_locks[inode->i_data_block]);
+    rwlock_unlock(dir_lock_get(inode->i_data_block));
 
-    return -1; // no space for entry
+    return 0;
 }
 
 /**
@@ -422,176 +1161,1298 @@ int clear_dir_entry(inode_t *inode, char const *sub_name) {
         return -1; // invalid sub_name
     }
 
-    insert_delay();
     if (inode->i_node_type != T_DIRECTORY) {
         return -1; // not a directory
     }
+    metadata_access(META_DIR_BLOCK, (uint64_t)inode->i_data_block, false);
 
     // Locates the block containing the entries of the directory
     dir_entry_t *dir_entry = (dir_entry_t *)data_block_get(inode->i_data_block);
     ALWAYS_ASSERT(dir_entry != NULL,
                   "clear_dir_entry: directory must have a data block");
 
-    rwlock_wrlock(&dir_locks[inode->i_data_block]);
-    for (size_t i = 0; i < MAX_DIR_ENTRIES; i++) {
-        if (!strcmp(dir_entry[i].d_name, sub_name)) {
-            dir_entry[i].d_inumber = -1;
-            memset(dir_entry[i].d_name, 0, MAX_FILE_NAME);
-            rwlock_unlock(&dir_locks[inode->i_data_block]);
-            return 0;
+    rwlock_wrlock(dir_lock_get(inode->i_data_block));
+    for (size_t i = 0; i < MAX_DIR_ENTRIES(inode); i++) {
+        if (dir_entry[i].d_inumber >= 0 &&
+            !strcmp(dir_entry[i].d_name, sub_name)) {
+            // Preserves the entries for the snapshots first (the root is the
+            // only directory)
+            if (inode_preserve(ROOT_DIR_INUM) != 0) {
+                break;
+            }
+            // Readers may still be looking at the entry, so it's only
+            // reused once they're done
+            dir_entry[i].d_inumber = DIR_ENTRY_REMOVED;
+            atomic_fetch_add(&namespace_generation, 1);
+            metadata_access(META_DIR_BLOCK, (uint64_t)inode->i_data_block,
+                            true);
+            // The entry is gone from memory either way, so a failed write
+            // only leaves it behind in the storage
+            int result = data_block_release(inode->i_data_block, true);
+            rwlock_unlock(dir_lock_get(inode->i_data_block));
+            return result;
         }
     }
-    rwlock_unlock(&dir_locks[inode->i_data_block]);
+    data_block_release(inode->i_data_block, false);
+    rwlock_unlock(dir_lock_get(inode->i_data_block));
 
     return -1; // sub_name not found
 }
 
 /**
- * Obtain the inumber for a sub file inside a directory.
+ * Clear the directory entries associated with many sub files, locking and
+ * scanning the directory once.
  *
  * Input:
  *   - inode: directory inode
- *   - sub_name: sub file name
+ *   - sub_names: sub file names (NULL ones are skipped)
+ *   - count: number of sub file names
+ *   - sub_inumbers: where to store the inumber each entry cleared linked to
+ *     (or -1 if the directory didn't contain an entry for the name)
  *
- * Returns inumber linked to the target name, -1 if errors occur.
+ * Returns the number of entries cleared, or -1 if errors occur.
  *
  * Possible errors:
  *   - inode is not a directory inode.
- *   - Directory does not contain a file named sub_name.
  */
-int find_in_dir(inode_t const *inode, char const *sub_name) {
-    ALWAYS_ASSERT(inode != NULL, "find_in_dir: inode must be non-NULL");
+ssize_t clear_dir_entries(inode_t *inode, char const *const *sub_names,
+                          size_t count, int *sub_inumbers) {
+    ALWAYS_ASSERT(inode != NULL, "clear_dir_entries: inode must be non-NULL");
+    ALWAYS_ASSERT(count == 0 || (sub_names != NULL && sub_inumbers != NULL),
+                  "clear_dir_entries: names must be non-NULL");
+
+    if (inode->i_node_type != T_DIRECTORY) {
+        return -1; // not a directory
+    }
+    for (size_t i = 0; i < count; i++) {
+        sub_inumbers[i] = -1;
+    }
+    if (count == 0) {
+        return 0;
+    }
+    metadata_access(META_DIR_BLOCK, (uint64_t)inode->i_data_block, false);
+
+    // Locates the block containing the entries of the directory
+    dir_entry_t *dir_entry = (dir_entry_t *)data_block_get(inode->i_data_block);
+    ALWAYS_ASSERT(dir_entry != NULL,
+                  "clear_dir_entries: directory must have a data block");
+
+    rwlock_wrlock(dir_lock_get(inode->i_data_block));
+    // Preserves the entries for the snapshots first (the root is the only
+    // directory)
+    if (inode_preserve(ROOT_DIR_INUM) != 0) {
+        data_block_release(inode->i_data_block, false);
+        rwlock_unlock(dir_lock_get(inode->i_data_block));
+        return -1;
+    }
+    ssize_t cleared = 0;
+    for (size_t i = 0; i < MAX_DIR_ENTRIES(inode) && cleared < count; i++) {
+        if (dir_entry[i].d_inumber < 0) {
+            continue;
+        }
+        for (size_t j = 0; j < count; j++) {
+            if (sub_names[j] != NULL && sub_inumbers[j] == -1 &&
+                strcmp(dir_entry[i].d_name, sub_names[j]) == 0) {
+                // Readers may still be looking at the entry, so it's only
+                // reused once they're done
+                sub_inumbers[j] = dir_entry[i].d_inumber;
+                dir_entry[i].d_inumber = DIR_ENTRY_REMOVED;
+                cleared++;
+                break;
+            }
+        }
+    }
+    if (cleared == 0) {
+        data_block_release(inode->i_data_block, false);
+        rwlock_unlock(dir_lock_get(inode->i_data_block));
+        return 0;
+    }
+    atomic_fetch_add(&namespace_generation, 1);
+    metadata_access(META_DIR_BLOCK, (uint64_t)inode->i_data_block, true);
+    // The entries are gone from memory either way, so a failed write only
+    // leaves them behind in the storage
+    data_block_release(inode->i_data_block, true);
+    rwlock_unlock(dir_lock_get(inode->i_data_block));
+
+    return cleared;
+}
+
+/**
+ * Read the entries of a directory, resuming from a cursor.
+ *
+ * Input:
+ *   - inode: directory inode
+ *   - cursor: index of the first entry slot to look at, which is advanced
+ *     past the entries read
+ *   - entries: where to store the entries
+ *   - count: max number of entries to read
+ *
+ * Returns the number of entries read (0 if there are no more of them).
+ */
+size_t read_dir_entries(inode_t const *inode, size_t *cursor,
+                        dir_entry_t *entries, size_t count) {
+    ALWAYS_ASSERT(inode != NULL, "read_dir_entries: inode must be non-NULL");
+    ALWAYS_ASSERT(inode->i_node_type == T_DIRECTORY,
+                  "read_dir_entries: inode must be a directory");
+    metadata_access(META_DIR_BLOCK, (uint64_t)inode->i_data_block, false);
+
+    // Locates the block containing the entries of the directory
+    dir_entry_t *dir_entry = (dir_entry_t *)data_block_get(inode->i_data_block);
+    ALWAYS_ASSERT(dir_entry != NULL,
+                  "read_dir_entries: directory must have a data block");
+
+    _Atomic size_t *readers = dir_read_begin();
+    size_t read = 0;
+    for (; *cursor < MAX_DIR_ENTRIES(inode) && read < count; (*cursor)++) {
+        int sub_inumber = atomic_load_explicit(&dir_entry[*cursor].d_inumber,
+                                               memory_order_acquire);
+        if (sub_inumber >= 0) {
+            memcpy(entries[read].d_name, dir_entry[*cursor].d_name,
+                   MAX_FILE_NAME);
+            entries[read].d_inumber = sub_inumber;
+            read++;
+        }
+    }
+    data_block_release(inode->i_data_block, false);
+    dir_read_end(readers);
+
+    return read;
+}
+
+/**
+ * Rename the directory entry of a sub file, replacing the entry that already
+ * has the new name (if any), atomically.
+ *
+ * Input:
+ *   - inode: directory inode
+ *   - sub_name: sub file name
+ *   - new_name: new sub file name
+ *   - replaced: where to store the inumber of the replaced entry (or -1 if
+ *     no entry was replaced)
+ *
+ * Returns 0 if successful, -1 otherwise.
+ *
+ * Possible errors:
+ *   - inode is not a directory inode.
+ *   - sub_name or new_name are not valid file names.
+ *   - Directory does not contain an entry for sub_name.
+ *   - Directory is full (when no entry has the new name).
+ */
+int rename_dir_entry(inode_t *inode, char const *sub_name,
+                     char const *new_name, int *replaced) {
+    ALWAYS_ASSERT(inode != NULL, "rename_dir_entry: inode must be non-NULL");
+    ALWAYS_ASSERT(sub_name != NULL && new_name != NULL,
+                  "rename_dir_entry: names must be non-NULL");
+
+    *replaced = -1;
+    if (strlen(sub_name) == 0 || strlen(sub_name) > MAX_FILE_NAME - 1 ||
+        strlen(new_name) == 0 || strlen(new_name) > MAX_FILE_NAME - 1) {
+        return -1; // invalid sub_name or new_name
+    }
+
+    if (inode->i_node_type != T_DIRECTORY) {
+        return -1; // not a directory
+    }
+    metadata_access(META_DIR_BLOCK, (uint64_t)inode->i_data_block, false);
+
+    // Locates the block containing the entries of the directory
+    dir_entry_t *dir_entry = (dir_entry_t *)data_block_get(inode->i_data_block);
+    ALWAYS_ASSERT(dir_entry != NULL,
+                  "rename_dir_entry: directory must have a data block");
+
+    rwlock_wrlock(dir_lock_get(inode->i_data_block));
+    // Finds the entries with both names
+    size_t entry_count = MAX_DIR_ENTRIES(inode);
+    size_t old_entry = entry_count;
+    size_t new_entry = entry_count;
+    for (size_t i = 0; i < entry_count; i++) {
+        if (dir_entry[i].d_inumber < 0) {
+            continue;
+        }
+        if (strcmp(dir_entry[i].d_name, sub_name) == 0) {
+            old_entry = i;
+        } else if (strcmp(dir_entry[i].d_name, new_name) == 0) {
+            new_entry = i;
+        }
+    }
+    if (old_entry == entry_count) {
+        data_block_release(inode->i_data_block, false);
+        rwlock_unlock(dir_lock_get(inode->i_data_block));
+        return -1; // sub_name not found
+    }
+    int sub_inumber = dir_entry[old_entry].d_inumber;
+    if (strcmp(sub_name, new_name) == 0 ||
+        (new_entry != entry_count &&
+         dir_entry[new_entry].d_inumber == sub_inumber)) {
+        // Both names already link to the same file
+        data_block_release(inode->i_data_block, false);
+        rwlock_unlock(dir_lock_get(inode->i_data_block));
+        return 0;
+    }
+
+    // Entries being read can't be renamed in place, so a new one is filled
+    // for the new name (when it has none), and published before the old one
+    // is removed (so the file can always be found under one of them)
+    if (new_entry == entry_count) {
+        new_entry = dir_entries_find_free(dir_entry, entry_count);
+    }
+    // Preserves the entries for the snapshots first (the root is the only
+    // directory)
+    if (new_entry == entry_count || inode_preserve(ROOT_DIR_INUM) != 0) {
+        data_block_release(inode->i_data_block, false);
+        rwlock_unlock(dir_lock_get(inode->i_data_block));
+        return -1;
+    }
+    if (dir_entry[new_entry].d_inumber >= 0) {
+        // Points the entry with the new name to the file
+        *replaced = dir_entry[new_entry].d_inumber;
+        atomic_store_explicit(&dir_entry[new_entry].d_inumber, sub_inumber,
+                              memory_order_release);
+    } else {
+        dir_entry_publish(&dir_entry[new_entry], new_name, sub_inumber);
+    }
+    dir_entry[old_entry].d_inumber = DIR_ENTRY_REMOVED;
+    atomic_fetch_add(&namespace_generation, 1);
+    metadata_access(META_DIR_BLOCK, (uint64_t)inode->i_data_block, true);
+    // The entries changed in memory either way, so a failed write only
+    // leaves the old ones behind in the storage
+    int result = data_block_release(inode->i_data_block, true);
+    rwlock_unlock(dir_lock_get(inode->i_data_block));
+
+    return result;
+}
+
+/**
+ * Look for the entry of a sub file among the entries of a directory.
+ *
+ * Input:
+ *   - dir_entry: the directory entries
+ *   - entry_count: number of entries
+ *   - sub_name: sub file name
+ *
+ * Returns inumber linked to the target name, or -1 if there is none.
+ */
+static int dir_entries_find(dir_entry_t const *dir_entry, size_t entry_count,
+                            char const *sub_name) {
+    // Iterates over the directory entries looking for one that has the target
+    // name (whose name is complete once its inumber is seen)
+    for (size_t i = 0; i < entry_count; i++) {
+        int sub_inumber = atomic_load_explicit(&dir_entry[i].d_inumber,
+                                               memory_order_acquire);
+        if (sub_inumber >= 0 &&
+            (strncmp(dir_entry[i].d_name, sub_name, MAX_FILE_NAME) == 0)) {
+            return sub_inumber;
+        }
+    }
+
+    return -1; // entry not found
+}
+
+/**
+ * Obtain the inumber for a sub file inside a directory, without locking the
+ * directory.
+ *
+ * Input:
+ *   - inode: directory inode
+ *   - sub_name: sub file name
+ *
+ * Returns inumber linked to the target name, -1 if errors occur.
+ *
+ * Possible errors:
+ *   - inode is not a directory inode.
+ *   - Directory does not contain a file named sub_name.
+ */
+int find_in_dir(inode_t const *inode, char const *sub_name) {
+    ALWAYS_ASSERT(inode != NULL, "find_in_dir: inode must be non-NULL");
     ALWAYS_ASSERT(sub_name != NULL, "find_in_dir: sub_name must be non-NULL");
 
     if (strlen(sub_name) == 0 || strlen(sub_name) > MAX_FILE_NAME - 1) {
         return -1; // invalid sub_name
     }
 
-    insert_delay(); // simulate storage access delay to inode with inumber
     if (inode->i_node_type != T_DIRECTORY) {
         return -1; // not a directory
     }
+    metadata_access(META_DIR_BLOCK, (uint64_t)inode->i_data_block, false);
 
     // Locates the block containing the entries of the directory
     dir_entry_t *dir_entry = (dir_entry_t *)data_block_get(inode->i_data_block);
     ALWAYS_ASSERT(dir_entry != NULL,
                   "find_in_dir: directory inode must have a data block");
 
-    rwlock_rdlock(&dir_locks[inode->i_data_block]);
-    // Iterates over the directory entries looking for one that has the target
-    // name
-    for (int i = 0; i < MAX_DIR_ENTRIES; i++) {
-        if ((dir_entry[i].d_inumber != -1) &&
-            (strncmp(dir_entry[i].d_name, sub_name, MAX_FILE_NAME) == 0)) {
-            int sub_inumber = dir_entry[i].d_inumber;
-            rwlock_unlock(&dir_locks[inode->i_data_block]);
-            return sub_inumber;
+    _Atomic size_t *readers = dir_read_begin();
+    int sub_inumber =
+        dir_entries_find(dir_entry, MAX_DIR_ENTRIES(inode), sub_name);
+    data_block_release(inode->i_data_block, false);
+    dir_read_end(readers);
+
+    return sub_inumber;
+}
+
+/**
+ * Allocate a new data block from a given pool.
+ *
+ * Input:
+ *   - pool_i: index of the pool
+ *
+ * Returns block number if successful, -1 otherwise.
+ *
+ * Possible errors:
+ *   - No free data blocks in the pool, and it can't grow anymore.
+ */
+static int data_block_alloc_from_pool(size_t pool_i) {
+    block_pool_t *pool = &block_pools[pool_i];
+
+    mutex_lock(&pool->free_blocks_mutex);
+    size_t block_count = chunked_table_size(&pool->blocks);
+    for (size_t i = 0; i < block_count; i++) {
+        if (i * sizeof(allocation_state_t) % BLOCK_SIZE == 0) {
+            // access to free_blocks
+            metadata_access(META_FREE_BLOCK_MAP, free_map_block(pool_i, i),
+                            false);
+        }
+
+        block_table_entry_t *entry = chunked_table_get(&pool->blocks, i);
+        if (entry->state == FREE) {
+            metadata_access(META_FREE_BLOCK_MAP, free_map_block(pool_i, i),
+                            true);
+            entry->state = TAKEN;
+            mutex_unlock(&pool->free_blocks_mutex);
+
+            return (int)((pool_i << BLOCK_INDEX_BITS) | i);
+        }
+    }
+
+    // No free blocks, so tries to grow the pool and takes the first new one
+    // (the storage may already have grown in a previous attempt, in case
+    // growing the block table itself failed then)
+    if (storage_resize(&pool->storage, block_count + 1) != 0 ||
+        chunked_table_grow(&pool->blocks) == -1) {
+        mutex_unlock(&pool->free_blocks_mutex);
+        return -1; // no free data blocks
+    }
+    table_locks_init(&pool->blocks, offsetof(block_table_entry_t, dir_lock),
+                     true, block_count, chunked_table_size(&pool->blocks));
+    metadata_access(META_FREE_BLOCK_MAP, free_map_block(pool_i, block_count),
+                    true);
+    ((block_table_entry_t *)chunked_table_get(&pool->blocks, block_count))
+        ->state = TAKEN;
+    mutex_unlock(&pool->free_blocks_mutex);
+
+    return (int)((pool_i << BLOCK_INDEX_BITS) | block_count);
+}
+
+/**
+ * Allocate a new data block, from the pool with the smallest blocks that can
+ * hold size bytes (or from the next ones, if that pool is full). When no pool
+ * has blocks big enough, allocates from the main pool.
+ *
+ * Input:
+ *   - size: number of bytes the block must be able to hold
+ *
+ * Returns block number if successful, -1 otherwise.
+ *
+ * Possible errors:
+ *   - No free data blocks.
+ */
+int data_block_alloc(size_t size) {
+    size_t pool_i = 0;
+    while (pool_i + 1 < block_pool_count &&
+           block_pools[pool_i].block_size < size) {
+        pool_i++;
+    }
+
+    for (; pool_i < block_pool_count; pool_i++) {
+        int block_number = data_block_alloc_from_pool(pool_i);
+        if (block_number != -1) {
+            return block_number;
+        }
+    }
+
+    return -1; // no free data blocks
+}
+
+/**
+ * Free a data block (or, if preserved inode versions share it, give up on
+ * using it, so the last user frees it).
+ *
+ * Input:
+ *   - block_number: the block number/index
+ */
+void data_block_free(int block_number) {
+    ALWAYS_ASSERT(valid_block_number(block_number),
+                  "data_block_free: invalid block number");
+
+    block_pool_t *pool = BLOCK_POOL(block_number);
+    mutex_lock(&pool->free_blocks_mutex);
+    if (block_table_entry(block_number)->shares > 0) {
+        block_table_entry(block_number)->shares--;
+        mutex_unlock(&pool->free_blocks_mutex);
+        return;
+    }
+    mutex_unlock(&pool->free_blocks_mutex);
+
+    // access to free_blocks
+    metadata_access(META_FREE_BLOCK_MAP,
+                    free_map_block((size_t)block_number >> BLOCK_INDEX_BITS,
+                                   BLOCK_INDEX(block_number)),
+                    true);
+
+    if (!storage_addressable(&pool->storage)) {
+        // Its contents are garbage now, so they are never written back
+        block_cache_forget(&pool->cache, BLOCK_INDEX(block_number));
+    }
+
+    mutex_lock(&pool->free_blocks_mutex);
+    block_table_entry(block_number)->stored = false;
+    block_table_entry(block_number)->state = FREE;
+    mutex_unlock(&pool->free_blocks_mutex);
+}
+
+/**
+ * Share a data block with one more user (a preserved inode version), which
+ * frees it with data_block_free too.
+ *
+ * Input:
+ *   - block_number: the block number/index
+ */
+static void data_block_share(int block_number) {
+    block_pool_t *pool = BLOCK_POOL(block_number);
+    mutex_lock(&pool->free_blocks_mutex);
+    block_table_entry(block_number)->shares++;
+    mutex_unlock(&pool->free_blocks_mutex);
+}
+
+/**
+ * Returns whether a data block is shared (so it must be copied before being
+ * written).
+ */
+static bool data_block_shared(int block_number) {
+    block_pool_t *pool = BLOCK_POOL(block_number);
+    mutex_lock(&pool->free_blocks_mutex);
+    bool shared = block_table_entry(block_number)->shares > 0;
+    mutex_unlock(&pool->free_blocks_mutex);
+
+    return shared;
+}
+
+/**
+ * Obtain a pointer to the contents of a given block (which stays in the block
+ * cache until released, when the storage isn't directly addressable). Every
+ * call must be paired with a call to data_block_release.
+ *
+ * Input:
+ *   - block_number: the block number/index
+ *
+ * Returns a pointer to the first byte of the block, or NULL if it couldn't be
+ * read from the storage.
+ */
+void *data_block_get(int block_number) {
+    ALWAYS_ASSERT(valid_block_number(block_number),
+                  "data_block_get: invalid block number");
+
+    block_pool_t *pool = BLOCK_POOL(block_number);
+    if (!storage_addressable(&pool->storage)) {
+        // Blocks that were never written don't need to be read
+        return block_cache_get(&pool->cache, BLOCK_INDEX(block_number),
+                               block_table_entry(block_number)->stored);
+    }
+
+    if (pool->storage.ops->simulated) {
+        io_submit(&io_scheduler, DEVICE_DATA_READ, (uint64_t)block_number,
+                  pool->block_size);
+    }
+    return storage_block_map(&pool->storage, BLOCK_INDEX(block_number));
+}
+
+/**
+ * Prefetch the contents of a given block into the block cache, in the
+ * background (when the storage isn't directly addressable).
+ *
+ * Input:
+ *   - block_number: the block number/index
+ */
+void data_block_prefetch(int block_number) {
+    ALWAYS_ASSERT(valid_block_number(block_number),
+                  "data_block_prefetch: invalid block number");
+
+    block_pool_t *pool = BLOCK_POOL(block_number);
+    if (!storage_addressable(&pool->storage) &&
+        block_table_entry(block_number)->stored) {
+        block_cache_prefetch(&pool->cache, BLOCK_INDEX(block_number));
+    }
+}
+
+/**
+ * Release the contents of a given block, obtained with data_block_get. Modified
+ * blocks are written back to the storage by the block cache (when it isn't
+ * directly addressable), so it must be called while the contents are still
+ * locked.
+ *
+ * Input:
+ *   - block_number: the block number/index
+ *   - dirty: whether the contents were modified
+ *
+ * Returns 0 if successful, -1 otherwise (failures to write the contents back
+ * in the background are only reported when the FS is destroyed).
+ */
+int data_block_release(int block_number, bool dirty) {
+    ALWAYS_ASSERT(valid_block_number(block_number),
+                  "data_block_release: invalid block number");
+
+    block_pool_t *pool = BLOCK_POOL(block_number);
+    if (storage_addressable(&pool->storage)) {
+        if (dirty && pool->storage.ops->simulated) {
+            io_submit(&io_scheduler, DEVICE_DATA_WRITE,
+                      (uint64_t)block_number, pool->block_size);
+        }
+        return 0;
+    }
+
+    if (dirty) {
+        block_table_entry(block_number)->stored = true;
+    }
+    block_cache_release(&pool->cache, BLOCK_INDEX(block_number), dirty);
+    return 0;
+}
+
+/**
+ * Obtain the size of a given block, which depends on the pool it belongs to.
+ *
+ * Input:
+ *   - block_number: the block number
+ *
+ * Returns the size of the block (in bytes).
+ */
+size_t data_block_size(int block_number) {
+    ALWAYS_ASSERT(valid_block_number(block_number),
+                  "data_block_size: invalid block number");
+
+    return BLOCK_POOL(block_number)->block_size;
+}
+
+/**
+ * Returns whether a snapshot sees the versions of inodes that were current
+ * from epoch since up to (but not including) epoch until. Must be called with
+ * snapshots_mutex held.
+ */
+static bool snapshot_sees(size_t since, size_t until) {
+    for (size_t i = 0; i < MAX_SNAPSHOTS; i++) {
+        if (snapshots[i].taken && snapshots[i].epoch >= since &&
+            snapshots[i].epoch < until) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Free a preserved inode version, along with its share of the data block.
+ *
+ * Input:
+ *   - version: the version
+ */
+static void inode_version_free(inode_version_t *version) {
+    if (version->state == TAKEN && version->dir_entries == NULL &&
+        version->inode.i_data_block != -1) {
+        data_block_free(version->inode.i_data_block);
+    }
+    free(version->dir_entries);
+    free(version);
+}
+
+/**
+ * Preserve the current version of an inode (its contents, or the fact that
+ * it's free) for the snapshots that see it, before it's modified for the first
+ * time since the last snapshot. Must be called with the inode write-locked
+ * (or, for directories, with their directory lock write-locked).
+ *
+ * Files share their data block with the preserved version, so their next
+ * write must copy it (see data_block_shared), while directories have their
+ * entries copied right away.
+ *
+ * Input:
+ *   - inumber: inode's number
+ *
+ * Returns 0 if successful, -1 otherwise.
+ *
+ * Possible errors:
+ *   - malloc failure when allocating the version.
+ */
+int inode_preserve(int inumber) {
+    ALWAYS_ASSERT(valid_inumber(inumber), "inode_preserve: invalid inumber");
+
+    inode_table_entry_t *entry = inode_table_entry(inumber);
+    mutex_lock(&snapshots_mutex);
+    size_t since = entry->epoch;
+    if (since == fs_epoch) {
+        mutex_unlock(&snapshots_mutex);
+        return 0; // already preserved (if needed) in this epoch
+    }
+    // Free inodes without older versions are seen as free anyway
+    bool needed = snapshot_sees(since, fs_epoch) &&
+                  (entry->state == TAKEN || entry->versions != NULL);
+    entry->epoch = fs_epoch;
+    mutex_unlock(&snapshots_mutex);
+    if (!needed) {
+        return 0;
+    }
+
+    inode_version_t *version = malloc(sizeof(inode_version_t));
+    if (version == NULL) {
+        entry->epoch = since;
+        return -1;
+    }
+    version->since = since;
+    version->state = entry->state;
+    version->inode = entry->inode;
+    version->dir_entries = NULL;
+    if (entry->state == TAKEN && entry->inode.i_node_type == T_DIRECTORY) {
+        int block = entry->inode.i_data_block;
+        version->dir_entries = malloc(entry->inode.i_size);
+        void *data = data_block_get(block);
+        if (version->dir_entries == NULL || data == NULL) {
+            if (data != NULL) {
+                data_block_release(block, false);
+            }
+            free(version->dir_entries);
+            free(version);
+            entry->epoch = since;
+            return -1;
+        }
+        memcpy(version->dir_entries, data, entry->inode.i_size);
+        data_block_release(block, false);
+    } else if (entry->state == TAKEN && entry->inode.i_data_block != -1) {
+        data_block_share(entry->inode.i_data_block);
+    }
+    version->next = entry->versions;
+    entry->versions = version;
+
+    return 0;
+}
+
+/**
+ * Find the version of an inode that a snapshot sees. Must be called with the
+ * inode locked (or, for directories, with their directory lock locked).
+ *
+ * Input:
+ *   - entry: the inode table entry
+ *   - epoch: epoch of the snapshot
+ *
+ * Returns the version, or NULL if it's the current one.
+ */
+static inode_version_t *inode_version_find(inode_table_entry_t *entry,
+                                           size_t epoch) {
+    if (entry->epoch <= epoch) {
+        return NULL;
+    }
+
+    for (inode_version_t *version = entry->versions; version != NULL;
+         version = version->next) {
+        if (version->since <= epoch) {
+            return version;
+        }
+    }
+
+    return &free_version;
+}
+
+/**
+ * Obtain a pointer to the version of an inode that a snapshot sees. Must be
+ * called with the inode locked, and the snapshot acquired.
+ *
+ * Input:
+ *   - inumber: inode's number
+ *   - snapshot: the snapshot
+ *
+ * Returns pointer to the inode, or NULL if it was free in the snapshot.
+ */
+inode_t *inode_snapshot_get(int inumber, int snapshot) {
+    ALWAYS_ASSERT(valid_inumber(inumber),
+                  "inode_snapshot_get: invalid inumber");
+
+    metadata_access(META_INODE, (uint64_t)inumber, false);
+    inode_table_entry_t *entry = inode_table_entry(inumber);
+    inode_version_t *version =
+        inode_version_find(entry, snapshots[snapshot].epoch);
+    if (version == NULL) {
+        return entry->state == TAKEN ? &entry->inode : NULL;
+    }
+
+    return version->state == TAKEN ? &version->inode : NULL;
+}
+
+/**
+ * Take a snapshot of the FS (which copies nothing).
+ *
+ * Returns the snapshot, or -1 if there are already MAX_SNAPSHOTS of them.
+ */
+int snapshot_create(void) {
+    mutex_lock(&snapshots_mutex);
+    for (int i = 0; i < MAX_SNAPSHOTS; i++) {
+        if (!snapshots[i].taken) {
+            snapshots[i].taken = true;
+            snapshots[i].epoch = fs_epoch;
+            snapshots[i].open_files = 0;
+            // Modifications from now on preserve what the snapshot sees
+            fs_epoch++;
+            mutex_unlock(&snapshots_mutex);
+
+            return i;
+        }
+    }
+    mutex_unlock(&snapshots_mutex);
+
+    return -1; // too many snapshots
+}
+
+/**
+ * Delete a snapshot, freeing the inode versions (and data blocks) that no
+ * other snapshot sees.
+ *
+ * Input:
+ *   - snapshot: the snapshot
+ *
+ * Returns 0 if successful, -1 otherwise.
+ *
+ * Possible errors:
+ *   - The snapshot doesn't exist.
+ *   - The snapshot has files open.
+ */
+int snapshot_delete(int snapshot) {
+    mutex_lock(&snapshots_mutex);
+    if (snapshot < 0 || snapshot >= MAX_SNAPSHOTS ||
+        !snapshots[snapshot].taken || snapshots[snapshot].open_files > 0) {
+        mutex_unlock(&snapshots_mutex);
+        return -1;
+    }
+    snapshots[snapshot].taken = false;
+    mutex_unlock(&snapshots_mutex);
+
+    for (int i = 0; i < INODE_TABLE_SIZE; i++) {
+        inode_table_entry_t *entry = inode_table_entry(i);
+        rwlock_wrlock(&entry->lock);
+        pthread_rwlock_t *dir_lock = NULL;
+        if (entry->state == TAKEN && entry->inode.i_node_type == T_DIRECTORY) {
+            dir_lock = dir_lock_get(entry->inode.i_data_block);
+            rwlock_wrlock(dir_lock);
+        }
+
+        // Each version was current up to the epoch in which the next newer
+        // one began
+        mutex_lock(&snapshots_mutex);
+        size_t until = entry->epoch;
+        inode_version_t **link = &entry->versions;
+        while (*link != NULL) {
+            inode_version_t *version = *link;
+            size_t since = version->since;
+            if (snapshot_sees(since, until)) {
+                link = &version->next;
+            } else {
+                *link = version->next;
+                inode_version_free(version);
+            }
+            until = since;
+        }
+        mutex_unlock(&snapshots_mutex);
+
+        if (dir_lock != NULL) {
+            rwlock_unlock(dir_lock);
+        }
+        rwlock_unlock(&entry->lock);
+    }
+
+    return 0;
+}
+
+/**
+ * Acquire a snapshot, so it isn't deleted while its files are open.
+ *
+ * Input:
+ *   - snapshot: the snapshot
+ *
+ * Returns true if successful, false if the snapshot doesn't exist.
+ */
+bool snapshot_acquire(int snapshot) {
+    mutex_lock(&snapshots_mutex);
+    bool taken = snapshot >= 0 && snapshot < MAX_SNAPSHOTS &&
+                 snapshots[snapshot].taken;
+    if (taken) {
+        snapshots[snapshot].open_files++;
+    }
+    mutex_unlock(&snapshots_mutex);
+
+    return taken;
+}
+
+/**
+ * Release a snapshot acquired with snapshot_acquire.
+ *
+ * Input:
+ *   - snapshot: the snapshot
+ */
+void snapshot_release(int snapshot) {
+    mutex_lock(&snapshots_mutex);
+    ALWAYS_ASSERT(snapshots[snapshot].open_files > 0,
+                  "snapshot_release: snapshot wasn't acquired");
+    snapshots[snapshot].open_files--;
+    mutex_unlock(&snapshots_mutex);
+}
+
+/**
+ * Obtain the inumber of a file in the root directory, as seen by a snapshot
+ * (which must be acquired).
+ *
+ * Input:
+ *   - snapshot: the snapshot
+ *   - sub_name: file name
+ *
+ * Returns the inumber of the file, or -1 if it didn't exist.
+ */
+int snapshot_lookup(int snapshot, char const *sub_name) {
+    if (strlen(sub_name) == 0 || strlen(sub_name) > MAX_FILE_NAME - 1) {
+        return -1; // invalid sub_name
+    }
+
+    inode_table_entry_t *root = inode_table_entry(ROOT_DIR_INUM);
+    int block = root->inode.i_data_block;
+    metadata_access(META_DIR_BLOCK, (uint64_t)block, false);
+
+    rwlock_rdlock(dir_lock_get(block));
+    inode_version_t *version =
+        inode_version_find(root, snapshots[snapshot].epoch);
+    int sub_inumber = -1;
+    if (version == NULL) {
+        dir_entry_t *dir_entry = (dir_entry_t *)data_block_get(block);
+        if (dir_entry != NULL) {
+            sub_inumber =
+                dir_entries_find(dir_entry, MAX_DIR_ENTRIES(&root->inode),
+                                 sub_name);
+            data_block_release(block, false);
+        }
+    } else if (version->state == TAKEN) {
+        sub_inumber =
+            dir_entries_find(version->dir_entries,
+                             MAX_DIR_ENTRIES(&version->inode), sub_name);
+    }
+    rwlock_unlock(dir_lock_get(block));
+
+    return sub_inumber;
+}
+
+/**
+ * Add a new entry to the open file table.
+ *
+ * Input:
+ *   - inumber: inode number of the file to open
+ *   - offset: initial offset
+ *   - buffered: whether writes to the file are buffered
+ *   - snapshot: snapshot the file is read from (which must be acquired), or
+ *     -1 for the current FS
+ *   - generation: generation the inode must be in (for the current FS), or
+ *     -1 for any
+ *
+ * Returns file handle if successful, -2 if the file was deleted (or its inode
+ * reused, for a given generation), -1 otherwise.
+ *
+ * Possible errors:
+ *   - No space in open file table for a new open file.
+ */
+int add_to_open_file_table(int inumber, size_t offset, bool buffered,
+                           int snapshot, int64_t generation) {
+    if (!valid_inumber(inumber)) {
+        return -1;
+    }
+
+    mutex_lock(&free_open_file_entries_mutex);
+    // We have to recheck this because the file could have been deleted (the
+    // files of snapshots were checked against the snapshot instead), which
+    // can't happen while the mutex is locked
+    if (snapshot == -1) {
+        rwlock_rdlock(inode_lock_get(inumber));
+        bool current = inode_exists(inumber) &&
+                       (generation == -1 ||
+                        inode_generation_get(inumber) == generation);
+        rwlock_unlock(inode_lock_get(inumber));
+        if (!current) {
+            mutex_unlock(&free_open_file_entries_mutex);
+            return -2;
+        }
+    }
+    size_t index = MAX_OPEN_FILES;
+    for (size_t i = 0; i < MAX_OPEN_FILES; i++) {
+        if (open_file_table_entry(i)->state == FREE) {
+            index = i;
+            break;
+        }
+    }
+    if (index == MAX_OPEN_FILES) {
+        // No free entries, so tries to grow the table
+        ssize_t first = chunked_table_grow(&open_file_table);
+        if (first == -1) {
+            mutex_unlock(&free_open_file_entries_mutex);
+            return -1;
+        }
+        table_locks_init(&open_file_table,
+                         offsetof(open_file_table_entry_t, file.mutex), false,
+                         (size_t)first, MAX_OPEN_FILES);
+        index = (size_t)first;
+    }
+
+    open_file_table_entry_t *entry = open_file_table_entry(index);
+    entry->state = TAKEN;
+    if (entry->generation == 0) {
+        entry->generation = 1; // a new entry
+    }
+    int fhandle = (int)index | (entry->generation << FILE_HANDLE_INDEX_BITS);
+
+    mutex_lock(&entry->file.mutex);
+    entry->file.of_inumber = inumber;
+    entry->file.of_offset = offset;
+    entry->file.of_sequential_reads = 0;
+    entry->file.of_buffered = buffered;
+    entry->file.of_snapshot = snapshot;
+    entry->file.of_write_buffer = NULL;
+    entry->file.of_write_buffer_len = 0;
+    // The handle only becomes valid once the entry is ready
+    atomic_store_explicit(&entry->fhandle, fhandle, memory_order_release);
+    mutex_unlock(&entry->file.mutex);
+
+    mutex_unlock(&free_open_file_entries_mutex);
+    return fhandle;
+}
+
+/**
+ * Returns the number of bytes the stored contents of an inode can take without
+ * moving into a bigger block.
+ */
+static size_t inode_capacity(inode_t const *inode) {
+    return inode->i_data_block == -1 ? INODE_INLINE_DATA_SIZE
+                                     : data_block_size(inode->i_data_block);
+}
+
+/**
+ * Writes to the contents of a file, moving them into a bigger block when they
+ * no longer fit. Must be called with the inode write-locked.
+ *
+ * Inputs:
+ *  - inode: the inode of the file
+ *  - offset: where to write (which must not be past the end of the file)
+ *  - buffer: buffer to write
+ *  - to_write: number of bytes to be written
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+static int inode_plain_write(inode_t *inode, size_t offset,
+                             void const *buffer, size_t to_write) {
+    size_t data_size = offset + to_write > inode->i_data_size
+                           ? offset + to_write
+                           : inode->i_data_size;
+    size_t capacity = inode_capacity(inode);
+    void *data;
+    if (data_size > capacity || (inode->i_data_block != -1 &&
+                                 data_block_shared(inode->i_data_block))) {
+        // If the contents no longer fit inline (or in their current block),
+        // or their block is shared with snapshots (which must keep seeing the
+        // old contents), move them into a new block (at least as big as the
+        // current one, which may have been reserved by tfs_fallocate)
+        int bnum =
+            data_block_alloc(data_size > capacity ? data_size : capacity);
+        if (bnum == -1) {
+            return -1; // no space
         }
+        void const *old_data = inode_data_get(inode);
+        data = old_data != NULL ? data_block_get(bnum) : NULL;
+        if (data == NULL) {
+            data_block_free(bnum);
+            if (old_data != NULL) {
+                inode_data_release(inode, false);
+            }
+            return -1; // the contents couldn't be read, or moved
+        }
+        memcpy(data, old_data, inode->i_data_size);
+        inode_data_release(inode, false);
+        if (inode->i_data_block != -1) {
+            data_block_free(inode->i_data_block);
+        }
+        inode->i_data_block = bnum;
+    } else {
+        data = inode_data_get(inode);
     }
-    rwlock_unlock(&dir_locks[inode->i_data_block]);
+    ALWAYS_ASSERT(data != NULL, "tfs_write: data block deleted mid-write");
 
-    return -1; // entry not found
+    // A write past the stored contents fills the hole it leaves with zeros
+    if (offset > inode->i_data_size) {
+        memset(data + inode->i_data_size, 0, offset - inode->i_data_size);
+    }
+
+    // Perform the actual write
+    memcpy(data + offset, buffer, to_write);
+    inode->i_data_size = data_size;
+    return inode_data_release(inode, true);
 }
 
 /**
- * Allocate a new data block.
+ * Writes to the contents of a compressed file, and sets how many of them are
+ * stored (cutting them short, or filling the hole up to them with zeros). They
+ * are encoded again from the first frame that changes (so appending only
+ * encodes the tail again), and moved into a bigger block when they no longer
+ * fit. Must be called with the inode write-locked.
  *
- * Returns block number/index if successful, -1 otherwise.
+ * Inputs:
+ *  - inode: the inode of the file
+ *  - offset: where to write (which must not be past the end of the file)
+ *  - buffer: buffer to write
+ *  - to_write: number of bytes to be written
+ *  - data_size: the new number of stored bytes (which the write must not go
+ *    past)
  *
- * Possible errors:
- *   - No free data blocks.
+ * Returns 0 if successful, -1 otherwise.
  */
-int data_block_alloc(void) {
-    mutex_lock(&free_blocks_mutex);
-    for (size_t i = 0; i < DATA_BLOCKS; i++) {
-        if (i * sizeof(allocation_state_t) % BLOCK_SIZE == 0) {
-            insert_delay(); // simulate storage access delay to free_blocks
+static int inode_compressed_write(inode_t *inode, size_t offset,
+                                  void const *buffer, size_t to_write,
+                                  size_t data_size) {
+    size_t kept =
+        inode->i_data_size < data_size ? inode->i_data_size : data_size;
+    size_t frame = (offset < kept ? offset : kept) / COMPRESSION_FRAME_SIZE;
+    size_t first = frame * COMPRESSION_FRAME_SIZE;
+    size_t framed_capacity = framed_bound(data_size - first);
+
+    char *contents = malloc(data_size - first);
+    char *framed = malloc(framed_capacity);
+    char *data = inode_data_get(inode);
+    if ((data_size > first && (contents == NULL || framed == NULL)) ||
+        data == NULL) {
+        if (data != NULL) {
+            inode_data_release(inode, false);
         }
+        free(contents);
+        free(framed);
+        return -1;
+    }
 
-        if (free_blocks[i] == FREE) {
-            free_blocks[i] = TAKEN;
-            mutex_unlock(&free_blocks_mutex);
-
-            return (int)i;
+    // Decodes the contents that are kept from the first frame that changes
+    // on, and writes to them (unless they are cut short at that frame)
+    size_t prefix = framed_frame_offset(data, frame);
+    ssize_t framed_size = 0;
+    if (data_size > first) {
+        ALWAYS_ASSERT(framed_read(data + prefix,
+                                  inode->i_stored_size - prefix,
+                                  inode->i_data_size - first, 0, contents,
+                                  kept - first) != -1,
+                      "tfs_write: corrupt compressed contents");
+        memset(contents + (kept - first), 0, data_size - kept);
+        if (to_write > 0) {
+            memcpy(contents + (offset - first), buffer, to_write);
+        }
+        framed_size = framed_encode(contents, data_size - first, framed,
+                                    framed_capacity);
+        ALWAYS_ASSERT(framed_size != -1,
+                      "tfs_write: framed contents overflow");
+    }
+    size_t stored_size = prefix + (size_t)framed_size;
+
+    size_t capacity = inode_capacity(inode);
+    if (stored_size > capacity || (inode->i_data_block != -1 &&
+                                   data_block_shared(inode->i_data_block))) {
+        // Moves the contents into a bigger (or unshared) block, like plain
+        // files (contents that don't compress may not reach the max file
+        // size, since the frames take a few more bytes)
+        int bnum = -1;
+        if (stored_size <= BLOCK_SIZE) {
+            bnum = data_block_alloc(stored_size > capacity ? stored_size
+                                                           : capacity);
+        }
+        char *new_data = bnum != -1 ? data_block_get(bnum) : NULL;
+        if (new_data == NULL) {
+            if (bnum != -1) {
+                data_block_free(bnum);
+            }
+            inode_data_release(inode, false);
+            free(contents);
+            free(framed);
+            return -1; // no space
+        }
+        memcpy(new_data, data, prefix);
+        memcpy(new_data + prefix, framed, (size_t)framed_size);
+        inode_data_release(inode, false);
+        if (inode->i_data_block != -1) {
+            data_block_free(inode->i_data_block);
         }
+        inode->i_data_block = bnum;
+    } else {
+        memcpy(data + prefix, framed, (size_t)framed_size);
     }
-    mutex_unlock(&free_blocks_mutex);
+    int result = inode_data_release(inode, true);
+    inode->i_stored_size = stored_size;
+    inode->i_data_size = data_size;
 
-    return -1; // no free data blocks
+    free(contents);
+    free(framed);
+    return result;
 }
 
 /**
- * Free a data block.
+ * Writes to an open file, bypassing its write buffer. Must be called with the
+ * open file's mutex held.
  *
- * Input:
- *   - block_number: the block number/index
+ * Inputs:
+ *  - file: the open file
+ *  - buffer: buffer to write
+ *  - to_write: number of bytes to be written
+ *
+ * Returns the number of bytes written, or -1 if unsuccessful.
  */
-void data_block_free(int block_number) {
-    ALWAYS_ASSERT(valid_block_number(block_number),
-                  "data_block_free: invalid block number");
+static ssize_t file_write(open_file_entry_t *file, void const *buffer,
+                          size_t to_write) {
+    // From the open file table entry, we get the inode
+    rwlock_wrlock(inode_lock_get(file->of_inumber));
+    inode_t *inode = inode_get(file->of_inumber);
+    ALWAYS_ASSERT(inode != NULL, "tfs_write: inode of open file deleted");
+
+    // Just to make sure that the offset isn't out of bounds
+    if (file->of_offset > inode->i_size) {
+        file->of_offset = inode->i_size;
+    }
+
+    // Determine how many bytes to write
+    size_t block_size = state_block_size();
+    if (to_write + file->of_offset > block_size) {
+        to_write = block_size - file->of_offset;
+    }
 
-    insert_delay(); // simulate storage access delay to free_blocks
+    if (to_write > 0) {
+        // Preserves the contents for the snapshots first
+        if (inode_preserve(file->of_inumber) != 0 ||
+            (inode->i_compressed
+                 ? inode_compressed_write(
+                       inode, file->of_offset, buffer, to_write,
+                       file->of_offset + to_write > inode->i_data_size
+                           ? file->of_offset + to_write
+                           : inode->i_data_size)
+                 : inode_plain_write(inode, file->of_offset, buffer,
+                                     to_write)) != 0) {
+            rwlock_unlock(inode_lock_get(file->of_inumber));
+            return -1; // no space, or storage failure
+        }
+
+        // The offset associated with the file handle is incremented accordingly
+        file->of_offset += to_write;
+        file->of_sequential_reads = 0;
+        if (file->of_offset > inode->i_size) {
+            inode->i_size = file->of_offset;
+            metadata_access(META_INODE, (uint64_t)file->of_inumber, true);
+        }
+    }
+    rwlock_unlock(inode_lock_get(file->of_inumber));
 
-    mutex_lock(&free_blocks_mutex);
-    free_blocks[block_number] = FREE;
-    mutex_unlock(&free_blocks_mutex);
+    return (ssize_t)to_write;
 }
 
 /**
- * Obtain a pointer to the contents of a given block.
+ * Applies the writes buffered by an open file to the file, in a single write.
+ * Must be called with the open file's mutex held.
  *
  * Input:
- *   - block_number: the block number/index
+ *  - file: the open file
  *
- * Returns a pointer to the first byte of the block.
+ * Returns 0 if successful, -1 otherwise (in which case the buffered writes
+ * are lost).
  */
-void *data_block_get(int block_number) {
-    ALWAYS_ASSERT(valid_block_number(block_number),
-                  "data_block_get: invalid block number");
-
-    insert_delay(); // simulate storage access delay to block
+static int file_flush_write_buffer(open_file_entry_t *file) {
+    size_t len = file->of_write_buffer_len;
+    if (len == 0) {
+        return 0;
+    }
 
-    return &fs_data[(size_t)block_number * BLOCK_SIZE];
+    file->of_write_buffer_len = 0;
+    return file_write(file, file->of_write_buffer, len) == (ssize_t)len ? 0
+                                                                        : -1;
 }
 
 /**
- * Add a new entry to the open file table.
- *
- * Input:
- *   - inumber: inode number of the file to open
- *   - offset: initial offset
+ * Writes to an open file through its write buffer, which only reaches the
+ * file once it fills up. Must be called with the open file's mutex held.
  *
- * Returns file handle if successful, -1 otherwise.
+ * Inputs:
+ *  - file: the open file
+ *  - buffer: buffer to write
+ *  - to_write: number of bytes to be written
  *
- * Possible errors:
- *   - No space in open file table for a new open file.
+ * Returns the number of bytes written, or -1 if unsuccessful.
  */
-int add_to_open_file_table(int inumber, size_t offset) {
-    if (!valid_inumber(inumber)) {
-        return -1;
+static ssize_t file_buffered_write(open_file_entry_t *file,
+                                   void const *buffer, size_t to_write) {
+    // Determine how many bytes to write (as if the buffered writes had
+    // already reached the file)
+    size_t offset = file->of_offset + file->of_write_buffer_len;
+    size_t block_size = state_block_size();
+    if (offset >= block_size) {
+        to_write = 0;
+    } else if (to_write > block_size - offset) {
+        to_write = block_size - offset;
     }
 
-    // We have to recheck this because the file could have been deleted
-    if (freeinode_ts[inumber] != TAKEN) {
+    if (file->of_write_buffer_len + to_write > OPEN_FILE_WRITE_BUFFER_SIZE &&
+        file_flush_write_buffer(file) == -1) {
         return -1;
     }
-    mutex_lock(&free_open_file_entries_mutex);
-    for (int i = 0; i < MAX_OPEN_FILES; i++) {
-        if (free_open_file_entries[i] == FREE) {
-            free_open_file_entries[i] = TAKEN;
-
-            mutex_lock(&open_file_table[i].mutex);
-            open_file_table[i].of_inumber = inumber;
-            open_file_table[i].of_offset = offset;
-            mutex_unlock(&open_file_table[i].mutex);
+    if (to_write >= OPEN_FILE_WRITE_BUFFER_SIZE) {
+        return file_write(file, buffer, to_write);
+    }
 
-            mutex_unlock(&free_open_file_entries_mutex);
-            return i;
+    if (file->of_write_buffer == NULL) {
+        file->of_write_buffer = malloc(OPEN_FILE_WRITE_BUFFER_SIZE);
+        if (file->of_write_buffer == NULL) {
+            return file_write(file, buffer, to_write);
         }
     }
-    mutex_unlock(&free_open_file_entries_mutex);
+    memcpy(file->of_write_buffer + file->of_write_buffer_len, buffer,
+           to_write);
+    file->of_write_buffer_len += to_write;
+    file->of_sequential_reads = 0;
+
+    return (ssize_t)to_write;
+}
+
+/**
+ * Obtain and lock a given entry in the open file table.
+ *
+ * Input:
+ *   - fhandle: file handle
+ *
+ * Returns pointer to the (locked) entry, or NULL if the fhandle is
+ * invalid/closed/never opened.
+ */
+static open_file_entry_t *open_file_lock(int fhandle) {
+    open_file_entry_t *file = get_open_file_entry(fhandle);
+    if (file == NULL) {
+        return NULL;
+    }
+    mutex_lock(&file->mutex);
+    open_file_table_entry_t *entry =
+        open_file_table_entry(FILE_HANDLE_INDEX(fhandle));
+    if (atomic_load_explicit(&entry->fhandle, memory_order_relaxed) !=
+        fhandle) {
+        mutex_unlock(&file->mutex);
+        return NULL; // closed meanwhile
+    }
 
-    return -1;
+    return file;
+}
+
+/**
+ * Free an entry of the open file table, so its handle is no longer valid.
+ * Must be called with free_open_file_entries_mutex and the entry locked.
+ *
+ * Input:
+ *   - entry: the entry
+ */
+static void open_file_entry_free(open_file_table_entry_t *entry) {
+    entry->state = FREE;
+    atomic_store_explicit(&entry->fhandle, -1, memory_order_release);
+    entry->generation = entry->generation % (FILE_HANDLE_GENERATIONS - 1) + 1;
 }
 
 /**
@@ -610,38 +2471,53 @@ int remove_from_open_file_table(int fhandle) {
 
     mutex_lock(&free_open_file_entries_mutex);
     mutex_lock(&file->mutex);
+    // The handle may have been closed meanwhile
+    open_file_table_entry_t *entry =
+        open_file_table_entry(FILE_HANDLE_INDEX(fhandle));
+    if (atomic_load(&entry->fhandle) != fhandle) {
+        mutex_unlock(&file->mutex);
+        mutex_unlock(&free_open_file_entries_mutex);
+        return -1;
+    }
+    open_file_entry_free(entry);
+    if (file->of_snapshot != -1) {
+        // Files of snapshots are read-only, and don't keep the current
+        // version of their inode from being deleted
+        snapshot_release(file->of_snapshot);
+        mutex_unlock(&file->mutex);
+        mutex_unlock(&free_open_file_entries_mutex);
+        return 0;
+    }
     ALWAYS_ASSERT(
         valid_file_content(file->of_inumber),
         "remove_from_open_file_table: file content deleted before closing");
 
-    ALWAYS_ASSERT(valid_file_handle(fhandle),
-                  "remove_from_open_file_table: file handle must be valid");
-
-    ALWAYS_ASSERT(free_open_file_entries[fhandle] == TAKEN,
-                  "remove_from_open_file_table: file handle must be taken");
-
-    free_open_file_entries[fhandle] = FREE;
+    // The buffered writes reach the file before it can be deleted (the
+    // handle is closed even if they fail)
+    int flushed = file_flush_write_buffer(file);
+    free(file->of_write_buffer);
+    file->of_write_buffer = NULL;
 
     // Deletes unlinked files on the last close (locks the inode because it
     // needs to read the hard link counter)
-    rwlock_rdlock(&inode_locks[file->of_inumber]);
+    rwlock_rdlock(inode_lock_get(file->of_inumber));
     inode_t *file_inode = inode_get(file->of_inumber);
     if (file_inode == NULL) {
-        rwlock_unlock(&inode_locks[file->of_inumber]);
+        rwlock_unlock(inode_lock_get(file->of_inumber));
         mutex_unlock(&file->mutex);
         mutex_unlock(&free_open_file_entries_mutex);
         return -1;
     }
     if (file_inode->i_hard_links == 0 && is_file_open(file->of_inumber) == 0) {
-        rwlock_unlock(&inode_locks[file->of_inumber]);
+        rwlock_unlock(inode_lock_get(file->of_inumber));
         inode_delete(file->of_inumber);
     } else {
-        rwlock_unlock(&inode_locks[file->of_inumber]);
+        rwlock_unlock(inode_lock_get(file->of_inumber));
     }
     mutex_unlock(&file->mutex);
     mutex_unlock(&free_open_file_entries_mutex);
 
-    return 0;
+    return flushed;
 }
 
 /**
@@ -659,57 +2535,289 @@ ssize_t write_to_open_file(int fhandle, void const *buffer, size_t to_write) {
         return -1;
     }
 
-    open_file_entry_t *file = get_open_file_entry(fhandle);
+    open_file_entry_t *file = open_file_lock(fhandle);
     if (file == NULL) {
         return -1;
     }
-    mutex_lock(&file->mutex);
+    if (file->of_snapshot != -1) {
+        mutex_unlock(&file->mutex);
+        return -1; // snapshots are read-only
+    }
+    ssize_t written = file->of_buffered
+                          ? file_buffered_write(file, buffer, to_write)
+                          : file_write(file, buffer, to_write);
+    mutex_unlock(&file->mutex);
 
-    // From the open file table entry, we get the inode
-    rwlock_wrlock(&inode_locks[file->of_inumber]);
-    inode_t *inode = inode_get(file->of_inumber);
-    ALWAYS_ASSERT(inode != NULL, "tfs_write: inode of open file deleted");
+    return written;
+}
 
-    // Just to make sure that the offset isn't out of bounds
-    if (file->of_offset > inode->i_size) {
-        file->of_offset = inode->i_size;
+/**
+ * Flushes the writes buffered by an open file handle to the file.
+ *
+ * Input:
+ *  - file handle to flush
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int flush_open_file(int fhandle) {
+    open_file_entry_t *file = open_file_lock(fhandle);
+    if (file == NULL) {
+        return -1;
     }
+    int result = file_flush_write_buffer(file);
+    mutex_unlock(&file->mutex);
 
-    // Determine how many bytes to write
-    size_t block_size = state_block_size();
-    if (to_write + file->of_offset > block_size) {
-        to_write = block_size - file->of_offset;
+    return result;
+}
+
+/**
+ * Changes the size of an open file, cutting its contents short or extending
+ * them with a hole.
+ *
+ * Inputs:
+ *  - fhandle: file handle
+ *  - length: the new size
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int truncate_open_file(int fhandle, size_t length) {
+    if (length > state_block_size()) {
+        return -1;
+    }
+    open_file_entry_t *file = open_file_lock(fhandle);
+    if (file == NULL) {
+        return -1;
+    }
+    if (file->of_snapshot != -1) {
+        mutex_unlock(&file->mutex);
+        return -1; // snapshots are read-only
     }
 
-    if (to_write > 0) {
-        if (inode->i_size == 0) {
-            // If empty file, allocate new block
-            int bnum = data_block_alloc();
-            if (bnum == -1) {
-                rwlock_unlock(&inode_locks[file->of_inumber]);
-                mutex_unlock(&file->mutex);
-
-                return -1; // no space
+    // The writes the handle buffered came before the truncation
+    if (file_flush_write_buffer(file) == -1) {
+        mutex_unlock(&file->mutex);
+        return -1;
+    }
+
+    rwlock_wrlock(inode_lock_get(file->of_inumber));
+    inode_t *inode = inode_get(file->of_inumber);
+    ALWAYS_ASSERT(inode != NULL, "tfs_ftruncate: inode of open file deleted");
+
+    int result = 0;
+    if (length != inode->i_size) {
+        // Preserves the contents for the snapshots first
+        result = inode_preserve(file->of_inumber);
+        if (result == 0 && length < inode->i_data_size) {
+            if (length == 0) {
+                if (inode->i_data_block != -1) {
+                    data_block_free(inode->i_data_block);
+                    inode->i_data_block = -1;
+                }
+                inode->i_data_size = 0;
+                inode->i_stored_size = 0;
+            } else if (inode->i_compressed) {
+                result =
+                    inode_compressed_write(inode, length, NULL, 0, length);
+            } else {
+                // The end of plain contents is simply forgotten
+                inode->i_data_size = length;
             }
-            inode->i_data_block = bnum;
         }
+        if (result == 0) {
+            inode->i_size = length;
+            metadata_access(META_INODE, (uint64_t)file->of_inumber, true);
+        }
+    }
+    rwlock_unlock(inode_lock_get(file->of_inumber));
+    mutex_unlock(&file->mutex);
 
-        void *block = data_block_get(inode->i_data_block);
-        ALWAYS_ASSERT(block != NULL, "tfs_write: data block deleted mid-write");
+    return result;
+}
 
-        // Perform the actual write
-        memcpy(block + file->of_offset, buffer, to_write);
+/**
+ * Obtains the metadata of an open file, applying the writes it buffered
+ * first.
+ *
+ * Inputs:
+ *  - fhandle: file handle
+ *  - stat: where to store the metadata
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int stat_open_file(int fhandle, tfs_file_stat *stat) {
+    open_file_entry_t *file = open_file_lock(fhandle);
+    if (file == NULL) {
+        return -1;
+    }
+    int result = file_flush_write_buffer(file);
+    if (result == 0) {
+        result = inode_stat(file->of_inumber, file->of_snapshot, stat);
+    }
+    mutex_unlock(&file->mutex);
 
-        // The offset associated with the file handle is incremented accordingly
-        file->of_offset += to_write;
-        if (file->of_offset > inode->i_size) {
-            inode->i_size = file->of_offset;
+    return result;
+}
+
+/**
+ * Obtain the contents of an open file (applying the writes it buffered
+ * first), which are kept from changing until they're released with
+ * open_file_contents_release. Compressed contents are decompressed into a
+ * new buffer, the others are the file's own data.
+ *
+ * Inputs:
+ *  - fhandle: file handle
+ *  - contents: where to store the pointer to the contents (NULL if no
+ *    contents are stored)
+ *  - data_size: where to store the number of bytes stored
+ *  - size: where to store the size of the file (past the bytes stored, it's
+ *    a hole that reads as zeros)
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int open_file_contents_get(int fhandle, void const **contents,
+                           size_t *data_size, size_t *size) {
+    open_file_entry_t *file = open_file_lock(fhandle);
+    if (file == NULL) {
+        return -1;
+    }
+    if (file_flush_write_buffer(file) == -1) {
+        mutex_unlock(&file->mutex);
+        return -1;
+    }
+
+    rwlock_rdlock(inode_lock_get(file->of_inumber));
+    inode_t *inode = file->of_snapshot == -1
+                         ? inode_get(file->of_inumber)
+                         : inode_snapshot_get(file->of_inumber,
+                                              file->of_snapshot);
+    ALWAYS_ASSERT(inode != NULL,
+                  "open_file_contents_get: inode of open file deleted");
+
+    *contents = NULL;
+    *data_size = inode->i_data_size;
+    *size = inode->i_size;
+    if (inode->i_data_size == 0) {
+        return 0;
+    }
+
+    void *data = inode_data_get(inode);
+    ALWAYS_ASSERT(data != NULL,
+                  "open_file_contents_get: data block deleted mid-read");
+    if (!inode->i_compressed) {
+        *contents = data;
+        return 0;
+    }
+
+    void *decompressed = malloc(inode->i_data_size);
+    if (decompressed != NULL) {
+        ALWAYS_ASSERT(framed_read(data, inode->i_stored_size,
+                                  inode->i_data_size, 0, decompressed,
+                                  inode->i_data_size) != -1,
+                      "open_file_contents_get: corrupt compressed contents");
+    }
+    inode_data_release(inode, false);
+    if (decompressed == NULL) {
+        rwlock_unlock(inode_lock_get(file->of_inumber));
+        mutex_unlock(&file->mutex);
+        return -1;
+    }
+    *contents = decompressed;
+
+    return 0;
+}
+
+/**
+ * Release the contents of an open file, obtained with
+ * open_file_contents_get.
+ *
+ * Inputs:
+ *  - fhandle: file handle
+ *  - contents: the contents
+ */
+void open_file_contents_release(int fhandle, void const *contents) {
+    open_file_entry_t *file = get_open_file_entry(fhandle);
+    ALWAYS_ASSERT(file != NULL,
+                  "open_file_contents_release: file closed mid-read");
+
+    inode_t *inode = file->of_snapshot == -1
+                         ? inode_get(file->of_inumber)
+                         : inode_snapshot_get(file->of_inumber,
+                                              file->of_snapshot);
+    if (contents != NULL) {
+        if (inode->i_compressed) {
+            free((void *)contents);
+        } else {
+            inode_data_release(inode, false);
         }
     }
-    rwlock_unlock(&inode_locks[file->of_inumber]);
+    rwlock_unlock(inode_lock_get(file->of_inumber));
     mutex_unlock(&file->mutex);
+}
 
-    return (ssize_t)to_write;
+/**
+ * Reserves space for the contents of an open file, moving them into a block
+ * where they can grow up to a given size.
+ *
+ * Inputs:
+ *  - fhandle: file handle
+ *  - length: size to reserve space for
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int allocate_open_file(int fhandle, size_t length) {
+    if (length > state_block_size()) {
+        return -1;
+    }
+    open_file_entry_t *file = open_file_lock(fhandle);
+    if (file == NULL) {
+        return -1;
+    }
+    if (file->of_snapshot != -1) {
+        mutex_unlock(&file->mutex);
+        return -1; // snapshots are read-only
+    }
+
+    rwlock_wrlock(inode_lock_get(file->of_inumber));
+    inode_t *inode = inode_get(file->of_inumber);
+    ALWAYS_ASSERT(inode != NULL, "tfs_fallocate: inode of open file deleted");
+
+    // Compressed contents are reserved the space they take if they don't
+    // compress
+    size_t needed = inode->i_compressed ? framed_bound(length) : length;
+    if (needed > state_block_size()) {
+        needed = state_block_size();
+    }
+
+    int result = 0;
+    if (needed > inode_capacity(inode)) {
+        size_t stored_size =
+            inode->i_compressed ? inode->i_stored_size : inode->i_data_size;
+        int bnum = data_block_alloc(needed);
+        char *new_data = bnum != -1 ? data_block_get(bnum) : NULL;
+        char *data = new_data != NULL ? inode_data_get(inode) : NULL;
+        if (data == NULL) {
+            if (new_data != NULL) {
+                data_block_release(bnum, false);
+            }
+            if (bnum != -1) {
+                data_block_free(bnum);
+            }
+            result = -1; // no space, or storage failure
+        } else {
+            memcpy(new_data, data, stored_size);
+            inode_data_release(inode, false);
+            if (inode->i_data_block != -1) {
+                data_block_free(inode->i_data_block);
+            }
+            inode->i_data_block = bnum;
+            result = data_block_release(bnum, true);
+            metadata_access(META_INODE, (uint64_t)file->of_inumber, true);
+        }
+    }
+    rwlock_unlock(inode_lock_get(file->of_inumber));
+    mutex_unlock(&file->mutex);
+
+    return result;
 }
 
 /**
@@ -727,15 +2835,24 @@ ssize_t read_from_open_file(int fhandle, void *buffer, size_t len) {
         return -1;
     }
 
-    open_file_entry_t *file = get_open_file_entry(fhandle);
+    open_file_entry_t *file = open_file_lock(fhandle);
     if (file == NULL) {
         return -1;
     }
-    mutex_lock(&file->mutex);
 
-    // From the open file table entry, we get the inode
-    rwlock_rdlock(&inode_locks[file->of_inumber]);
-    inode_t const *inode = inode_get(file->of_inumber);
+    // The handle's own writes must be visible to its reads
+    if (file_flush_write_buffer(file) == -1) {
+        mutex_unlock(&file->mutex);
+        return -1;
+    }
+
+    // From the open file table entry, we get the inode (or the version of it
+    // that the snapshot sees)
+    rwlock_rdlock(inode_lock_get(file->of_inumber));
+    inode_t *inode = file->of_snapshot == -1
+                         ? inode_get(file->of_inumber)
+                         : inode_snapshot_get(file->of_inumber,
+                                              file->of_snapshot);
     ALWAYS_ASSERT(inode != NULL, "tfs_read: inode of open file deleted");
 
     // Just to make sure that write_to_open_file doesn't make the offset out of
@@ -751,15 +2868,48 @@ ssize_t read_from_open_file(int fhandle, void *buffer, size_t len) {
     }
 
     if (to_read > 0) {
-        void *block = data_block_get(inode->i_data_block);
-        ALWAYS_ASSERT(block != NULL, "tfs_read: data block deleted mid-read");
+        // Only the part of the read that overlaps the stored contents reads
+        // them, the rest of it is a hole
+        size_t to_copy = 0;
+        if (file->of_offset < inode->i_data_size) {
+            to_copy = inode->i_data_size - file->of_offset;
+            if (to_copy > to_read) {
+                to_copy = to_read;
+            }
+        }
 
-        // Perform the actual read
-        memcpy(buffer, block + file->of_offset, to_read);
+        if (to_copy > 0) {
+            void *data = inode_data_get(inode);
+            ALWAYS_ASSERT(data != NULL,
+                          "tfs_read: data block deleted mid-read");
+
+            // Perform the actual read (decompressing only the frames it
+            // needs, for compressed files)
+            if (inode->i_compressed) {
+                ALWAYS_ASSERT(framed_read(data, inode->i_stored_size,
+                                          inode->i_data_size, file->of_offset,
+                                          buffer, to_copy) != -1,
+                              "tfs_read: corrupt compressed contents");
+            } else {
+                memcpy(buffer, data + file->of_offset, to_copy);
+            }
+            inode_data_release(inode, false);
+        }
+        memset((char *)buffer + to_copy, 0, to_read - to_copy);
         // The offset associated with the file handle is incremented accordingly
         file->of_offset += to_read;
+
+        // Sequential readers that haven't reached the end of the file will be
+        // back for the rest of it soon, so it's kept (or brought back) into
+        // the cache meanwhile
+        file->of_sequential_reads++;
+        if (file->of_sequential_reads >= SEQUENTIAL_READ_THRESHOLD &&
+            file->of_offset < inode->i_data_size &&
+            inode->i_data_block != -1) {
+            data_block_prefetch(inode->i_data_block);
+        }
     }
-    rwlock_unlock(&inode_locks[file->of_inumber]);
+    rwlock_unlock(inode_lock_get(file->of_inumber));
     mutex_unlock(&file->mutex);
 
     return (ssize_t)to_read;
@@ -775,12 +2925,20 @@ ssize_t read_from_open_file(int fhandle, void *buffer, size_t len) {
  * opened.
  */
 open_file_entry_t *get_open_file_entry(int fhandle) {
-    if (!valid_file_handle(fhandle) ||
-        free_open_file_entries[fhandle] != TAKEN) {
+    // The handle is checked against the one of the entry without locking it
+    // (so it must be checked again once the entry is locked, since it may be
+    // closed meanwhile)
+    if (!valid_file_handle(fhandle)) {
+        return NULL;
+    }
+    open_file_table_entry_t *entry =
+        open_file_table_entry(FILE_HANDLE_INDEX(fhandle));
+    if (atomic_load_explicit(&entry->fhandle, memory_order_acquire) !=
+        fhandle) {
         return NULL;
     }
 
-    return &open_file_table[fhandle];
+    return &entry->file;
 }
 
 /**
@@ -797,9 +2955,10 @@ bool is_file_open(int inumber) {
         return 0;
     }
 
-    for (int i = 0; i < MAX_OPEN_FILES; i++) {
-        if (free_open_file_entries[i] == TAKEN &&
-            open_file_table[i].of_inumber == inumber) {
+    for (size_t i = 0; i < MAX_OPEN_FILES; i++) {
+        open_file_table_entry_t *entry = open_file_table_entry(i);
+        if (entry->state == TAKEN && entry->file.of_snapshot == -1 &&
+            entry->file.of_inumber == inumber) {
             return 1;
         }
     }
@@ -4,6 +4,7 @@
 #include "config.h"
 #include "operations.h"
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/types.h>
@@ -12,7 +13,6 @@
  * External mutexes/locks
  */
 extern pthread_mutex_t free_open_file_entries_mutex;
-extern pthread_rwlock_t *inode_locks;
 
 /**
  * Inode
@@ -23,9 +23,22 @@ typedef struct {
     inode_type i_node_type;
 
     size_t i_size;
+    // Number of bytes of the contents that are stored (inline or in the data
+    // block), where the rest of them (up to i_size) is a hole that reads as
+    // zeros
+    size_t i_data_size;
     int i_data_block;
     size_t i_hard_links;
 
+    // Contents of the inode when i_data_block is -1 (i_size must not exceed
+    // INODE_INLINE_DATA_SIZE in that case)
+    char i_inline_data[INODE_INLINE_DATA_SIZE];
+
+    // Compressed files keep the stored part of their contents framed (see
+    // compression.h), which takes i_stored_size bytes
+    bool i_compressed;
+    size_t i_stored_size;
+
     // in a more complete FS, more fields could exist here
 } inode_t;
 
@@ -34,9 +47,13 @@ typedef struct {
  */
 typedef struct {
     char d_name[MAX_FILE_NAME];
-    int d_inumber;
+    // -1 if the entry is free, DIR_ENTRY_REMOVED if it was removed but may
+    // still be being read (the name is complete once the inumber is set)
+    _Atomic int d_inumber;
 } dir_entry_t;
 
+#define DIR_ENTRY_REMOVED (-2)
+
 /**
  * Open file entry (in open file table)
  */
@@ -45,30 +62,75 @@ typedef enum { FREE = 0, TAKEN = 1 } allocation_state_t;
 typedef struct {
     int of_inumber;
     size_t of_offset;
+    size_t of_sequential_reads; // # reads since the last write (or open)
+    bool of_buffered;
+    int of_snapshot; // snapshot the file is read from, or -1
+    // Writes not yet applied to the file (that follow of_offset)
+    char *of_write_buffer;
+    size_t of_write_buffer_len;
     pthread_mutex_t mutex;
 } open_file_entry_t;
 
 int state_init(tfs_params);
 int state_destroy(void);
 size_t state_block_size(void);
+void state_metadata_stats(tfs_metadata_stats *stats);
+void state_io_stats(tfs_io_stats *stats);
+void state_io_plug(void);
+void state_io_unplug(void);
 
 int inode_create(inode_type n_type);
 void inode_delete(int inumber);
 inode_t *inode_get(int inumber);
+bool inode_exists(int inumber);
+uint32_t inode_generation_get(int inumber);
+pthread_rwlock_t *inode_lock_get(int inumber);
+void *inode_data_get(inode_t *inode);
+int inode_data_release(inode_t *inode, bool dirty);
 size_t inode_table_size(void);
 
 int add_dir_entry(inode_t *inode, char const *sub_name, int sub_inumber);
 int clear_dir_entry(inode_t *inode, char const *sub_name);
+ssize_t clear_dir_entries(inode_t *inode, char const *const *sub_names,
+                          size_t count, int *sub_inumbers);
+int rename_dir_entry(inode_t *inode, char const *sub_name,
+                     char const *new_name, int *replaced);
 int find_in_dir(inode_t const *inode, char const *sub_name);
+size_t read_dir_entries(inode_t const *inode, size_t *cursor,
+                        dir_entry_t *entries, size_t count);
+int inode_stat(int inumber, int snapshot, tfs_file_stat *stat);
+
+uint32_t namespace_generation_get(void);
+int sym_link_cache_get(int inumber);
+void sym_link_cache_put(int inumber, uint32_t generation, int target);
+
+int inode_preserve(int inumber);
+inode_t *inode_snapshot_get(int inumber, int snapshot);
+int snapshot_create(void);
+int snapshot_delete(int snapshot);
+bool snapshot_acquire(int snapshot);
+void snapshot_release(int snapshot);
+int snapshot_lookup(int snapshot, char const *sub_name);
 
-int data_block_alloc(void);
+int data_block_alloc(size_t size);
 void data_block_free(int block_number);
 void *data_block_get(int block_number);
+void data_block_prefetch(int block_number);
+int data_block_release(int block_number, bool dirty);
+size_t data_block_size(int block_number);
 
-int add_to_open_file_table(int inumber, size_t offset);
+int add_to_open_file_table(int inumber, size_t offset, bool buffered,
+                           int snapshot, int64_t generation);
 int remove_from_open_file_table(int fhandle);
 ssize_t write_to_open_file(int fhandle, void const *buffer, size_t to_write);
 ssize_t read_from_open_file(int fhandle, void *buffer, size_t len);
+int flush_open_file(int fhandle);
+int truncate_open_file(int fhandle, size_t length);
+int allocate_open_file(int fhandle, size_t length);
+int stat_open_file(int fhandle, tfs_file_stat *stat);
+int open_file_contents_get(int fhandle, void const **contents,
+                           size_t *data_size, size_t *size);
+void open_file_contents_release(int fhandle, void const *contents);
 open_file_entry_t *get_open_file_entry(int fhandle);
 bool is_file_open(int inumber);
 
@@ -0,0 +1,593 @@
+/*
+ *      File: storage.c
+ *      Authors: Gonçalo Sampaio Bárias (ist1103124)
+ *               Pedro Perez Vieira (ist1100064)
+ *      Description: Storage backends that hold the data blocks of the FS
+ *                   (primary memory, a mapped file, or a file accessed with
+ *                   direct I/O through io_uring).
+ */
+
+// O_DIRECT and MAP_POPULATE are not part of POSIX
+#define _GNU_SOURCE
+
+#include "storage.h"
+#include "../utils/better-locks.h"
+#include "../utils/chunked-table.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Alignment of the offsets, sizes and buffers of direct I/O
+#define DIRECT_IO_ALIGNMENT (4096)
+// Max number of requests in flight in the io_uring of a direct file
+#define DIRECT_IO_QUEUE_DEPTH (64)
+
+/*
+ * Memory storage: the blocks live in a chunked table in primary memory.
+ */
+
+static void *memory_block_map(storage_t *storage, size_t index) {
+    return chunked_table_get(storage->impl, index);
+}
+
+static int memory_block_read(storage_t *storage, size_t index, void *buffer) {
+    memcpy(buffer, memory_block_map(storage, index), storage->block_size);
+    return 0;
+}
+
+static int memory_block_write(storage_t *storage, size_t index,
+                              void const *buffer) {
+    memcpy(memory_block_map(storage, index), buffer, storage->block_size);
+    return 0;
+}
+
+static int memory_flush(storage_t *storage) {
+    (void)storage;
+    return 0; // nothing to make durable
+}
+
+static int memory_resize(storage_t *storage, size_t block_count) {
+    chunked_table_t *blocks = storage->impl;
+    while (chunked_table_size(blocks) < block_count) {
+        if (chunked_table_grow(blocks) == -1) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static void memory_close(storage_t *storage) {
+    chunked_table_destroy(storage->impl);
+    free(storage->impl);
+}
+
+static storage_ops_t const memory_ops = {
+    .name = "memory",
+    .simulated = true,
+    .block_map = memory_block_map,
+    .block_read = memory_block_read,
+    .block_write = memory_block_write,
+    .flush = memory_flush,
+    .resize = memory_resize,
+    .close = memory_close,
+};
+
+/**
+ * Open a memory storage, whose blocks grow in chunks of block_count blocks.
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+static int memory_open(storage_t *storage, size_t block_count,
+                       int table_flags) {
+    chunked_table_t *blocks = malloc(sizeof(chunked_table_t));
+    if (blocks == NULL) {
+        return -1;
+    }
+    if (chunked_table_init(blocks, storage->block_size, block_count,
+                           storage->block_count_limit, table_flags) != 0) {
+        chunked_table_destroy(blocks);
+        free(blocks);
+        return -1;
+    }
+
+    storage->ops = &memory_ops;
+    storage->impl = blocks;
+    return 0;
+}
+
+/*
+ * Mapped file storage: the blocks live in a file that is mapped (shared) into
+ * memory, so the kernel pages them in and out.
+ */
+
+typedef struct {
+    int fd;
+    char *data;
+    size_t size;
+} mapped_file_t;
+
+static void *mapped_file_block_map(storage_t *storage, size_t index) {
+    mapped_file_t *file = storage->impl;
+    return file->data + index * storage->block_size;
+}
+
+static int mapped_file_block_read(storage_t *storage, size_t index,
+                                  void *buffer) {
+    memcpy(buffer, mapped_file_block_map(storage, index), storage->block_size);
+    return 0;
+}
+
+static int mapped_file_block_write(storage_t *storage, size_t index,
+                                   void const *buffer) {
+    memcpy(mapped_file_block_map(storage, index), buffer, storage->block_size);
+    return 0;
+}
+
+static int mapped_file_flush(storage_t *storage) {
+    mapped_file_t *file = storage->impl;
+    return msync(file->data, file->size, MS_SYNC);
+}
+
+static int mapped_file_resize(storage_t *storage, size_t block_count) {
+    // The whole file is mapped up front
+    return block_count <= storage->block_count_limit ? 0 : -1;
+}
+
+static void mapped_file_close(storage_t *storage) {
+    mapped_file_t *file = storage->impl;
+    munmap(file->data, file->size);
+    close(file->fd);
+    free(file);
+}
+
+static storage_ops_t const mapped_file_ops = {
+    .name = "mapped file",
+    .simulated = false,
+    .block_map = mapped_file_block_map,
+    .block_read = mapped_file_block_read,
+    .block_write = mapped_file_block_write,
+    .flush = mapped_file_flush,
+    .resize = mapped_file_resize,
+    .close = mapped_file_close,
+};
+
+/**
+ * Open a mapped file storage, sizing the file (sparsely) for every block the
+ * storage can grow to.
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+static int mapped_file_open(storage_t *storage, char const *path) {
+    mapped_file_t *file = malloc(sizeof(mapped_file_t));
+    if (file == NULL) {
+        return -1;
+    }
+    file->size = storage->block_size * storage->block_count_limit;
+    file->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0640);
+    if (file->fd == -1) {
+        free(file);
+        return -1;
+    }
+    if (ftruncate(file->fd, (off_t)file->size) != 0) {
+        close(file->fd);
+        free(file);
+        return -1;
+    }
+    file->data = mmap(NULL, file->size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                      file->fd, 0);
+    if (file->data == MAP_FAILED) {
+        close(file->fd);
+        free(file);
+        return -1;
+    }
+
+    storage->ops = &mapped_file_ops;
+    storage->impl = file;
+    return 0;
+}
+
+/*
+ * Direct file storage: the blocks live in a file opened with O_DIRECT, so
+ * they bypass the page cache, and are read and written through an io_uring
+ * shared by every thread (keeping up to DIRECT_IO_QUEUE_DEPTH requests in
+ * flight). Falls back to buffered I/O where direct I/O isn't supported, and to
+ * pread/pwrite where io_uring isn't.
+ */
+
+// The fields are atomic because they're handed over between threads through
+// the kernel (which tools like ThreadSanitizer can't see)
+typedef struct {
+    _Atomic int res;
+    _Atomic bool done;
+} io_request_t;
+
+typedef struct {
+    int fd;
+    size_t slot_size; // block size, rounded up to the direct I/O alignment
+
+    int ring_fd; // -1 when io_uring is unavailable
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring;
+    size_t cq_ring_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+    unsigned *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    // Serializes submissions, and bounds the requests in flight
+    pthread_mutex_t sq_mutex;
+    pthread_cond_t sq_cond;
+    unsigned in_flight;
+    // Serializes the reaping of completions, which is done by one of the
+    // waiting threads on behalf of all of them
+    pthread_mutex_t cq_mutex;
+    pthread_cond_t cq_cond;
+    bool reaping;
+} direct_file_t;
+
+/**
+ * Set up the io_uring of a direct file.
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+static int direct_file_ring_setup(direct_file_t *file) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int ring_fd =
+        (int)syscall(__NR_io_uring_setup, DIRECT_IO_QUEUE_DEPTH, &params);
+    if (ring_fd < 0) {
+        return -1;
+    }
+
+    file->sq_ring_size =
+        params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    file->cq_ring_size =
+        params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    file->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    file->sq_ring = mmap(NULL, file->sq_ring_size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, ring_fd,
+                         IORING_OFF_SQ_RING);
+    file->cq_ring = mmap(NULL, file->cq_ring_size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, ring_fd,
+                         IORING_OFF_CQ_RING);
+    file->sqes = mmap(NULL, file->sqes_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+    if (file->sq_ring == MAP_FAILED || file->cq_ring == MAP_FAILED ||
+        file->sqes == MAP_FAILED) {
+        if (file->sq_ring != MAP_FAILED) {
+            munmap(file->sq_ring, file->sq_ring_size);
+        }
+        if (file->cq_ring != MAP_FAILED) {
+            munmap(file->cq_ring, file->cq_ring_size);
+        }
+        if (file->sqes != MAP_FAILED) {
+            munmap(file->sqes, file->sqes_size);
+        }
+        close(ring_fd);
+        return -1;
+    }
+
+    char *sq = file->sq_ring;
+    file->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    file->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    file->sq_array = (unsigned *)(sq + params.sq_off.array);
+    char *cq = file->cq_ring;
+    file->cq_head = (unsigned *)(cq + params.cq_off.head);
+    file->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    file->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    file->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    file->ring_fd = ring_fd;
+
+    return 0;
+}
+
+/**
+ * Reap every available completion of the io_uring of a direct file, marking
+ * the corresponding requests as done. Must be called with cq_mutex held.
+ *
+ * Returns the number of completions reaped.
+ */
+static unsigned direct_file_reap(direct_file_t *file) {
+    unsigned head = *file->cq_head;
+    unsigned tail = __atomic_load_n(file->cq_tail, __ATOMIC_ACQUIRE);
+    unsigned reaped = tail - head;
+    for (; head != tail; head++) {
+        struct io_uring_cqe *cqe = &file->cqes[head & *file->cq_mask];
+        io_request_t *request = (io_request_t *)(uintptr_t)cqe->user_data;
+        atomic_store_explicit(&request->res, cqe->res, memory_order_relaxed);
+        atomic_store_explicit(&request->done, true, memory_order_relaxed);
+    }
+    __atomic_store_n(file->cq_head, head, __ATOMIC_RELEASE);
+
+    if (reaped > 0) {
+        mutex_lock(&file->sq_mutex);
+        file->in_flight -= reaped;
+        cond_broadcast(&file->sq_cond);
+        mutex_unlock(&file->sq_mutex);
+        cond_broadcast(&file->cq_cond);
+    }
+
+    return reaped;
+}
+
+/**
+ * Perform a read or write on a direct file through its io_uring, waiting for
+ * it to complete.
+ *
+ * Returns the number of bytes transferred, or -1 if unsuccessful.
+ */
+static ssize_t direct_file_ring_io(direct_file_t *file, uint8_t opcode,
+                                   void *buffer, size_t len, off_t offset) {
+    io_request_t request;
+    atomic_store_explicit(&request.res, 0, memory_order_relaxed);
+    atomic_store_explicit(&request.done, false, memory_order_relaxed);
+
+    mutex_lock(&file->sq_mutex);
+    while (file->in_flight == DIRECT_IO_QUEUE_DEPTH) {
+        cond_wait(&file->sq_cond, &file->sq_mutex);
+    }
+    unsigned tail = *file->sq_tail;
+    unsigned i = tail & *file->sq_mask;
+    struct io_uring_sqe *sqe = &file->sqes[i];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->fd = file->fd;
+    sqe->addr = (uint64_t)(uintptr_t)buffer;
+    sqe->len = (uint32_t)len;
+    sqe->off = (uint64_t)offset;
+    sqe->user_data = (uint64_t)(uintptr_t)&request;
+    file->sq_array[i] = i;
+    __atomic_store_n(file->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    if (syscall(__NR_io_uring_enter, file->ring_fd, 1, 0, 0, NULL, 0) != 1) {
+        // The kernel didn't take the request, so it can be withdrawn
+        __atomic_store_n(file->sq_tail, tail, __ATOMIC_RELEASE);
+        mutex_unlock(&file->sq_mutex);
+        return -1;
+    }
+    file->in_flight++;
+    mutex_unlock(&file->sq_mutex);
+
+    mutex_lock(&file->cq_mutex);
+    while (!atomic_load_explicit(&request.done, memory_order_relaxed)) {
+        if (file->reaping) {
+            // Another thread is waiting in the kernel, and will reap this
+            // request's completion too
+            cond_wait(&file->cq_cond, &file->cq_mutex);
+            continue;
+        }
+        if (direct_file_reap(file) > 0) {
+            continue;
+        }
+
+        file->reaping = true;
+        mutex_unlock(&file->cq_mutex);
+        syscall(__NR_io_uring_enter, file->ring_fd, 0, 1,
+                IORING_ENTER_GETEVENTS, NULL, 0);
+        mutex_lock(&file->cq_mutex);
+        file->reaping = false;
+        direct_file_reap(file);
+        cond_broadcast(&file->cq_cond);
+    }
+    mutex_unlock(&file->cq_mutex);
+
+    int res = atomic_load_explicit(&request.res, memory_order_relaxed);
+    return res < 0 ? -1 : res;
+}
+
+/**
+ * Perform a read or write of a whole slot of a direct file.
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+static int direct_file_io(direct_file_t *file, bool write, void *buffer,
+                          size_t index) {
+    off_t offset = (off_t)(index * file->slot_size);
+    ssize_t done;
+    if (file->ring_fd != -1) {
+        done = direct_file_ring_io(
+            file, write ? IORING_OP_WRITE : IORING_OP_READ, buffer,
+            file->slot_size, offset);
+    } else if (write) {
+        done = pwrite(file->fd, buffer, file->slot_size, offset);
+    } else {
+        done = pread(file->fd, buffer, file->slot_size, offset);
+    }
+
+    return done == (ssize_t)file->slot_size ? 0 : -1;
+}
+
+/**
+ * Returns whether buffer can be used directly for I/O on a whole slot.
+ */
+static bool direct_file_io_ready(storage_t const *storage,
+                                 void const *buffer) {
+    direct_file_t const *file = storage->impl;
+    return storage->block_size == file->slot_size &&
+           (uintptr_t)buffer % DIRECT_IO_ALIGNMENT == 0;
+}
+
+static int direct_file_block_read(storage_t *storage, size_t index,
+                                  void *buffer) {
+    direct_file_t *file = storage->impl;
+    if (direct_file_io_ready(storage, buffer)) {
+        return direct_file_io(file, false, buffer, index);
+    }
+
+    // Goes through an aligned bounce buffer
+    void *bounce;
+    if (posix_memalign(&bounce, DIRECT_IO_ALIGNMENT, file->slot_size) != 0) {
+        return -1;
+    }
+    int result = direct_file_io(file, false, bounce, index);
+    if (result == 0) {
+        memcpy(buffer, bounce, storage->block_size);
+    }
+    free(bounce);
+
+    return result;
+}
+
+static int direct_file_block_write(storage_t *storage, size_t index,
+                                   void const *buffer) {
+    direct_file_t *file = storage->impl;
+    if (direct_file_io_ready(storage, buffer)) {
+        return direct_file_io(file, true, (void *)buffer, index);
+    }
+
+    // Goes through an aligned bounce buffer (padded with zeros)
+    void *bounce;
+    if (posix_memalign(&bounce, DIRECT_IO_ALIGNMENT, file->slot_size) != 0) {
+        return -1;
+    }
+    memcpy(bounce, buffer, storage->block_size);
+    memset((char *)bounce + storage->block_size, 0,
+           file->slot_size - storage->block_size);
+    int result = direct_file_io(file, true, bounce, index);
+    free(bounce);
+
+    return result;
+}
+
+static int direct_file_flush(storage_t *storage) {
+    direct_file_t *file = storage->impl;
+    return fdatasync(file->fd);
+}
+
+static int direct_file_resize(storage_t *storage, size_t block_count) {
+    // The whole file is sized up front
+    return block_count <= storage->block_count_limit ? 0 : -1;
+}
+
+static void direct_file_close(storage_t *storage) {
+    direct_file_t *file = storage->impl;
+    if (file->ring_fd != -1) {
+        munmap(file->sq_ring, file->sq_ring_size);
+        munmap(file->cq_ring, file->cq_ring_size);
+        munmap(file->sqes, file->sqes_size);
+        close(file->ring_fd);
+    }
+    mutex_destroy(&file->sq_mutex);
+    cond_destroy(&file->sq_cond);
+    mutex_destroy(&file->cq_mutex);
+    cond_destroy(&file->cq_cond);
+    close(file->fd);
+    free(file);
+}
+
+static storage_ops_t const direct_file_ops = {
+    .name = "direct file",
+    .simulated = false,
+    .block_map = NULL,
+    .block_read = direct_file_block_read,
+    .block_write = direct_file_block_write,
+    .flush = direct_file_flush,
+    .resize = direct_file_resize,
+    .close = direct_file_close,
+};
+
+/**
+ * Open a direct file storage, sizing the file (sparsely) for every block the
+ * storage can grow to.
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+static int direct_file_open(storage_t *storage, char const *path) {
+    direct_file_t *file = malloc(sizeof(direct_file_t));
+    if (file == NULL) {
+        return -1;
+    }
+    file->slot_size = (storage->block_size + DIRECT_IO_ALIGNMENT - 1) /
+                      DIRECT_IO_ALIGNMENT * DIRECT_IO_ALIGNMENT;
+
+    file->fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_DIRECT, 0640);
+    if (file->fd == -1 && errno == EINVAL) {
+        // The file system doesn't support direct I/O
+        file->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0640);
+    }
+    if (file->fd == -1) {
+        free(file);
+        return -1;
+    }
+    if (ftruncate(file->fd,
+                  (off_t)(file->slot_size * storage->block_count_limit)) !=
+        0) {
+        close(file->fd);
+        free(file);
+        return -1;
+    }
+    if (direct_file_ring_setup(file) != 0) {
+        file->ring_fd = -1;
+    }
+
+    mutex_init(&file->sq_mutex);
+    cond_init(&file->sq_cond);
+    file->in_flight = 0;
+    mutex_init(&file->cq_mutex);
+    cond_init(&file->cq_cond);
+    file->reaping = false;
+
+    storage->ops = &direct_file_ops;
+    storage->impl = file;
+    return 0;
+}
+
+/**
+ * Open a storage.
+ *
+ * Input:
+ *   - storage: the storage to open
+ *   - backend: the storage backend
+ *   - path: path of the file that holds the blocks (for file backends)
+ *   - block_size: size of the blocks
+ *   - block_count: initial number of blocks (and growth step)
+ *   - block_count_limit: max number of blocks the storage can grow to
+ *   - table_flags: chunked_table_flags_t options (for the memory backend)
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int storage_open(storage_t *storage, tfs_storage_t backend, char const *path,
+                 size_t block_size, size_t block_count,
+                 size_t block_count_limit, int table_flags) {
+    storage->block_size = block_size;
+    storage->block_count_limit =
+        block_count_limit > block_count ? block_count_limit : block_count;
+
+    switch (backend) {
+    case TFS_STORAGE_MEMORY:
+        return memory_open(storage, block_count, table_flags);
+    case TFS_STORAGE_MAPPED_FILE:
+        return path == NULL ? -1 : mapped_file_open(storage, path);
+    case TFS_STORAGE_DIRECT_FILE:
+        return path == NULL ? -1 : direct_file_open(storage, path);
+    default:
+        return -1;
+    }
+}
+
+/**
+ * Close a storage, after flushing it (the file of a file backend is kept).
+ * Does nothing if the storage was never opened.
+ *
+ * Returns 0 if successful, -1 if the storage couldn't be flushed.
+ */
+int storage_close(storage_t *storage) {
+    if (storage->ops == NULL) {
+        return 0;
+    }
+
+    int result = storage_flush(storage);
+    storage->ops->close(storage);
+    storage->ops = NULL;
+
+    return result;
+}
@@ -0,0 +1,99 @@
+#ifndef STORAGE_H
+#define STORAGE_H
+
+#include "operations.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct storage storage_t;
+
+/**
+ * Storage backend operations.
+ *
+ * A storage holds the data blocks of a pool (blocks of the same size, indexed
+ * from 0). Directly addressable storages (memory, mapped files) expose their
+ * blocks through block_map; every other storage sets it to NULL, and its
+ * blocks can only be accessed through block_read and block_write.
+ */
+typedef struct {
+    char const *name;
+    // Whether the blocks live in primary memory, in which case accesses to
+    // them must simulate the latency of secondary memory
+    bool simulated;
+
+    void *(*block_map)(storage_t *storage, size_t index);
+    int (*block_read)(storage_t *storage, size_t index, void *buffer);
+    int (*block_write)(storage_t *storage, size_t index, void const *buffer);
+    int (*flush)(storage_t *storage);
+    int (*resize)(storage_t *storage, size_t block_count);
+    void (*close)(storage_t *storage);
+} storage_ops_t;
+
+/**
+ * Storage (of a given backend).
+ */
+struct storage {
+    storage_ops_t const *ops;
+    size_t block_size;
+    size_t block_count_limit;
+    void *impl; // backend specific state
+};
+
+int storage_open(storage_t *storage, tfs_storage_t backend, char const *path,
+                 size_t block_size, size_t block_count,
+                 size_t block_count_limit, int table_flags);
+int storage_close(storage_t *storage);
+
+/**
+ * Returns whether the blocks of a storage are directly addressable.
+ */
+static inline bool storage_addressable(storage_t const *storage) {
+    return storage->ops->block_map != NULL;
+}
+
+/**
+ * Returns a pointer to a block of a directly addressable storage.
+ */
+static inline void *storage_block_map(storage_t *storage, size_t index) {
+    return storage->ops->block_map(storage, index);
+}
+
+/**
+ * Copies a block of a storage into buffer (of the block size).
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+static inline int storage_block_read(storage_t *storage, size_t index,
+                                     void *buffer) {
+    return storage->ops->block_read(storage, index, buffer);
+}
+
+/**
+ * Copies buffer (of the block size) into a block of a storage.
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+static inline int storage_block_write(storage_t *storage, size_t index,
+                                      void const *buffer) {
+    return storage->ops->block_write(storage, index, buffer);
+}
+
+/**
+ * Makes every block written so far to a storage durable.
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+static inline int storage_flush(storage_t *storage) {
+    return storage->ops->flush(storage);
+}
+
+/**
+ * Makes room for (at least) block_count blocks in a storage.
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+static inline int storage_resize(storage_t *storage, size_t block_count) {
+    return storage->ops->resize(storage, block_count);
+}
+
+#endif // STORAGE_H
@@ -21,8 +21,8 @@
 // Requests queue
 static pc_queue_t *requests_queue;
 
-// Boxes table
-static int n_boxes;
+// Boxes table (indexed by the inumber of the box files)
+static size_t boxes_table_size;
 static box_t *boxes_table;
 static allocation_state_t *free_boxes;
 static pthread_rwlock_t free_boxes_lock;
@@ -115,10 +115,26 @@ int main(int argc, char **argv) {
 int mbroker_init(char *register_pipename, size_t max_sessions) {
     // We initialize the tfs with the number of files the same as max sessions,
     // so we can have <max_sessions> boxes all at once, and the block size we
-    // set to 1MiB to have room for 1024 messages.
+    // set to 1MiB to have room for 1024 messages. Boxes (and the directory)
+    // start out in smaller blocks, and only move to the 1MiB ones once they
+    // grow past 64KiB. Every table starts out small and grows with the number
+    // of boxes, up to MBROKER_MAX_BOXES of them. Since boxes are spread over
+    // a big data area, it's backed by huge pages.
     tfs_params params = tfs_default_params();
     params.max_open_files_count = max_sessions;
+    params.open_files_count_limit = 2 * max_sessions;
+    params.inode_count_limit = MBROKER_MAX_BOXES;
     params.block_size = 1024 * 1024;
+    params.max_block_count = 64;
+    params.block_count_limit = MBROKER_MAX_BOXES;
+    params.block_class_count = 2;
+    params.block_classes[0].block_size = 4 * 1024;
+    params.block_classes[0].block_count = params.max_inode_count;
+    params.block_classes[0].block_count_limit = MBROKER_MAX_BOXES;
+    params.block_classes[1].block_size = 64 * 1024;
+    params.block_classes[1].block_count = params.max_inode_count;
+    params.block_classes[1].block_count_limit = MBROKER_MAX_BOXES;
+    params.use_huge_pages = true;
     if (tfs_init(&params) != 0) {
         WARN("Failed to initialize the tfs file system");
         return -1;
@@ -153,8 +169,9 @@ int mbroker_init(char *register_pipename, size_t max_sessions) {
     }
 
     // Prepares all the boxes on the server
-    boxes_table = malloc(inode_table_size() * sizeof(box_t));
-    free_boxes = malloc(inode_table_size() * sizeof(allocation_state_t));
+    boxes_table_size = inode_table_size();
+    boxes_table = malloc(boxes_table_size * sizeof(box_t));
+    free_boxes = malloc(boxes_table_size * sizeof(allocation_state_t));
     if (boxes_table == NULL) {
         tfs_destroy();
         pcq_destroy(requests_queue);
@@ -162,7 +179,7 @@ int mbroker_init(char *register_pipename, size_t max_sessions) {
         free(workers);
         return -1; // allocation failed
     }
-    for (size_t i = 0; i < inode_table_size(); i++) {
+    for (size_t i = 0; i < boxes_table_size; i++) {
         free_boxes[i] = FREE;
         mutex_init(&boxes_table[i].mutex);
         cond_init(&boxes_table[i].cond);
@@ -272,7 +289,8 @@ int workers_handle_pub_register(request_t *request) {
         return 0;
     }
 
-    int box_i = box_find(request->box_name);
+    uint32_t generation;
+    int box_i = box_find(request->box_name, &generation);
     if (box_i == -1) {
         close(session_pipe_out);
         return 0; // The given box name doesn't exist on the server
@@ -286,7 +304,9 @@ int workers_handle_pub_register(request_t *request) {
     // Increments the number of publishers on that box to 1
     boxes_table[box_i].n_publishers++;
 
-    int box_f = tfs_open(request->box_name, TFS_O_APPEND);
+    // The box file was found already, so it's opened without looking it up
+    // again
+    int box_f = tfs_open_inum(box_i, generation, TFS_O_APPEND);
     if (box_f < 0) {
         boxes_table[box_i].n_publishers--;
         mutex_unlock(&boxes_table[box_i].mutex);
@@ -323,10 +343,8 @@ int workers_handle_pub_register(request_t *request) {
             tfs_write(box_f, message, to_write) != to_write) {
             break;
         }
-        // We update the box size and signal the subscribers that a new message
-        // appeared
+        // We signal the subscribers that a new message appeared
         mutex_lock(&boxes_table[box_i].mutex);
-        boxes_table[box_i].size += to_write;
         cond_broadcast(&boxes_table[box_i].cond);
         mutex_unlock(&boxes_table[box_i].mutex);
     }
@@ -345,7 +363,8 @@ int workers_handle_sub_register(request_t *request) {
         return 0;
     }
 
-    int box_i = box_find(request->box_name);
+    uint32_t generation;
+    int box_i = box_find(request->box_name, &generation);
     if (box_i == -1) {
         close(session_pipe_in);
         return 0; // The given box name doesn't exist on the server
@@ -354,9 +373,10 @@ int workers_handle_sub_register(request_t *request) {
     // Increments the number of subscribers on the given box
     boxes_table[box_i].n_subscribers++;
 
-    int box_f = tfs_open(request->box_name, 0);
+    int box_f = tfs_open_inum(box_i, generation, 0);
     if (box_f < 0) {
         boxes_table[box_i].n_subscribers--;
+        mutex_unlock(&boxes_table[box_i].mutex);
         close(session_pipe_in);
         return 0; // The box doesn't exist on the server
     }
@@ -425,16 +445,15 @@ int workers_handle_manager_create(request_t *request) {
     memset(packet, 0, packet_len);
     packet_write(packet, &packet_offset, &code, sizeof(uint8_t));
 
-    // Sees if the box already exists on the server, giving an error in that
-    // case
-    int f = tfs_open(request->box_name, 0);
-    if (f >= 0 || (f = tfs_open(request->box_name, TFS_O_CREAT)) < 0 ||
-        box_create(request->box_name) != 0) {
+    // Creates the box file, giving an error if the box already exists on the
+    // server (boxes hold fixed size messages, mostly padding, so they're
+    // compressed)
+    int box_i = tfs_create(request->box_name, TFS_O_COMPRESS);
+    if (box_i == -1 || box_create(box_i) != 0) {
         return_code = -1;
         strcpy(error_message, "Couldn't create box");
         WARN("MANAGER: %s", error_message);
     }
-    tfs_close(f);
     packet_write(packet, &packet_offset, &return_code, sizeof(int32_t));
     packet_write(packet, &packet_offset, error_message,
                  sizeof(char) * strlen(error_message));
@@ -484,127 +503,145 @@ int workers_handle_manager_remove(request_t *request) {
     return 0;
 }
 
-int workers_handle_manager_listing(request_t *request) {
+/**
+ * Sends a box of a listing to the manager client.
+ *
+ * Input:
+ *	- session_pipe_in: the session pipe
+ *	- box: the box, or NULL if there are no boxes
+ *	- last: whether it's the last box of the listing
+ *
+ *	Returns 0 if successful, -1 otherwise.
+ */
+static int listing_send(int session_pipe_in, box_t const *box, uint8_t last) {
     size_t packet_len = sizeof(uint8_t) * 2 + sizeof(char) * BOX_NAME_MAX_LEN +
                         sizeof(uint64_t) * 3;
     packet_ensure_len_limit(packet_len);
     int8_t packet[packet_len];
 
+    // Writes all the information of a box in a packet and sends it
+    uint8_t code = PROTOCOL_CODE_LIST_ANSWER;
+    size_t packet_offset = 0;
+    memset(packet, 0, packet_len);
+    packet_write(packet, &packet_offset, &code, sizeof(uint8_t));
+    packet_write(packet, &packet_offset, &last, sizeof(uint8_t));
+    if (box != NULL) {
+        packet_write(packet, &packet_offset, box->name,
+                     sizeof(char) * BOX_NAME_MAX_LEN);
+        packet_write(packet, &packet_offset, &box->size, sizeof(uint64_t));
+        packet_write(packet, &packet_offset, &box->n_publishers,
+                     sizeof(uint64_t));
+        packet_write(packet, &packet_offset, &box->n_subscribers,
+                     sizeof(uint64_t));
+    }
+
+    return pipe_write(session_pipe_in, packet, packet_len) <= 0 ? -1 : 0;
+}
+
+int workers_handle_manager_listing(request_t *request) {
     int session_pipe_in = open(request->client_named_pipe_path, O_WRONLY);
     if (session_pipe_in < 0) {
         WARN("Failed to open pipe");
         return -1;
     }
 
-    // Reads all the current boxes on the server and sends all the information
-    // to the manager client (boxes sent are not sorted because that's up to the
-    // client)
-    uint8_t code = PROTOCOL_CODE_LIST_ANSWER;
-    uint8_t last = 0;
-    rwlock_rdlock(&free_boxes_lock);
-    for (int i = 0, n_boxes_listed = 0;
-         n_boxes_listed <= n_boxes && i < inode_table_size(); i++) {
-        // Only looks at taken boxes
-        if (n_boxes > 0 && free_boxes[i] == FREE) {
-            continue;
-        }
-        // When we have 0 boxes or we reached the last box we set the last flag
-        // to 1
-        if (n_boxes == 0 || n_boxes_listed + 1 == n_boxes) {
-            last = 1;
-        }
-        // Writes all the information of a box in a packet and sends it
-        size_t packet_offset = 0;
-        memset(packet, 0, packet_len);
-        packet_write(packet, &packet_offset, &code, sizeof(uint8_t));
-        packet_write(packet, &packet_offset, &last, sizeof(uint8_t));
-        mutex_lock(&boxes_table[i].mutex);
-        if (n_boxes > 0) {
-            packet_write(packet, &packet_offset, boxes_table[i].name + 1,
-                         sizeof(char) * BOX_NAME_MAX_LEN);
-            packet_write(packet, &packet_offset, &boxes_table[i].size,
-                         sizeof(uint64_t));
-            packet_write(packet, &packet_offset, &boxes_table[i].n_publishers,
-                         sizeof(uint64_t));
-            packet_write(packet, &packet_offset, &boxes_table[i].n_subscribers,
-                         sizeof(uint64_t));
-        }
-        mutex_unlock(&boxes_table[i].mutex);
-        if (pipe_write(session_pipe_in, packet, packet_len) <= 0) {
+    // Reads all the current boxes straight from the FS (along with their
+    // sizes) and sends all the information to the manager client (boxes sent
+    // are not sorted because that's up to the client). Each box is only sent
+    // once the next one is found, so the last one can be flagged
+    box_t pending;
+    bool has_pending = false;
+    tfs_dir_entry entries[MBROKER_LISTING_BATCH];
+    size_t cursor = 0;
+    ssize_t n_entries;
+    while ((n_entries = tfs_readdir(&cursor, entries,
+                                    MBROKER_LISTING_BATCH)) > 0) {
+        for (ssize_t e = 0; e < n_entries; e++) {
+            // Only looks at taken boxes
+            size_t i = (size_t)entries[e].stat.inumber;
+            rwlock_rdlock(&free_boxes_lock);
+            if (i >= boxes_table_size || free_boxes[i] != TAKEN) {
+                rwlock_unlock(&free_boxes_lock);
+                continue;
+            }
+            box_t box;
+            memset(box.name, 0, sizeof(char) * BOX_NAME_MAX_LEN);
+            memcpy(box.name, entries[e].name,
+                   strnlen(entries[e].name, BOX_NAME_MAX_LEN - 1));
+            box.size = entries[e].stat.size;
+            mutex_lock(&boxes_table[i].mutex);
+            box.n_publishers = boxes_table[i].n_publishers;
+            box.n_subscribers = boxes_table[i].n_subscribers;
+            mutex_unlock(&boxes_table[i].mutex);
             rwlock_unlock(&free_boxes_lock);
-            close(session_pipe_in);
-            return -1;
+
+            if (has_pending && listing_send(session_pipe_in, &pending, 0)) {
+                close(session_pipe_in);
+                return -1;
+            }
+            pending = box;
+            has_pending = true;
         }
-        // When this counter reaches the number of boxes, we know we are
-        // finished
-        n_boxes_listed++;
     }
-    rwlock_unlock(&free_boxes_lock);
 
+    // When we have 0 boxes we send a single empty one with the last flag set
+    int result =
+        listing_send(session_pipe_in, has_pending ? &pending : NULL, 1);
     close(session_pipe_in);
-    return 0;
+    return result;
 }
 
-int box_create(char *box_name) {
-    rwlock_wrlock(&free_boxes_lock);
-    for (size_t i = 0; i < inode_table_size(); i++) {
-        // Finds first free entry in boxes table
-        if (free_boxes[i] == FREE) {
-            // Found a free entry, so takes it for the new box
-            free_boxes[i] = TAKEN;
-            n_boxes++;
-            rwlock_unlock(&free_boxes_lock);
-
-            mutex_lock(&boxes_table[i].mutex);
-            memset(boxes_table[i].name, 0, sizeof(char) * BOX_NAME_MAX_LEN);
-            strcpy(boxes_table[i].name, box_name);
-            boxes_table[i].size = 0;
-            boxes_table[i].n_subscribers = 0;
-            boxes_table[i].n_subscribers = 0;
-            mutex_unlock(&boxes_table[i].mutex);
+int box_create(int box_i) {
+    if (box_i < 0 || (size_t)box_i >= boxes_table_size) {
+        return -1;
+    }
 
-            return 0;
-        }
+    rwlock_wrlock(&free_boxes_lock);
+    if (free_boxes[box_i] == TAKEN) {
+        rwlock_unlock(&free_boxes_lock);
+        return -1;
     }
+    // Takes the entry of the box file for the new box
+    free_boxes[box_i] = TAKEN;
+    mutex_lock(&boxes_table[box_i].mutex);
+    boxes_table[box_i].n_publishers = 0;
+    boxes_table[box_i].n_subscribers = 0;
+    mutex_unlock(&boxes_table[box_i].mutex);
     rwlock_unlock(&free_boxes_lock);
 
-    return -1;
+    return 0;
 }
 
 int box_delete(char *box_name) {
-    rwlock_wrlock(&free_boxes_lock);
-    for (size_t i = 0; i < inode_table_size(); i++) {
-        // Finds the entry in boxes table
-        if (free_boxes[i] == TAKEN &&
-            strcmp(boxes_table[i].name, box_name) == 0) {
-            // Marks entry as deleted
-            mutex_lock(&boxes_table[i].mutex);
-            free_boxes[i] = FREE;
-            cond_broadcast(&boxes_table[i].cond);
-            mutex_unlock(&boxes_table[i].mutex);
-            n_boxes--;
-            rwlock_unlock(&free_boxes_lock);
-
-            return 0;
-        }
+    uint32_t generation;
+    int box_i = box_find(box_name, &generation);
+    if (box_i == -1) {
+        return -1;
     }
+
+    // Marks entry as deleted
+    rwlock_wrlock(&free_boxes_lock);
+    mutex_lock(&boxes_table[box_i].mutex);
+    free_boxes[box_i] = FREE;
+    cond_broadcast(&boxes_table[box_i].cond);
+    mutex_unlock(&boxes_table[box_i].mutex);
     rwlock_unlock(&free_boxes_lock);
 
-    return -1;
+    return 0;
 }
 
-int box_find(char *box_name) {
-    rwlock_rdlock(&free_boxes_lock);
-    for (size_t i = 0; i < inode_table_size(); i++) {
-        // Finds the entry in boxes table
-        if (free_boxes[i] == TAKEN &&
-            strcmp(boxes_table[i].name, box_name) == 0) {
-            rwlock_unlock(&free_boxes_lock);
-
-            return (int)i;
-        }
+int box_find(char *box_name, uint32_t *generation) {
+    // Finds the entry of the box file in boxes table
+    tfs_file_stat stat;
+    if (tfs_stat(box_name, &stat) != 0 ||
+        (size_t)stat.inumber >= boxes_table_size) {
+        return -1;
     }
+    *generation = stat.generation;
+
+    rwlock_rdlock(&free_boxes_lock);
+    bool taken = free_boxes[stat.inumber] == TAKEN;
     rwlock_unlock(&free_boxes_lock);
 
-    return -1;
+    return taken ? stat.inumber : -1;
 }
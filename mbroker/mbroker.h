@@ -4,8 +4,14 @@
 #include "../protocol/protocol.h"
 #include <sys/types.h>
 
+// Max number of boxes the server can have at once
+#define MBROKER_MAX_BOXES (1024)
+// Number of boxes read from the FS at a time when listing them
+#define MBROKER_LISTING_BATCH (16)
+
 /**
- * Server communication box
+ * Server communication box (the server only keeps its sessions, since its name
+ * and size are those of its file, and are only filled in for listings)
  */
 typedef struct {
     char name[BOX_NAME_MAX_LEN];
@@ -115,14 +121,14 @@ int workers_handle_manager_remove(request_t *request);
 int workers_handle_manager_listing(request_t *request);
 
 /**
- * Creates a box named box_name.
+ * Creates a box, kept in the box file with the given inumber.
  *
  * Input:
- *	- box_name: name of the box to be created
+ *	- box_i: inumber of the (newly created) box file
  *
  *	Returns 0 if successful, -1 otherwise.
  */
-int box_create(char *box_name);
+int box_create(int box_i);
 
 /**
  * Deletes the box with box_name name.
@@ -135,13 +141,15 @@ int box_create(char *box_name);
 int box_delete(char *box_name);
 
 /**
- * Finds the position of the box in the boxes_table
+ * Finds the position of the box in the boxes_table (the inumber of its file)
  *
  * Input:
  *	- box_name: name of the box to find
+ *	- generation: where to store the generation of the box file (so it can be
+ *	  opened by its inumber)
  *
  *	Return position of the box in the array is successful, -1 otherwise.
  */
-int box_find(char *box_name);
+int box_find(char *box_name, uint32_t *generation);
 
 #endif // __MBROKER_H__
@@ -0,0 +1,103 @@
+#include "../../fs/operations.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define BLOCK_SIZE (4096)
+#define FILE_COUNT (32)
+#define THREAD_COUNT (8)
+#define ROUNDS (3)
+
+char const *storage_path = "tests/fs-tests/block_cache_eviction.tfs";
+
+/**
+ * Fills a buffer with contents that depend on the file and the round.
+ */
+void fill(char *buffer, int file, int round) {
+    for (size_t i = 0; i < BLOCK_SIZE; i++) {
+        buffer[i] = (char)('a' + (file * 7 + round + (int)i) % 26);
+    }
+}
+
+void write_file(int file, int round) {
+    char path[MAX_FILE_NAME];
+    snprintf(path, sizeof(path), "/f%d", file);
+    char buffer[BLOCK_SIZE];
+    fill(buffer, file, round);
+
+    int f = tfs_open(path, TFS_O_CREAT | TFS_O_TRUNC);
+    assert(f != -1);
+    assert(tfs_write(f, buffer, sizeof(buffer)) == sizeof(buffer));
+    assert(tfs_close(f) != -1);
+}
+
+void check_file(int file, int round) {
+    char path[MAX_FILE_NAME];
+    snprintf(path, sizeof(path), "/f%d", file);
+    char expected[BLOCK_SIZE], buffer[BLOCK_SIZE];
+    fill(expected, file, round);
+
+    int f = tfs_open(path, 0);
+    assert(f != -1);
+    assert(tfs_read(f, buffer, sizeof(buffer)) == sizeof(buffer));
+    assert(memcmp(buffer, expected, sizeof(buffer)) == 0);
+    assert(tfs_close(f) != -1);
+}
+
+void *worker(void *arg) {
+    int first = (int)(size_t)arg;
+    for (int round = 0; round < ROUNDS; round++) {
+        for (int i = first; i < FILE_COUNT; i += THREAD_COUNT) {
+            write_file(i, round);
+        }
+        for (int i = first; i < FILE_COUNT; i += THREAD_COUNT) {
+            check_file(i, round);
+        }
+    }
+
+    return NULL;
+}
+
+int main() {
+    // A cache that fits far fewer blocks than the files use, so blocks are
+    // constantly evicted, written back and read again
+    tfs_params params = tfs_default_params();
+    params.block_size = BLOCK_SIZE;
+    params.max_block_count = FILE_COUNT + 1;
+    params.storage_backend = TFS_STORAGE_DIRECT_FILE;
+    params.storage_path = storage_path;
+    params.block_cache_size = 4 * BLOCK_SIZE;
+    assert(tfs_init(&params) != -1);
+
+    // Sequentially
+    for (int i = 0; i < FILE_COUNT; i++) {
+        write_file(i, 0);
+    }
+    for (int i = 0; i < FILE_COUNT; i++) {
+        check_file(i, 0);
+    }
+
+    // Concurrently
+    pthread_t threads[THREAD_COUNT];
+    for (size_t i = 0; i < THREAD_COUNT; i++) {
+        assert(pthread_create(&threads[i], NULL, worker, (void *)i) == 0);
+    }
+    for (size_t i = 0; i < THREAD_COUNT; i++) {
+        assert(pthread_join(threads[i], NULL) == 0);
+    }
+    for (int i = 0; i < FILE_COUNT; i++) {
+        check_file(i, ROUNDS - 1);
+    }
+
+    assert(tfs_destroy() != -1);
+
+    char pool_path[64];
+    snprintf(pool_path, sizeof(pool_path), "%s.0", storage_path);
+    assert(unlink(pool_path) == 0);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
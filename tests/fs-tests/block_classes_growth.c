@@ -0,0 +1,73 @@
+#include "../../fs/operations.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+char const file_path1[] = "/f1";
+char const file_path2[] = "/f2";
+
+void assert_contents_ok(char const *path, char c, size_t len);
+
+int main() {
+    // init TécnicoFS with one block of each size (the root directory takes the
+    // 512 bytes one, since it's the smallest that fits its entries)
+    tfs_params params = tfs_default_params();
+    params.max_inode_count = 4;
+    params.max_block_count = 1;
+    params.block_size = 1024;
+    params.block_class_count = 2;
+    params.block_classes[0].block_size = 128;
+    params.block_classes[0].block_count = 1;
+    params.block_classes[1].block_size = 512;
+    params.block_classes[1].block_count = 1;
+    assert(tfs_init(&params) != -1);
+
+    char buffer[1024];
+    memset(buffer, 'A', sizeof(buffer));
+
+    // the file starts in the 128 bytes block
+    int f1 = tfs_open(file_path1, TFS_O_CREAT);
+    assert(f1 != -1);
+    assert(tfs_write(f1, buffer, 100) == 100);
+
+    // and grows into the main pool, since the 512 bytes block is taken
+    assert(tfs_write(f1, buffer, 200) == 200);
+    assert(tfs_close(f1) != -1);
+    assert_contents_ok(file_path1, 'A', 300);
+
+    // the 128 bytes block was released when the first file grew
+    memset(buffer, 'B', sizeof(buffer));
+    int f2 = tfs_open(file_path2, TFS_O_CREAT);
+    assert(f2 != -1);
+    assert(tfs_write(f2, buffer, 100) == 100);
+
+    // but there is no bigger block left for the second file to grow into
+    assert(tfs_write(f2, buffer, 300) == -1);
+    assert(tfs_close(f2) != -1);
+    assert_contents_ok(file_path2, 'B', 100);
+
+    // files can still grow up to the main block size
+    f1 = tfs_open(file_path1, TFS_O_APPEND);
+    assert(f1 != -1);
+    assert(tfs_write(f1, buffer, sizeof(buffer)) == 1024 - 300);
+    assert(tfs_close(f1) != -1);
+
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
+
+void assert_contents_ok(char const *path, char c, size_t len) {
+    int f = tfs_open(path, 0);
+    assert(f != -1);
+
+    char buffer[1024];
+    assert(tfs_read(f, buffer, sizeof(buffer)) == len);
+    for (size_t i = 0; i < len; i++) {
+        assert(buffer[i] == c);
+    }
+
+    assert(tfs_close(f) != -1);
+}
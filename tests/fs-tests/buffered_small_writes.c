@@ -0,0 +1,106 @@
+#include "../../fs/operations.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#define BLOCK_SIZE (1024)
+#define RECORD_SIZE (8)
+#define RECORD_COUNT (100)
+
+char const *path = "/f1";
+
+/**
+ * Returns the number of accesses to secondary memory made so far (with the
+ * metadata cache disabled, every metadata access is one).
+ */
+size_t metadata_accesses() {
+    tfs_metadata_stats stats;
+    assert(tfs_get_metadata_stats(&stats) != -1);
+    return stats.misses;
+}
+
+/**
+ * Appends RECORD_COUNT small records to a new file, returning how many
+ * metadata accesses it took.
+ */
+size_t append_records(tfs_file_mode_t mode) {
+    int f = tfs_open(path, TFS_O_CREAT | TFS_O_TRUNC | mode);
+    assert(f != -1);
+    size_t before = metadata_accesses();
+    for (int i = 0; i < RECORD_COUNT; i++) {
+        char record[RECORD_SIZE];
+        memset(record, 'a' + i % 26, sizeof(record));
+        assert(tfs_write(f, record, sizeof(record)) == sizeof(record));
+    }
+    assert(tfs_close(f) != -1);
+    size_t accesses = metadata_accesses() - before;
+
+    // Every record reached the file
+    f = tfs_open(path, 0);
+    assert(f != -1);
+    char buffer[RECORD_COUNT * RECORD_SIZE];
+    assert(tfs_read(f, buffer, sizeof(buffer)) == sizeof(buffer));
+    for (int i = 0; i < RECORD_COUNT; i++) {
+        for (int j = 0; j < RECORD_SIZE; j++) {
+            assert(buffer[i * RECORD_SIZE + j] == 'a' + i % 26);
+        }
+    }
+    assert(tfs_close(f) != -1);
+
+    return accesses;
+}
+
+int main() {
+    tfs_params params = tfs_default_params();
+    params.block_size = BLOCK_SIZE;
+    params.metadata_cache_size = 0;
+    assert(tfs_init(&params) != -1);
+
+    // Small writes are coalesced, so they take far fewer accesses
+    size_t unbuffered = append_records(0);
+    size_t buffered = append_records(TFS_O_BUFFERED);
+    assert(buffered * 10 < unbuffered);
+
+    // Buffered writes are only visible to other handles once flushed, but
+    // always to the handle's own reads
+    char buffer[BLOCK_SIZE];
+    int writer = tfs_open(path, TFS_O_TRUNC | TFS_O_BUFFERED);
+    assert(writer != -1);
+    int reader = tfs_open(path, 0);
+    assert(reader != -1);
+    assert(tfs_write(writer, "hello", 5) == 5);
+    assert(tfs_read(reader, buffer, sizeof(buffer)) == 0);
+    assert(tfs_flush(writer) != -1);
+    assert(tfs_read(reader, buffer, sizeof(buffer)) == 5);
+    assert(memcmp(buffer, "hello", 5) == 0);
+
+    assert(tfs_write(writer, " world", 6) == 6);
+    assert(tfs_read(writer, buffer, sizeof(buffer)) == 0);
+    assert(tfs_read(reader, buffer, sizeof(buffer)) == 6);
+    assert(memcmp(buffer, " world", 6) == 0);
+
+    // Writes past the max file size are cut short, as if unbuffered
+    memset(buffer, 'x', sizeof(buffer));
+    assert(tfs_write(writer, buffer, 100) == 100);
+    assert(tfs_write(writer, buffer, sizeof(buffer)) == BLOCK_SIZE - 111);
+    assert(tfs_write(writer, buffer, 1) == 0);
+
+    // Closing flushes the remaining writes
+    assert(tfs_close(writer) != -1);
+    assert(tfs_read(reader, buffer, sizeof(buffer)) == BLOCK_SIZE - 11);
+    assert(tfs_close(reader) != -1);
+
+    // Only open handles can be flushed
+    assert(tfs_flush(writer) == -1);
+
+    // Handles left open are flushed when the FS is destroyed
+    writer = tfs_open(path, TFS_O_TRUNC | TFS_O_BUFFERED);
+    assert(writer != -1);
+    assert(tfs_write(writer, "bye", 3) == 3);
+
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
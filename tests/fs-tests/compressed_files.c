@@ -0,0 +1,124 @@
+#include "../../fs/operations.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#define BLOCK_SIZE (64 * 1024)
+#define SMALL_BLOCK_SIZE (4 * 1024)
+#define RECORD_SIZE (1024)
+#define FILE_COUNT (8)
+
+/**
+ * Fills a record like the ones of the mbroker boxes (a short message,
+ * padded with zeros).
+ */
+void fill_record(char *record, int file, int i) {
+    memset(record, 0, RECORD_SIZE);
+    snprintf(record, RECORD_SIZE, "message %d of file %d", i, file);
+}
+
+/**
+ * Fills a buffer with contents that barely compress.
+ */
+void fill_noise(char *buffer, size_t size, unsigned seed) {
+    for (size_t i = 0; i < size; i++) {
+        seed = seed * 1103515245 + 12345;
+        buffer[i] = (char)(seed >> 16);
+    }
+}
+
+int main() {
+    // One main block (besides the root directory's), and small blocks for
+    // the rest
+    tfs_params params = tfs_default_params();
+    params.block_size = BLOCK_SIZE;
+    params.max_block_count = 1;
+    params.block_class_count = 1;
+    params.block_classes[0].block_size = SMALL_BLOCK_SIZE;
+    params.block_classes[0].block_count = FILE_COUNT + 2;
+    assert(tfs_init(&params) != -1);
+
+    // Files full of records take a small block each when compressed
+    char record[RECORD_SIZE], buffer[BLOCK_SIZE];
+    for (int file = 0; file < FILE_COUNT; file++) {
+        char path[MAX_FILE_NAME];
+        snprintf(path, sizeof(path), "/box%d", file);
+        int f = tfs_open(path, TFS_O_CREAT | TFS_O_COMPRESS);
+        assert(f != -1);
+        for (int i = 0; i < BLOCK_SIZE / RECORD_SIZE; i++) {
+            fill_record(record, file, i);
+            assert(tfs_write(f, record, sizeof(record)) == sizeof(record));
+        }
+        assert(tfs_write(f, record, 1) == 0);
+        assert(tfs_close(f) != -1);
+    }
+    for (int file = 0; file < FILE_COUNT; file++) {
+        char path[MAX_FILE_NAME];
+        snprintf(path, sizeof(path), "/box%d", file);
+        int f = tfs_open(path, 0);
+        assert(f != -1);
+        // Reads them back in pieces that don't line up with the frames
+        for (int i = 0; i < BLOCK_SIZE / RECORD_SIZE; i++) {
+            fill_record(record, file, i);
+            assert(tfs_read(f, buffer, 100) == 100);
+            assert(memcmp(buffer, record, 100) == 0);
+            assert(tfs_read(f, buffer, RECORD_SIZE - 100) ==
+                   RECORD_SIZE - 100);
+            assert(memcmp(buffer, record + 100, RECORD_SIZE - 100) == 0);
+        }
+        assert(tfs_read(f, buffer, 1) == 0);
+        assert(tfs_close(f) != -1);
+    }
+
+    // While the main block only fits one uncompressed file
+    int f = tfs_open("/plain", TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_write(f, buffer, SMALL_BLOCK_SIZE + 1) == SMALL_BLOCK_SIZE + 1);
+    assert(tfs_close(f) != -1);
+    f = tfs_open("/plain2", TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_write(f, buffer, SMALL_BLOCK_SIZE + 1) == -1);
+    assert(tfs_close(f) != -1);
+    assert(tfs_unlink("/plain2") != -1);
+
+    // Contents that don't compress, overwritten in the middle (of a sealed
+    // frame), and truncated
+    assert(tfs_unlink("/plain") != -1);
+    char noise[3 * SMALL_BLOCK_SIZE], expected[3 * SMALL_BLOCK_SIZE];
+    fill_noise(noise, sizeof(noise), 1);
+    f = tfs_open("/noise", TFS_O_CREAT | TFS_O_COMPRESS);
+    assert(f != -1);
+    assert(tfs_write(f, noise, sizeof(noise)) == sizeof(noise));
+    assert(tfs_close(f) != -1);
+    memcpy(expected, noise, sizeof(noise));
+
+    f = tfs_open("/noise", 0);
+    assert(f != -1);
+    assert(tfs_read(f, buffer, 5000) == 5000);
+    fill_noise(noise, 3000, 2);
+    assert(tfs_write(f, noise, 3000) == 3000);
+    memcpy(expected + 5000, noise, 3000);
+    assert(tfs_close(f) != -1);
+
+    f = tfs_open("/noise", 0);
+    assert(f != -1);
+    assert(tfs_read(f, buffer, sizeof(buffer)) == sizeof(expected));
+    assert(memcmp(buffer, expected, sizeof(expected)) == 0);
+    assert(tfs_close(f) != -1);
+
+    f = tfs_open("/noise", TFS_O_TRUNC);
+    assert(f != -1);
+    assert(tfs_write(f, "tiny", 4) == 4);
+    assert(tfs_close(f) != -1);
+    f = tfs_open("/noise", 0);
+    assert(f != -1);
+    assert(tfs_read(f, buffer, sizeof(buffer)) == 4);
+    assert(memcmp(buffer, "tiny", 4) == 0);
+    assert(tfs_close(f) != -1);
+
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
@@ -0,0 +1,79 @@
+#include "../../fs/operations.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#define COPIES_PER_FILE (5)
+#define SOURCE_COUNT (4)
+#define COPY_COUNT (SOURCE_COUNT * COPIES_PER_FILE)
+#define THREAD_COUNT (4)
+#define BUFFER_LEN (1024)
+
+char const *sources[SOURCE_COUNT] = {
+    "tests/fs-tests/file_to_copy_over512.txt",
+    "tests/fs-tests/file_to_copy_many_different_characters.txt",
+    "tests/fs-tests/empty_file.txt",
+    "/dev/null", // which can't be mapped, so it's read instead
+};
+
+/**
+ * Asserts that a file in TécnicoFS has the same contents as an external one.
+ */
+void assert_same_contents(char const *dest_path, char const *source_path) {
+    char expected[BUFFER_LEN], buffer[BUFFER_LEN];
+    FILE *source = fopen(source_path, "r");
+    assert(source != NULL);
+    size_t expected_len = fread(expected, 1, sizeof(expected), source);
+    assert(fclose(source) == 0);
+
+    int f = tfs_open(dest_path, 0);
+    assert(f != -1);
+    assert(tfs_read(f, buffer, sizeof(buffer)) == expected_len);
+    assert(memcmp(buffer, expected, expected_len) == 0);
+    assert(tfs_close(f) != -1);
+}
+
+int main() {
+    tfs_params params = tfs_default_params();
+    params.max_block_count = COPY_COUNT + 2;
+    assert(tfs_init(&params) != -1);
+
+    char dest_names[COPY_COUNT][MAX_FILE_NAME];
+    char const *source_paths[COPY_COUNT + 1], *dest_paths[COPY_COUNT + 1];
+    for (size_t i = 0; i < COPY_COUNT; i++) {
+        snprintf(dest_names[i], MAX_FILE_NAME, "/copy%zu", i);
+        source_paths[i] = sources[i % SOURCE_COUNT];
+        dest_paths[i] = dest_names[i];
+    }
+
+    // Every file is copied, whatever thread copies it
+    assert(tfs_copy_many_from_external_fs(source_paths, dest_paths,
+                                          COPY_COUNT, THREAD_COUNT) != -1);
+    for (size_t i = 0; i < COPY_COUNT; i++) {
+        assert_same_contents(dest_paths[i], source_paths[i]);
+    }
+
+    // Copying over the same files again replaces them, and a file that's too
+    // large fails the batch without stopping the other copies
+    assert(tfs_copy_many_from_external_fs(source_paths + 1, dest_paths,
+                                          COPY_COUNT - 1, THREAD_COUNT) != -1);
+    source_paths[COPY_COUNT] = "tests/fs-tests/file_overflow.txt";
+    dest_paths[COPY_COUNT] = "/overflow";
+    assert(tfs_copy_many_from_external_fs(source_paths, dest_paths,
+                                          COPY_COUNT + 1, THREAD_COUNT) == -1);
+    for (size_t i = 0; i < COPY_COUNT; i++) {
+        assert_same_contents(dest_paths[i], source_paths[i]);
+    }
+    assert(tfs_open("/overflow", 0) == -1);
+
+    assert(tfs_copy_many_from_external_fs(NULL, dest_paths, 1, 1) == -1);
+    assert(tfs_copy_many_from_external_fs(source_paths, dest_paths, 1, 0) ==
+           -1);
+    assert(tfs_copy_many_from_external_fs(NULL, NULL, 0, 1) != -1);
+
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
@@ -0,0 +1,112 @@
+#include "../../fs/operations.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define LARGE_SIZE (200 * 1024)
+#define HOLE_SIZE (1000)
+
+char large[LARGE_SIZE];
+
+/**
+ * Asserts that an external file has the given contents.
+ */
+void assert_external_contents(char const *path, char const *contents,
+                              size_t size) {
+    static char buffer[LARGE_SIZE + 1];
+    FILE *file = fopen(path, "r");
+    assert(file != NULL);
+    assert(fread(buffer, 1, sizeof(buffer), file) == size);
+    assert(memcmp(buffer, contents, size) == 0);
+    assert(fclose(file) == 0);
+}
+
+/**
+ * Writes a file in TécnicoFS with the given contents.
+ */
+void write_file(char const *path, char const *contents, size_t size,
+                tfs_file_mode_t mode) {
+    int f = tfs_open(path, TFS_O_CREAT | mode);
+    assert(f != -1);
+    assert(tfs_write(f, contents, size) == size);
+    assert(tfs_close(f) != -1);
+}
+
+int main() {
+    // Blocks large enough for files that take many chunks to write
+    tfs_params params = tfs_default_params();
+    params.block_size = LARGE_SIZE;
+    params.max_block_count = 8;
+    assert(tfs_init(&params) != -1);
+
+    for (size_t i = 0; i < LARGE_SIZE; i++) {
+        large[i] = (char)('a' + i % 23);
+    }
+    write_file("/large", large, LARGE_SIZE, 0);
+    write_file("/compressed", large, LARGE_SIZE, TFS_O_COMPRESS);
+    write_file("/tiny", "tiny", 4, 0);
+    write_file("/empty", "", 0, 0);
+    int f = tfs_open("/sparse", TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_write(f, "head", 4) == 4);
+    assert(tfs_ftruncate(f, HOLE_SIZE) != -1);
+    assert(tfs_close(f) != -1);
+    assert(tfs_sym_link("/tiny", "/link") != -1);
+
+    char dir[] = "/tmp/tfs-export-XXXXXX";
+    assert(mkdtemp(dir) != NULL);
+    char path[64];
+
+    // A single file, whatever way it's stored
+    snprintf(path, sizeof(path), "%s/single", dir);
+    assert(tfs_copy_to_external_fs("/large", path) != -1);
+    assert_external_contents(path, large, LARGE_SIZE);
+    assert(tfs_copy_to_external_fs("/compressed", path) != -1);
+    assert_external_contents(path, large, LARGE_SIZE);
+    assert(tfs_copy_to_external_fs("/link", path) != -1);
+    assert_external_contents(path, "tiny", 4);
+    assert(unlink(path) == 0);
+    assert(tfs_copy_to_external_fs("/missing", path) == -1);
+    assert(access(path, F_OK) == -1);
+    assert(tfs_copy_to_external_fs("large", path) == -1);
+    assert(tfs_copy_to_external_fs("/large", "/nonexistent-dir/file") == -1);
+
+    // The whole FS, which can be copied back as it was
+    snprintf(path, sizeof(path), "%s/all", dir);
+    assert(tfs_copy_to_external_fs("/", path) != -1);
+    char const *names[] = {"large", "compressed", "tiny", "empty", "sparse"};
+    char sparse[HOLE_SIZE] = "head";
+    char const *contents[] = {large, large, "tiny", "", sparse};
+    size_t sizes[] = {LARGE_SIZE, LARGE_SIZE, 4, 0, HOLE_SIZE};
+    char file_path[128];
+    for (size_t i = 0; i < sizeof(names) / sizeof(*names); i++) {
+        snprintf(file_path, sizeof(file_path), "%s/%s", path, names[i]);
+        assert_external_contents(file_path, contents[i], sizes[i]);
+    }
+    snprintf(file_path, sizeof(file_path), "%s/link", path);
+    assert(access(file_path, F_OK) == -1);
+
+    snprintf(file_path, sizeof(file_path), "%s/sparse", path);
+    assert(tfs_copy_from_external_fs(file_path, "/copied") != -1);
+    char buffer[HOLE_SIZE + 1];
+    f = tfs_open("/copied", 0);
+    assert(f != -1);
+    assert(tfs_read(f, buffer, sizeof(buffer)) == HOLE_SIZE);
+    assert(memcmp(buffer, sparse, HOLE_SIZE) == 0);
+    assert(tfs_close(f) != -1);
+
+    for (size_t i = 0; i < sizeof(names) / sizeof(*names); i++) {
+        snprintf(file_path, sizeof(file_path), "%s/%s", path, names[i]);
+        assert(unlink(file_path) == 0);
+    }
+    assert(rmdir(path) == 0);
+    assert(rmdir(dir) == 0);
+
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
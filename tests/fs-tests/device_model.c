@@ -0,0 +1,131 @@
+#include "../../fs/operations.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define BLOCK_SIZE (1024)
+#define THREAD_COUNT (4)
+#define READS_PER_THREAD (5)
+#define ACCESS_NS (1000000)
+
+/**
+ * Returns the current time of a given clock, in nanoseconds.
+ */
+uint64_t clock_ns(clockid_t clock) {
+    struct timespec now;
+    assert(clock_gettime(clock, &now) == 0);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+/**
+ * Reads the file a few times (each read accessing its data block).
+ */
+void *read_file(void *arg) {
+    (void)arg;
+    for (int i = 0; i < READS_PER_THREAD; i++) {
+        char buffer[BLOCK_SIZE];
+        int f = tfs_open("/f", 0);
+        assert(f != -1);
+        assert(tfs_read(f, buffer, sizeof(buffer)) == BLOCK_SIZE);
+        assert(tfs_close(f) != -1);
+    }
+
+    return NULL;
+}
+
+/**
+ * Returns how long THREAD_COUNT threads take to read the file at once, on a
+ * device with the given model.
+ */
+uint64_t concurrent_reads_ns(tfs_device_model const *model) {
+    tfs_params params = tfs_default_params();
+    params.block_size = BLOCK_SIZE;
+    assert(tfs_init(&params) != -1);
+    int f = tfs_open("/f", TFS_O_CREAT);
+    assert(f != -1);
+    char buffer[BLOCK_SIZE];
+    memset(buffer, 'x', sizeof(buffer));
+    assert(tfs_write(f, buffer, sizeof(buffer)) == BLOCK_SIZE);
+    assert(tfs_close(f) != -1);
+    assert(tfs_destroy() != -1);
+
+    // The file is written again on the modeled device (the FS starts over)
+    params.device = *model;
+    assert(tfs_init(&params) != -1);
+    f = tfs_open("/f", TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_write(f, buffer, sizeof(buffer)) == BLOCK_SIZE);
+    assert(tfs_close(f) != -1);
+
+    uint64_t start = clock_ns(CLOCK_MONOTONIC);
+    pthread_t threads[THREAD_COUNT];
+    for (int i = 0; i < THREAD_COUNT; i++) {
+        assert(pthread_create(&threads[i], NULL, read_file, NULL) == 0);
+    }
+    for (int i = 0; i < THREAD_COUNT; i++) {
+        assert(pthread_join(threads[i], NULL) == 0);
+    }
+    uint64_t elapsed = clock_ns(CLOCK_MONOTONIC) - start;
+    assert(tfs_destroy() != -1);
+
+    return elapsed;
+}
+
+int main() {
+    // Unknown wait modes are rejected
+    tfs_params params = tfs_default_params();
+    params.device.wait = (tfs_device_wait_t)42;
+    assert(tfs_init(&params) == -1);
+
+    // The presets work as any other model
+    tfs_device_kind_t kinds[] = {TFS_DEVICE_RAM, TFS_DEVICE_NVME,
+                                 TFS_DEVICE_SATA_SSD};
+    for (size_t i = 0; i < sizeof(kinds) / sizeof(kinds[0]); i++) {
+        params = tfs_default_params();
+        params.device = tfs_device_preset(kinds[i]);
+        assert(tfs_init(&params) != -1);
+        int f = tfs_open("/f", TFS_O_CREAT);
+        assert(f != -1);
+        assert(tfs_write(f, "hello", 5) == 5);
+        assert(tfs_close(f) != -1);
+        assert(tfs_destroy() != -1);
+    }
+
+    // Sleeping on a slow device takes its latency, but not the CPU
+    params = tfs_default_params();
+    params.metadata_cache_size = 0;
+    params.device.metadata_latency_ns = ACCESS_NS;
+    params.device.wait = TFS_DEVICE_SLEEP;
+    assert(tfs_init(&params) != -1);
+    uint64_t start = clock_ns(CLOCK_MONOTONIC);
+    uint64_t cpu_start = clock_ns(CLOCK_PROCESS_CPUTIME_ID);
+    int f = tfs_open("/f", TFS_O_CREAT);
+    uint64_t cpu_elapsed = clock_ns(CLOCK_PROCESS_CPUTIME_ID) - cpu_start;
+    uint64_t elapsed = clock_ns(CLOCK_MONOTONIC) - start;
+    assert(f != -1);
+    assert(elapsed >= ACCESS_NS);
+    assert(cpu_elapsed < elapsed / 2);
+    assert(tfs_close(f) != -1);
+    assert(tfs_destroy() != -1);
+
+    // A single channel (or a single access in the queue) serves the reads one
+    // at a time, each taking as long as its block takes to transfer
+    tfs_device_model model = {
+        .bandwidth = (uint64_t)BLOCK_SIZE * 1000000000u / ACCESS_NS,
+        .channels = 1,
+        .wait = TFS_DEVICE_YIELD,
+    };
+    assert(concurrent_reads_ns(&model) >=
+           THREAD_COUNT * READS_PER_THREAD * ACCESS_NS);
+    model.channels = 0;
+    model.queue_depth = 1;
+    model.wait = TFS_DEVICE_SLEEP;
+    assert(concurrent_reads_ns(&model) >=
+           THREAD_COUNT * READS_PER_THREAD * ACCESS_NS);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
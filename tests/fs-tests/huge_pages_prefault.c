@@ -0,0 +1,41 @@
+#include "../../fs/operations.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#define BLOCK_SIZE (4 * 1024 * 1024)
+
+char buffer[BLOCK_SIZE];
+
+int main() {
+    // init TécnicoFS with a data area big enough to use huge pages, all of its
+    // memory faulted in up front (this must work even if the system has no
+    // huge pages reserved)
+    tfs_params params = tfs_default_params();
+    params.block_size = BLOCK_SIZE;
+    params.max_block_count = 4;
+    params.use_huge_pages = true;
+    params.prefault_memory = true;
+    assert(tfs_init(&params) != -1);
+
+    memset(buffer, 'A', sizeof(buffer));
+    int f = tfs_open("/f1", TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_write(f, buffer, sizeof(buffer)) == sizeof(buffer));
+    assert(tfs_close(f) != -1);
+
+    memset(buffer, 0, sizeof(buffer));
+    f = tfs_open("/f1", 0);
+    assert(f != -1);
+    assert(tfs_read(f, buffer, sizeof(buffer)) == sizeof(buffer));
+    for (size_t i = 0; i < sizeof(buffer); i++) {
+        assert(buffer[i] == 'A');
+    }
+    assert(tfs_close(f) != -1);
+
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
@@ -0,0 +1,58 @@
+#include "../../fs/config.h"
+#include "../../fs/operations.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+char const small_contents[] = "Small enough to be kept inside the inode.";
+char const file_path[] = "/f1";
+char const link_path[] = "/l1";
+
+int main() {
+    assert(sizeof(small_contents) <= INODE_INLINE_DATA_SIZE);
+
+    // init TécnicoFS with a single data block (taken by the root directory)
+    tfs_params params = tfs_default_params();
+    params.max_inode_count = 3;
+    params.max_block_count = 1;
+    assert(tfs_init(&params) != -1);
+
+    // small files don't need a data block
+    int f = tfs_open(file_path, TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_write(f, small_contents, sizeof(small_contents)) ==
+           sizeof(small_contents));
+    assert(tfs_close(f) != -1);
+
+    // neither do symbolic links with short target paths
+    assert(tfs_sym_link(file_path, link_path) != -1);
+
+    // reads the contents back through the symbolic link
+    char buffer[sizeof(small_contents)] = {0};
+    f = tfs_open(link_path, 0);
+    assert(f != -1);
+    assert(tfs_read(f, buffer, sizeof(buffer)) == sizeof(buffer));
+    assert(memcmp(buffer, small_contents, sizeof(buffer)) == 0);
+    assert(tfs_close(f) != -1);
+
+    // growing the file past the inline data needs a block, which doesn't exist
+    char big_contents[INODE_INLINE_DATA_SIZE + 1];
+    memset(big_contents, 'A', sizeof(big_contents));
+    f = tfs_open(file_path, TFS_O_APPEND);
+    assert(f != -1);
+    assert(tfs_write(f, big_contents, sizeof(big_contents)) == -1);
+    assert(tfs_close(f) != -1);
+
+    // the inline contents are left untouched
+    f = tfs_open(file_path, 0);
+    assert(f != -1);
+    assert(tfs_read(f, buffer, sizeof(buffer)) == sizeof(buffer));
+    assert(memcmp(buffer, small_contents, sizeof(buffer)) == 0);
+    assert(tfs_close(f) != -1);
+
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
@@ -0,0 +1,120 @@
+#include "../../fs/operations.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define FILE_COUNT (16)
+#define ACCESS_NS (1000000)
+
+/**
+ * Returns the current time of the monotonic clock, in nanoseconds.
+ */
+uint64_t now_ns(void) {
+    struct timespec now;
+    assert(clock_gettime(CLOCK_MONOTONIC, &now) == 0);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+/**
+ * Creates FILE_COUNT empty files.
+ */
+void create_files(void) {
+    for (int i = 0; i < FILE_COUNT; i++) {
+        char path[MAX_FILE_NAME];
+        snprintf(path, sizeof(path), "/f%d", i);
+        int f = tfs_open(path, TFS_O_CREAT);
+        assert(f != -1);
+        assert(tfs_close(f) != -1);
+    }
+}
+
+/**
+ * Returns the I/O scheduler statistics accrued since the given ones.
+ */
+tfs_io_stats io_since(tfs_io_stats const *before) {
+    tfs_io_stats now;
+    assert(tfs_get_io_stats(&now) != -1);
+    now.requests -= before->requests;
+    now.dispatches -= before->dispatches;
+    now.bytes -= before->bytes;
+
+    return now;
+}
+
+int main() {
+    // Every metadata access misses the cache, and takes as long as the
+    // device's latency
+    tfs_params params = tfs_default_params();
+    params.metadata_cache_size = 0;
+    params.device.metadata_latency_ns = ACCESS_NS;
+    params.device.read_latency_ns = 0;
+    params.device.wait = TFS_DEVICE_SLEEP;
+    assert(tfs_init(&params) != -1);
+    assert(tfs_get_io_stats(NULL) == -1);
+
+    create_files();
+
+    // Opening a file accesses the root directory's inode, its block and the
+    // file's inode (in the same block as the root's), which are merged
+    tfs_io_stats before;
+    assert(tfs_get_io_stats(&before) != -1);
+    uint64_t start = now_ns();
+    int f = tfs_open("/f3", 0);
+    uint64_t elapsed = now_ns() - start;
+    assert(f != -1);
+    tfs_io_stats io = io_since(&before);
+    assert(io.dispatches > 0 && io.dispatches < io.requests);
+    assert(io.bytes > 0);
+    assert(elapsed >= ACCESS_NS);
+
+    // So does stating it (the root directory's inode included)
+    assert(tfs_get_io_stats(&before) != -1);
+    tfs_file_stat stat;
+    assert(tfs_stat("/f3", &stat) != -1);
+    io = io_since(&before);
+    assert(io.dispatches > 0 && io.dispatches < io.requests);
+
+    // Accesses outside of the merged operations are dispatched one by one
+    assert(tfs_get_io_stats(&before) != -1);
+    assert(tfs_write(f, "hello", 5) == 5);
+    io = io_since(&before);
+    assert(io.dispatches == io.requests);
+    assert(tfs_close(f) != -1);
+
+    // Listing the directory stats every file, whose inodes share blocks
+    assert(tfs_get_io_stats(&before) != -1);
+    size_t cursor = 0;
+    tfs_dir_entry entries[FILE_COUNT];
+    assert(tfs_readdir(&cursor, entries, FILE_COUNT) == FILE_COUNT);
+    io = io_since(&before);
+    assert(io.requests >= FILE_COUNT);
+    assert(io.dispatches * 2 <= io.requests);
+
+    // So do the inodes of the files unlinked at once
+    assert(tfs_get_io_stats(&before) != -1);
+    char const *targets[FILE_COUNT];
+    char paths[FILE_COUNT][MAX_FILE_NAME];
+    for (int i = 0; i < FILE_COUNT; i++) {
+        snprintf(paths[i], sizeof(paths[i]), "/f%d", i);
+        targets[i] = paths[i];
+    }
+    assert(tfs_unlink_many(targets, FILE_COUNT) == FILE_COUNT);
+    io = io_since(&before);
+    assert(io.dispatches * 2 <= io.requests);
+    assert(tfs_destroy() != -1);
+
+    // The metadata written back when the FS is destroyed isn't merged, so
+    // every dirty inode pays the latency of its write-back (some may have been
+    // written back earlier, when evicted)
+    params.metadata_cache_size = 1024;
+    assert(tfs_init(&params) != -1);
+    create_files();
+    start = now_ns();
+    assert(tfs_destroy() != -1);
+    assert(now_ns() - start >= FILE_COUNT / 2 * ACCESS_NS);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
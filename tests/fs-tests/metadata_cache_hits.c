@@ -0,0 +1,63 @@
+#include "../../fs/operations.h"
+#include <assert.h>
+#include <stdio.h>
+
+#define OPEN_COUNT (100)
+
+/**
+ * Creates a file and reopens it many times.
+ */
+void reopen_file(void) {
+    int f = tfs_open("/f1", TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_close(f) != -1);
+
+    for (int i = 0; i < OPEN_COUNT; i++) {
+        f = tfs_open("/f1", 0);
+        assert(f != -1);
+        assert(tfs_write(f, "x", 1) == 1);
+        assert(tfs_close(f) != -1);
+    }
+}
+
+int main() {
+    tfs_metadata_stats stats;
+
+    // With the cache, the root inode, the root directory and the file inode
+    // are only missed the first time
+    tfs_params params = tfs_default_params();
+    assert(tfs_init(&params) != -1);
+    reopen_file();
+    assert(tfs_get_metadata_stats(&stats) != -1);
+    assert(stats.hits >= 3 * OPEN_COUNT);
+    assert(stats.misses < 16);
+    assert(tfs_destroy() != -1);
+
+    // Without it, every access misses
+    params.metadata_cache_size = 0;
+    assert(tfs_init(&params) != -1);
+    reopen_file();
+    assert(tfs_get_metadata_stats(&stats) != -1);
+    assert(stats.hits == 0);
+    assert(stats.misses >= 3 * OPEN_COUNT);
+    assert(stats.write_backs == 0);
+    assert(tfs_destroy() != -1);
+
+    // A tiny cache keeps evicting the modified inodes and directory blocks
+    params.metadata_cache_size = 1;
+    assert(tfs_init(&params) != -1);
+    char path[MAX_FILE_NAME];
+    for (int i = 0; i < 16; i++) {
+        snprintf(path, sizeof(path), "/f%d", i);
+        int f = tfs_open(path, TFS_O_CREAT);
+        assert(f != -1);
+        assert(tfs_close(f) != -1);
+    }
+    assert(tfs_get_metadata_stats(&stats) != -1);
+    assert(stats.write_backs > 0);
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
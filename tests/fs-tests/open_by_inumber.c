@@ -0,0 +1,86 @@
+#include "../../fs/operations.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+/**
+ * Asserts that an open file reads as the given contents, closing it.
+ */
+void assert_contents(int f, char const *contents) {
+    char buffer[16];
+    assert(f != -1);
+    assert(tfs_read(f, buffer, sizeof(buffer)) == strlen(contents));
+    assert(memcmp(buffer, contents, strlen(contents)) == 0);
+    assert(tfs_close(f) != -1);
+}
+
+int main() {
+    // Few inodes, so deleted ones are reused right away
+    tfs_params params = tfs_default_params();
+    params.max_inode_count = 3;
+    params.inode_count_limit = 3;
+    assert(tfs_init(&params) != -1);
+
+    int f = tfs_open("/a", TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_write(f, "first", 5) == 5);
+    assert(tfs_close(f) != -1);
+    tfs_file_stat stat;
+    assert(tfs_stat("/a", &stat) != -1);
+
+    // The file is opened by its inumber, with any mode but creating it
+    assert_contents(tfs_open_inum(stat.inumber, stat.generation, 0), "first");
+    f = tfs_open_inum(stat.inumber, stat.generation, TFS_O_APPEND);
+    assert(f != -1);
+    assert(tfs_write(f, "+", 1) == 1);
+    assert(tfs_close(f) != -1);
+    assert_contents(tfs_open("/a", 0), "first+");
+    f = tfs_open_inum(stat.inumber, stat.generation, TFS_O_TRUNC);
+    assert(f != -1);
+    assert(tfs_write(f, "second", 6) == 6);
+    assert(tfs_close(f) != -1);
+    assert_contents(tfs_open("/a", 0), "second");
+
+    // Renaming it keeps its generation, and so does linking it
+    assert(tfs_rename("/a", "/b") != -1);
+    assert(tfs_link("/b", "/c") != -1);
+    tfs_file_stat renamed;
+    assert(tfs_stat("/c", &renamed) != -1);
+    assert(renamed.inumber == stat.inumber);
+    assert(renamed.generation == stat.generation);
+    assert(tfs_unlink("/c") != -1);
+
+    // Only existing files can be opened, and not directories nor links
+    assert(tfs_open_inum(-1, 0, 0) == -1);
+    assert(tfs_open_inum(1000, 0, 0) == -1);
+    assert(tfs_stat("/", &stat) != -1 && stat.type == TFS_T_DIRECTORY);
+    assert(tfs_open_inum(stat.inumber, stat.generation, 0) == -1);
+    assert(tfs_sym_link("/b", "/link") != -1);
+    assert(tfs_stat("/link", &stat) != -1);
+    assert(tfs_open_inum(stat.inumber, stat.generation, 0) == -1);
+    assert(tfs_unlink("/link") != -1);
+
+    // Once the file is deleted, another one that reuses its inode isn't
+    // mistaken for it, while opening it the new file is fine
+    int open = tfs_open_inum(renamed.inumber, renamed.generation, 0);
+    assert(tfs_unlink("/b") != -1);
+    assert_contents(tfs_open_inum(renamed.inumber, renamed.generation, 0),
+                    "second");
+    assert_contents(open, "second");
+    assert(tfs_open_inum(renamed.inumber, renamed.generation, 0) == -1);
+    f = tfs_open("/d", TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_write(f, "third", 5) == 5);
+    assert(tfs_close(f) != -1);
+    assert(tfs_stat("/d", &stat) != -1);
+    assert(stat.inumber == renamed.inumber);
+    assert(stat.generation != renamed.generation);
+    assert(tfs_open_inum(renamed.inumber, renamed.generation, 0) == -1);
+    assert_contents(tfs_open_inum(stat.inumber, stat.generation, 0), "third");
+
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
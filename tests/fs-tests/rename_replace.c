@@ -0,0 +1,136 @@
+#include "../../fs/operations.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#define ROTATIONS (200)
+#define READER_COUNT (4)
+#define RECORD_SIZE (32)
+
+char const *current_path = "/current";
+char const *next_path = "/next";
+
+/**
+ * Asserts that a file has the given contents.
+ */
+void assert_contents(char const *path, char const *contents) {
+    char buffer[RECORD_SIZE];
+    int f = tfs_open(path, 0);
+    assert(f != -1);
+    assert(tfs_read(f, buffer, sizeof(buffer)) == strlen(contents));
+    assert(memcmp(buffer, contents, strlen(contents)) == 0);
+    assert(tfs_close(f) != -1);
+}
+
+/**
+ * Writes a file with the given contents.
+ */
+void write_file(char const *path, char const *contents) {
+    int f = tfs_open(path, TFS_O_CREAT | TFS_O_TRUNC);
+    assert(f != -1);
+    assert(tfs_write(f, contents, strlen(contents)) == strlen(contents));
+    assert(tfs_close(f) != -1);
+}
+
+/**
+ * Rotates the current file, swapping in a rebuilt one.
+ */
+void *rotate(void *arg) {
+    (void)arg;
+    for (int i = 1; i <= ROTATIONS; i++) {
+        char record[RECORD_SIZE];
+        snprintf(record, sizeof(record), "generation %08d", i);
+        write_file(next_path, record);
+        assert(tfs_rename(next_path, current_path) != -1);
+    }
+
+    return NULL;
+}
+
+/**
+ * Reads the current file while it's being rotated, which must always exist
+ * and hold a whole record.
+ */
+void *read_current(void *arg) {
+    (void)arg;
+    for (int i = 0; i < ROTATIONS; i++) {
+        char buffer[RECORD_SIZE];
+        int f = tfs_open(current_path, 0);
+        assert(f != -1);
+        assert(tfs_read(f, buffer, sizeof(buffer)) ==
+               strlen("generation 00000000"));
+        assert(memcmp(buffer, "generation ", strlen("generation ")) == 0);
+        assert(tfs_close(f) != -1);
+    }
+
+    return NULL;
+}
+
+int main() {
+    // Few inodes (one for each file the readers may keep open, besides the
+    // root directory, current and next files), so files that aren't deleted
+    // when replaced run out of them
+    tfs_params params = tfs_default_params();
+    params.max_inode_count = READER_COUNT + 4;
+    params.inode_count_limit = READER_COUNT + 4;
+    assert(tfs_init(&params) != -1);
+
+    // Renaming moves the entry
+    write_file("/a", "A");
+    assert(tfs_rename("/a", "/b") != -1);
+    assert(tfs_open("/a", 0) == -1);
+    assert_contents("/b", "A");
+    assert(tfs_rename("/a", "/c") == -1);
+    assert(tfs_rename("/b", "/b") != -1);
+    assert(tfs_rename("/b", "b") == -1);
+    assert_contents("/b", "A");
+
+    // Renaming onto an existing file replaces it, which is deleted once it's
+    // closed
+    write_file("/c", "C");
+    int f = tfs_open("/c", 0);
+    assert(f != -1);
+    assert(tfs_rename("/b", "/c") != -1);
+    assert(tfs_open("/b", 0) == -1);
+    assert_contents("/c", "A");
+    char buffer[RECORD_SIZE];
+    assert(tfs_read(f, buffer, sizeof(buffer)) == 1 && buffer[0] == 'C');
+    assert(tfs_close(f) != -1);
+
+    // Renaming a hard link onto another link to the same file keeps both
+    assert(tfs_link("/c", "/d") != -1);
+    assert(tfs_rename("/c", "/d") != -1);
+    assert_contents("/c", "A");
+    assert_contents("/d", "A");
+    assert(tfs_unlink("/c") != -1);
+
+    // Symbolic links are renamed themselves, and still resolve
+    assert(tfs_sym_link("/d", "/s") != -1);
+    assert(tfs_rename("/s", "/t") != -1);
+    assert_contents("/t", "A");
+    assert(tfs_unlink("/t") != -1);
+    assert(tfs_rename("/d", current_path) != -1);
+    write_file(current_path, "generation 00000000");
+
+    // Rotating the current file never leaves readers without it (and frees
+    // every replaced file, or the inodes would run out)
+    pthread_t rotator, readers[READER_COUNT];
+    assert(pthread_create(&rotator, NULL, rotate, NULL) == 0);
+    for (int i = 0; i < READER_COUNT; i++) {
+        assert(pthread_create(&readers[i], NULL, read_current, NULL) == 0);
+    }
+    assert(pthread_join(rotator, NULL) == 0);
+    for (int i = 0; i < READER_COUNT; i++) {
+        assert(pthread_join(readers[i], NULL) == 0);
+    }
+    char record[RECORD_SIZE];
+    snprintf(record, sizeof(record), "generation %08d", ROTATIONS);
+    assert_contents(current_path, record);
+
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
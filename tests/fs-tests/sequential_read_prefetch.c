@@ -0,0 +1,106 @@
+#include "../../fs/operations.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define BLOCK_SIZE (4096)
+#define CHUNK_SIZE (64)
+#define FILE_COUNT (16)
+#define THREAD_COUNT (4)
+
+char const *storage_path = "tests/fs-tests/sequential_read_prefetch.tfs";
+
+/**
+ * Fills a buffer with contents that depend on the file.
+ */
+void fill(char *buffer, int file) {
+    for (size_t i = 0; i < BLOCK_SIZE; i++) {
+        buffer[i] = (char)('a' + (file * 5 + (int)i) % 26);
+    }
+}
+
+/**
+ * Reads a file in small chunks (so the reads are detected as sequential and
+ * its block is prefetched), interleaved with whole reads of another file (so
+ * the blocks compete for the cache).
+ */
+void read_in_chunks(int file) {
+    char path[MAX_FILE_NAME], other_path[MAX_FILE_NAME];
+    snprintf(path, sizeof(path), "/f%d", file);
+    snprintf(other_path, sizeof(other_path), "/f%d",
+             (file + FILE_COUNT / 2) % FILE_COUNT);
+    char expected[BLOCK_SIZE], other_buffer[BLOCK_SIZE];
+    fill(expected, file);
+
+    int f = tfs_open(path, 0);
+    assert(f != -1);
+    char buffer[CHUNK_SIZE];
+    for (size_t offset = 0; offset < BLOCK_SIZE; offset += CHUNK_SIZE) {
+        assert(tfs_read(f, buffer, sizeof(buffer)) == sizeof(buffer));
+        assert(memcmp(buffer, expected + offset, sizeof(buffer)) == 0);
+
+        int other_f = tfs_open(other_path, 0);
+        assert(other_f != -1);
+        assert(tfs_read(other_f, other_buffer, sizeof(other_buffer)) ==
+               sizeof(other_buffer));
+        assert(tfs_close(other_f) != -1);
+    }
+    assert(tfs_read(f, buffer, sizeof(buffer)) == 0);
+    assert(tfs_close(f) != -1);
+}
+
+void *worker(void *arg) {
+    int first = (int)(size_t)arg;
+    for (int i = first; i < FILE_COUNT; i += THREAD_COUNT) {
+        read_in_chunks(i);
+    }
+
+    return NULL;
+}
+
+int main() {
+    tfs_params params = tfs_default_params();
+    params.block_size = BLOCK_SIZE;
+    params.max_block_count = FILE_COUNT + 1;
+    params.storage_backend = TFS_STORAGE_DIRECT_FILE;
+    params.storage_path = storage_path;
+    params.block_cache_size = 2 * BLOCK_SIZE;
+    assert(tfs_init(&params) != -1);
+
+    char buffer[BLOCK_SIZE];
+    for (int i = 0; i < FILE_COUNT; i++) {
+        char path[MAX_FILE_NAME];
+        snprintf(path, sizeof(path), "/f%d", i);
+        fill(buffer, i);
+        int f = tfs_open(path, TFS_O_CREAT);
+        assert(f != -1);
+        assert(tfs_write(f, buffer, sizeof(buffer)) == sizeof(buffer));
+        assert(tfs_close(f) != -1);
+    }
+
+    // Sequentially
+    for (int i = 0; i < FILE_COUNT; i++) {
+        read_in_chunks(i);
+    }
+
+    // Concurrently
+    pthread_t threads[THREAD_COUNT];
+    for (size_t i = 0; i < THREAD_COUNT; i++) {
+        assert(pthread_create(&threads[i], NULL, worker, (void *)i) == 0);
+    }
+    for (size_t i = 0; i < THREAD_COUNT; i++) {
+        assert(pthread_join(threads[i], NULL) == 0);
+    }
+
+    assert(tfs_destroy() != -1);
+
+    char pool_path[64];
+    snprintf(pool_path, sizeof(pool_path), "%s.0", storage_path);
+    assert(unlink(pool_path) == 0);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
@@ -0,0 +1,149 @@
+#include "../../fs/operations.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#define BLOCK_SIZE (1024)
+#define BLOCK_COUNT (8)
+#define RECORD_SIZE (16)
+
+/**
+ * Checks that a file of a snapshot has the given contents.
+ */
+void assert_snapshot_contents(int snapshot, char const *path,
+                              char const *expected, size_t size) {
+    char buffer[BLOCK_SIZE];
+    int f = tfs_snapshot_open(snapshot, path);
+    assert(f != -1);
+    assert(tfs_read(f, buffer, sizeof(buffer)) == size);
+    assert(memcmp(buffer, expected, size) == 0);
+    assert(tfs_close(f) != -1);
+}
+
+void write_file(char const *path, tfs_file_mode_t mode, char const *contents,
+                size_t size) {
+    int f = tfs_open(path, TFS_O_CREAT | mode);
+    assert(f != -1);
+    assert(tfs_write(f, contents, size) == size);
+    assert(tfs_close(f) != -1);
+}
+
+void *appender(void *arg) {
+    (void)arg;
+    int f = tfs_open("/log", TFS_O_CREAT | TFS_O_APPEND);
+    assert(f != -1);
+    char record[RECORD_SIZE];
+    for (int i = 0; i < BLOCK_SIZE / RECORD_SIZE; i++) {
+        memset(record, 'a' + i % 26, sizeof(record));
+        assert(tfs_write(f, record, sizeof(record)) == sizeof(record));
+    }
+    assert(tfs_close(f) != -1);
+
+    return NULL;
+}
+
+int main() {
+    tfs_params params = tfs_default_params();
+    params.block_size = BLOCK_SIZE;
+    params.max_block_count = BLOCK_COUNT;
+    assert(tfs_init(&params) != -1);
+
+    char big[BLOCK_SIZE / 2];
+    memset(big, 'b', sizeof(big));
+    write_file("/big", 0, big, sizeof(big));
+    write_file("/small", 0, "small", 5);
+    write_file("/gone", 0, big, sizeof(big));
+    assert(tfs_sym_link("/small", "/link") != -1);
+
+    int s1 = tfs_snapshot();
+    assert(s1 != -1);
+
+    // Modifies every file after the snapshot
+    char changed[BLOCK_SIZE / 2];
+    memset(changed, 'c', sizeof(changed));
+    write_file("/big", 0, changed, 10);
+    write_file("/big", TFS_O_APPEND, changed, 100);
+    write_file("/small", TFS_O_TRUNC, "new", 3);
+    assert(tfs_unlink("/gone") != -1);
+    write_file("/created", 0, "created", 7);
+
+    // The snapshot still sees the files as they were
+    assert_snapshot_contents(s1, "/big", big, sizeof(big));
+    assert_snapshot_contents(s1, "/small", "small", 5);
+    assert_snapshot_contents(s1, "/link", "small", 5);
+    assert_snapshot_contents(s1, "/gone", big, sizeof(big));
+    assert(tfs_snapshot_open(s1, "/created") == -1);
+
+    // While the FS sees the changes
+    char buffer[BLOCK_SIZE];
+    int f = tfs_open("/big", 0);
+    assert(f != -1);
+    assert(tfs_read(f, buffer, sizeof(buffer)) == sizeof(big) + 100);
+    assert(memcmp(buffer, changed, 10) == 0);
+    assert(memcmp(buffer + 10, big + 10, sizeof(big) - 10) == 0);
+    assert(tfs_close(f) != -1);
+
+    // A second snapshot sees the changes, but not the ones after it
+    int s2 = tfs_snapshot();
+    assert(s2 != -1 && s2 != s1);
+    write_file("/created", TFS_O_TRUNC, "again", 5);
+    assert_snapshot_contents(s2, "/created", "created", 7);
+    assert_snapshot_contents(s2, "/small", "new", 3);
+    assert_snapshot_contents(s1, "/small", "small", 5);
+
+    // Snapshots are read-only, and can't be deleted with files open
+    f = tfs_snapshot_open(s1, "/big");
+    assert(f != -1);
+    assert(tfs_write(f, "x", 1) == -1);
+    assert(tfs_snapshot_delete(s1) == -1);
+    assert(tfs_close(f) != -1);
+    assert(tfs_snapshot_delete(s1) != -1);
+    assert(tfs_snapshot_delete(s1) == -1);
+    assert(tfs_snapshot_open(s1, "/big") == -1);
+    assert(tfs_snapshot_delete(s2) != -1);
+
+    // Once no snapshot needs them, the old blocks are freed, so all of them
+    // can be used again
+    assert(tfs_unlink("/big") != -1);
+    assert(tfs_unlink("/small") != -1);
+    assert(tfs_unlink("/link") != -1);
+    assert(tfs_unlink("/created") != -1);
+    for (int i = 0; i < BLOCK_COUNT - 1; i++) {
+        char path[MAX_FILE_NAME];
+        snprintf(path, sizeof(path), "/f%d", i);
+        write_file(path, 0, big, sizeof(big));
+    }
+    for (int i = 0; i < BLOCK_COUNT - 1; i++) {
+        char path[MAX_FILE_NAME];
+        snprintf(path, sizeof(path), "/f%d", i);
+        assert(tfs_unlink(path) != -1);
+    }
+
+    // Snapshots taken while a file is appended to see whole records
+    pthread_t thread;
+    assert(pthread_create(&thread, NULL, appender, NULL) == 0);
+    size_t last_size = 0;
+    while (last_size < BLOCK_SIZE) {
+        int s = tfs_snapshot();
+        assert(s != -1);
+        f = tfs_snapshot_open(s, "/log");
+        if (f != -1) {
+            ssize_t size = tfs_read(f, buffer, sizeof(buffer));
+            assert(size >= last_size && size % RECORD_SIZE == 0);
+            for (ssize_t i = 0; i < size; i++) {
+                assert(buffer[i] == 'a' + (i / RECORD_SIZE) % 26);
+            }
+            last_size = (size_t)size;
+            assert(tfs_close(f) != -1);
+        }
+        assert(tfs_snapshot_delete(s) != -1);
+    }
+    assert(pthread_join(thread, NULL) == 0);
+
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
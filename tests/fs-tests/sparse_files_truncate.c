@@ -0,0 +1,145 @@
+#include "../../fs/operations.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#define BLOCK_SIZE (16 * 1024)
+#define HOLE_SIZE (3000)
+
+/**
+ * Asserts that a file reads as the given prefix followed by zeros, up to a
+ * given size.
+ */
+void assert_contents(char const *path, char const *prefix, size_t prefix_len,
+                     size_t size) {
+    char buffer[BLOCK_SIZE];
+    int f = tfs_open(path, 0);
+    assert(f != -1);
+    assert(tfs_read(f, buffer, sizeof(buffer)) == size);
+    assert(memcmp(buffer, prefix, prefix_len) == 0);
+    for (size_t i = prefix_len; i < size; i++) {
+        assert(buffer[i] == 0);
+    }
+    assert(tfs_close(f) != -1);
+}
+
+/**
+ * Fills a buffer with contents that compress well.
+ */
+void fill_pattern(char *buffer, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        buffer[i] = (char)('a' + i % 7);
+    }
+}
+
+int main() {
+    // A single data block (besides the root directory's)
+    tfs_params params = tfs_default_params();
+    params.block_size = BLOCK_SIZE;
+    params.max_block_count = 2;
+    assert(tfs_init(&params) != -1);
+
+    // Extending a file leaves a hole that reads as zeros and takes no space
+    int f = tfs_open("/log", TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_write(f, "hello", 5) == 5);
+    assert(tfs_ftruncate(f, HOLE_SIZE) != -1);
+    assert(tfs_close(f) != -1);
+    assert_contents("/log", "hello", 5, HOLE_SIZE);
+
+    int other = tfs_open("/other", TFS_O_CREAT);
+    assert(other != -1);
+    assert(tfs_write(other, "x", 1) == 1);
+    assert(tfs_fallocate(other, BLOCK_SIZE) != -1);
+    f = tfs_open("/log", TFS_O_APPEND);
+    assert(f != -1);
+    assert(tfs_write(f, "world", 5) == -1);
+    assert(tfs_close(f) != -1);
+    assert(tfs_close(other) != -1);
+    assert(tfs_unlink("/other") != -1);
+
+    // Writing past the hole fills it with zeros
+    f = tfs_open("/log", TFS_O_APPEND);
+    assert(f != -1);
+    assert(tfs_write(f, "world", 5) == 5);
+    assert(tfs_close(f) != -1);
+    char expected[BLOCK_SIZE];
+    memset(expected, 0, sizeof(expected));
+    memcpy(expected, "hello", 5);
+    memcpy(expected + HOLE_SIZE, "world", 5);
+    assert_contents("/log", expected, HOLE_SIZE + 5, HOLE_SIZE + 5);
+
+    // Trimmed contents don't come back when the file is extended again
+    f = tfs_open("/log", 0);
+    assert(f != -1);
+    assert(tfs_ftruncate(f, 2) != -1);
+    assert(tfs_ftruncate(f, 10) != -1);
+    assert(tfs_ftruncate(f, BLOCK_SIZE + 1) == -1);
+    assert(tfs_close(f) != -1);
+    assert_contents("/log", "he", 2, 10);
+
+    // Space reserved for a file doesn't change its size, and writing up to
+    // it doesn't need any more space
+    assert(tfs_unlink("/log") != -1);
+    f = tfs_open("/reserved", TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_fallocate(f, BLOCK_SIZE) != -1);
+    assert_contents("/reserved", "", 0, 0);
+    other = tfs_open("/other", TFS_O_CREAT);
+    assert(other != -1);
+    assert(tfs_fallocate(other, BLOCK_SIZE) == -1);
+    assert(tfs_close(other) != -1);
+    char buffer[BLOCK_SIZE];
+    fill_pattern(buffer, sizeof(buffer));
+    for (size_t i = 0; i < BLOCK_SIZE; i += 1024) {
+        assert(tfs_write(f, buffer + i, 1024) == 1024);
+    }
+    assert(tfs_close(f) != -1);
+    assert_contents("/reserved", buffer, BLOCK_SIZE, BLOCK_SIZE);
+
+    // Snapshots keep the contents a truncation discards
+    int snapshot = tfs_snapshot();
+    assert(snapshot != -1);
+    f = tfs_open("/reserved", 0);
+    assert(f != -1);
+    assert(tfs_ftruncate(f, 0) != -1);
+    assert(tfs_close(f) != -1);
+    assert_contents("/reserved", "", 0, 0);
+    f = tfs_snapshot_open(snapshot, "/reserved");
+    assert(f != -1);
+    char read_buffer[BLOCK_SIZE];
+    assert(tfs_read(f, read_buffer, sizeof(read_buffer)) == BLOCK_SIZE);
+    assert(memcmp(read_buffer, buffer, BLOCK_SIZE) == 0);
+    assert(tfs_ftruncate(f, 1) == -1);
+    assert(tfs_close(f) != -1);
+    assert(tfs_snapshot_delete(snapshot) != -1);
+    assert(tfs_unlink("/reserved") != -1);
+    assert(tfs_unlink("/other") != -1);
+
+    // Compressed files are cut short within a frame, at a frame boundary and
+    // extended with holes too
+    f = tfs_open("/compressed", TFS_O_CREAT | TFS_O_COMPRESS);
+    assert(f != -1);
+    assert(tfs_write(f, buffer, 10000) == 10000);
+    assert(tfs_ftruncate(f, 5000) != -1);
+    assert(tfs_ftruncate(f, 9000) != -1);
+    assert(tfs_close(f) != -1);
+    memcpy(expected, buffer, 5000);
+    memset(expected + 5000, 0, 4000);
+    assert_contents("/compressed", expected, 9000, 9000);
+    f = tfs_open("/compressed", TFS_O_APPEND);
+    assert(f != -1);
+    assert(tfs_ftruncate(f, 4096) != -1);
+    assert(tfs_ftruncate(f, 6000) != -1);
+    assert(tfs_write(f, "end", 3) == 3);
+    assert(tfs_close(f) != -1);
+    memset(expected + 4096, 0, 6000 - 4096);
+    memcpy(expected + 6000, "end", 3);
+    assert_contents("/compressed", expected, 6003, 6003);
+
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
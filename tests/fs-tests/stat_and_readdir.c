@@ -0,0 +1,86 @@
+#include "../../fs/operations.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#define FILE_COUNT (20)
+#define BATCH_SIZE (3)
+
+int main() {
+    assert(tfs_init(NULL) != -1);
+
+    // Files of different sizes, a hard link and a symbolic link
+    for (int i = 0; i < FILE_COUNT; i++) {
+        char path[MAX_FILE_NAME];
+        snprintf(path, sizeof(path), "/f%d", i);
+        int f = tfs_open(path, TFS_O_CREAT);
+        assert(f != -1);
+        char buffer[FILE_COUNT];
+        memset(buffer, 'x', sizeof(buffer));
+        assert(tfs_write(f, buffer, (size_t)i) == i);
+        assert(tfs_close(f) != -1);
+    }
+    assert(tfs_link("/f1", "/hard") != -1);
+    assert(tfs_sym_link("/f2", "/soft") != -1);
+
+    tfs_file_stat stat;
+    assert(tfs_stat("/f3", &stat) != -1);
+    assert(stat.type == TFS_T_FILE && stat.size == 3 && stat.hard_links == 1);
+    assert(tfs_stat("/hard", &stat) != -1);
+    assert(stat.type == TFS_T_FILE && stat.size == 1 && stat.hard_links == 2);
+    int f1_inumber = stat.inumber;
+    assert(tfs_stat("/soft", &stat) != -1);
+    assert(stat.type == TFS_T_SYM_LINK && stat.size == strlen("/f2"));
+    assert(tfs_stat("/", &stat) != -1);
+    assert(stat.type == TFS_T_DIRECTORY);
+    assert(tfs_stat("/missing", &stat) == -1);
+    assert(tfs_stat("f3", &stat) == -1);
+
+    // The metadata of an open file includes the writes it buffered
+    int f = tfs_open("/f1", TFS_O_APPEND | TFS_O_BUFFERED);
+    assert(f != -1);
+    assert(tfs_write(f, "yy", 2) == 2);
+    assert(tfs_fstat(f, &stat) != -1);
+    assert(stat.inumber == f1_inumber && stat.size == 3);
+    assert(tfs_close(f) != -1);
+    assert(tfs_fstat(f, &stat) == -1);
+
+    // Reading the directory in small batches returns every entry once
+    assert(tfs_unlink("/f0") != -1);
+    int seen[FILE_COUNT] = {0};
+    int hard_seen = 0, soft_seen = 0;
+    size_t cursor = 0;
+    tfs_dir_entry entries[BATCH_SIZE];
+    ssize_t count;
+    while ((count = tfs_readdir(&cursor, entries, BATCH_SIZE)) > 0) {
+        assert(count <= BATCH_SIZE);
+        for (ssize_t i = 0; i < count; i++) {
+            int n;
+            if (strcmp(entries[i].name, "hard") == 0) {
+                assert(entries[i].stat.inumber == f1_inumber);
+                hard_seen++;
+            } else if (strcmp(entries[i].name, "soft") == 0) {
+                assert(entries[i].stat.type == TFS_T_SYM_LINK);
+                soft_seen++;
+            } else {
+                assert(sscanf(entries[i].name, "f%d", &n) == 1);
+                assert(n > 0 && n < FILE_COUNT);
+                assert(entries[i].stat.size == (n == 1 ? 3 : n));
+                seen[n]++;
+            }
+        }
+    }
+    assert(count == 0);
+    assert(tfs_readdir(&cursor, entries, BATCH_SIZE) == 0);
+    assert(hard_seen == 1 && soft_seen == 1 && seen[0] == 0);
+    for (int i = 1; i < FILE_COUNT; i++) {
+        assert(seen[i] == 1);
+    }
+    assert(tfs_readdir(NULL, entries, BATCH_SIZE) == -1);
+
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
@@ -0,0 +1,115 @@
+#include "../../fs/operations.h"
+#include <assert.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define FILE_COUNT (8)
+#define BIG_FILE_SIZE (3000)
+
+char const *storage_path = "tests/fs-tests/storage_backends.tfs";
+
+char big_file_contents[BIG_FILE_SIZE];
+
+// Must be bigger than the inline data of an inode, so that it needs a block
+char const file_contents[] =
+    "AAA! This content is too big to be stored inside the inode itself!";
+
+/**
+ * Checks that a storage file holds the given contents somewhere.
+ */
+void assert_in_storage_file(char const *path, char const *contents,
+                            size_t size) {
+    int fd = open(path, O_RDONLY);
+    assert(fd != -1);
+    off_t file_size = lseek(fd, 0, SEEK_END);
+    assert(file_size > 0);
+    char data[file_size];
+    assert(pread(fd, data, (size_t)file_size, 0) == file_size);
+    assert(close(fd) == 0);
+
+    for (off_t i = 0; i + (off_t)size <= file_size; i++) {
+        if (memcmp(data + i, contents, size) == 0) {
+            return;
+        }
+    }
+    assert(false);
+}
+
+void run_with_backend(tfs_storage_t backend) {
+    tfs_params params = tfs_default_params();
+    params.block_size = 4096;
+    params.max_block_count = 2;
+    params.block_count_limit = FILE_COUNT;
+    params.block_class_count = 1;
+    params.block_classes[0].block_size = 256;
+    params.block_classes[0].block_count = 4;
+    params.block_classes[0].block_count_limit = FILE_COUNT;
+    params.storage_backend = backend;
+    params.storage_path = storage_path;
+    assert(tfs_init(&params) != -1);
+
+    // writes small files (that fill more than one chunk of the small blocks)
+    // and a big one
+    char path[MAX_FILE_NAME];
+    for (int i = 0; i < FILE_COUNT - 2; i++) {
+        snprintf(path, sizeof(path), "/f%d", i);
+        int f = tfs_open(path, TFS_O_CREAT);
+        assert(f != -1);
+        assert(tfs_write(f, file_contents, sizeof(file_contents)) ==
+               sizeof(file_contents));
+        assert(tfs_close(f) != -1);
+    }
+    int f = tfs_open("/big", TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_write(f, big_file_contents, sizeof(big_file_contents)) ==
+           sizeof(big_file_contents));
+    assert(tfs_close(f) != -1);
+
+    // reads them back
+    for (int i = 0; i < FILE_COUNT - 2; i++) {
+        snprintf(path, sizeof(path), "/f%d", i);
+        f = tfs_open(path, 0);
+        assert(f != -1);
+        char buffer[sizeof(file_contents)];
+        assert(tfs_read(f, buffer, sizeof(buffer)) == sizeof(buffer));
+        assert(memcmp(buffer, file_contents, sizeof(buffer)) == 0);
+        assert(tfs_close(f) != -1);
+    }
+    f = tfs_open("/big", 0);
+    assert(f != -1);
+    char buffer[BIG_FILE_SIZE];
+    assert(tfs_read(f, buffer, sizeof(buffer)) == sizeof(buffer));
+    assert(memcmp(buffer, big_file_contents, sizeof(buffer)) == 0);
+    assert(tfs_close(f) != -1);
+
+    assert(tfs_destroy() != -1);
+
+    // the contents made it to the storage files
+    if (backend != TFS_STORAGE_MEMORY) {
+        char pool_path[64];
+        snprintf(pool_path, sizeof(pool_path), "%s.0", storage_path);
+        assert_in_storage_file(pool_path, file_contents,
+                               sizeof(file_contents));
+        assert(unlink(pool_path) == 0);
+        snprintf(pool_path, sizeof(pool_path), "%s.1", storage_path);
+        assert_in_storage_file(pool_path, big_file_contents,
+                               sizeof(big_file_contents));
+        assert(unlink(pool_path) == 0);
+    }
+}
+
+int main() {
+    for (size_t i = 0; i < sizeof(big_file_contents); i++) {
+        big_file_contents[i] = (char)('a' + i % 26);
+    }
+
+    run_with_backend(TFS_STORAGE_MEMORY);
+    run_with_backend(TFS_STORAGE_MAPPED_FILE);
+    run_with_backend(TFS_STORAGE_DIRECT_FILE);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
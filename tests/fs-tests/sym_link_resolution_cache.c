@@ -0,0 +1,115 @@
+#include "../../fs/operations.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#define CHAIN_LENGTH (MAX_SYM_LINK_HOPS)
+
+/**
+ * Returns the number of accesses to secondary memory made so far (with the
+ * metadata cache disabled, every metadata access is one).
+ */
+size_t metadata_accesses() {
+    tfs_metadata_stats stats;
+    assert(tfs_get_metadata_stats(&stats) != -1);
+    return stats.misses;
+}
+
+/**
+ * Asserts that a path name opens a file with the given contents, returning
+ * how many metadata accesses opening it took.
+ */
+size_t assert_contents(char const *path, char const *contents) {
+    char buffer[16];
+    size_t before = metadata_accesses();
+    int f = tfs_open(path, 0);
+    size_t accesses = metadata_accesses() - before;
+    assert(f != -1);
+    assert(tfs_read(f, buffer, sizeof(buffer)) == strlen(contents));
+    assert(memcmp(buffer, contents, strlen(contents)) == 0);
+    assert(tfs_close(f) != -1);
+
+    return accesses;
+}
+
+/**
+ * Writes a file with the given contents.
+ */
+void write_file(char const *path, char const *contents) {
+    int f = tfs_open(path, TFS_O_CREAT | TFS_O_TRUNC);
+    assert(f != -1);
+    assert(tfs_write(f, contents, strlen(contents)) == strlen(contents));
+    assert(tfs_close(f) != -1);
+}
+
+int main() {
+    tfs_params params = tfs_default_params();
+    params.metadata_cache_size = 0;
+    assert(tfs_init(&params) != -1);
+
+    // A chain of links as long as can be followed (l0 -> l1 -> ... -> file)
+    write_file("/file", "first");
+    char link[MAX_FILE_NAME], target[MAX_FILE_NAME];
+    for (int i = CHAIN_LENGTH - 1; i >= 0; i--) {
+        snprintf(link, sizeof(link), "/l%d", i);
+        if (i == CHAIN_LENGTH - 1) {
+            strcpy(target, "/file");
+        } else {
+            snprintf(target, sizeof(target), "/l%d", i + 1);
+        }
+        assert(tfs_sym_link(target, link) != -1);
+    }
+
+    // Once resolved, opening through the chain costs a single lookup
+    size_t uncached = assert_contents("/l0", "first");
+    size_t cached = assert_contents("/l0", "first");
+    assert(cached < uncached);
+    assert(assert_contents("/file", "first") == cached);
+
+    // New names can't change it, so adding one keeps the resolution
+    write_file("/unrelated", "other");
+    assert(assert_contents("/l0", "first") == cached);
+
+    // Changing any entry invalidates the resolution
+    assert(tfs_unlink("/file") != -1);
+    assert(tfs_open("/l0", 0) == -1);
+    write_file("/file", "second");
+    assert(assert_contents("/l0", "second") == uncached);
+    write_file("/other", "third");
+    assert(tfs_rename("/other", "/file") != -1);
+    assert_contents("/l0", "third");
+    assert(tfs_unlink("/l7") != -1);
+    assert(tfs_sym_link("/other", "/l7") != -1);
+    assert(tfs_open("/l0", 0) == -1);
+
+    // Creating through a dangling chain creates its last target
+    int f = tfs_open("/l0", TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_write(f, "fourth", 6) == 6);
+    assert(tfs_close(f) != -1);
+    assert_contents("/other", "fourth");
+
+    // One link too many can't be followed
+    assert(tfs_sym_link("/l0", "/longer") != -1);
+    assert(tfs_open("/longer", 0) == -1);
+    assert(tfs_open("/longer", TFS_O_CREAT) == -1);
+
+    // Nor can cycles of links
+    assert(tfs_sym_link("/b", "/a") != -1);
+    assert(tfs_sym_link("/a", "/b") != -1);
+    assert(tfs_open("/a", 0) == -1);
+    assert(tfs_open("/a", TFS_O_CREAT) == -1);
+    int snapshot = tfs_snapshot();
+    assert(snapshot != -1);
+    assert(tfs_snapshot_open(snapshot, "/a") == -1);
+    f = tfs_snapshot_open(snapshot, "/l0");
+    assert(f != -1);
+    assert(tfs_close(f) != -1);
+    assert(tfs_snapshot_delete(snapshot) != -1);
+
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
@@ -0,0 +1,66 @@
+#include "../../fs/operations.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#define FILE_COUNT (7)
+#define OPEN_FILE_COUNT (4)
+
+// Must be bigger than the inline data of an inode, so that it needs a block
+char const file_contents[] =
+    "AAA! This content is too big to be stored inside the inode itself!";
+
+int main() {
+    // init TécnicoFS with tiny tables, that have room to grow
+    tfs_params params = tfs_default_params();
+    params.max_inode_count = 2;
+    params.inode_count_limit = FILE_COUNT + 1;
+    params.max_block_count = 2;
+    params.block_count_limit = FILE_COUNT + 1;
+    params.max_open_files_count = 1;
+    params.open_files_count_limit = OPEN_FILE_COUNT;
+    assert(tfs_init(&params) != -1);
+
+    // creates more files (each with its own block) than the initial tables fit,
+    // keeping some of them open
+    int fhandles[FILE_COUNT];
+    char path[MAX_FILE_NAME];
+    for (int i = 0; i < FILE_COUNT; i++) {
+        snprintf(path, sizeof(path), "/f%d", i);
+        fhandles[i] = tfs_open(path, TFS_O_CREAT);
+        assert(fhandles[i] != -1);
+        assert(tfs_write(fhandles[i], file_contents, sizeof(file_contents)) ==
+               sizeof(file_contents));
+        if (i >= OPEN_FILE_COUNT - 1) {
+            assert(tfs_close(fhandles[i]) != -1);
+        }
+    }
+
+    // the tables can't grow past their limits
+    assert(tfs_open("/f_extra", TFS_O_CREAT) == -1);
+    int f = tfs_open("/f0", 0);
+    assert(f != -1);
+    assert(tfs_open("/f1", 0) == -1);
+    assert(tfs_close(f) != -1);
+    for (int i = 0; i < OPEN_FILE_COUNT - 1; i++) {
+        assert(tfs_close(fhandles[i]) != -1);
+    }
+
+    // the contents written before the tables grew are kept
+    for (int i = 0; i < FILE_COUNT; i++) {
+        snprintf(path, sizeof(path), "/f%d", i);
+        f = tfs_open(path, 0);
+        assert(f != -1);
+
+        char buffer[sizeof(file_contents)];
+        assert(tfs_read(f, buffer, sizeof(buffer)) == sizeof(buffer));
+        assert(memcmp(buffer, file_contents, sizeof(buffer)) == 0);
+        assert(tfs_close(f) != -1);
+    }
+
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
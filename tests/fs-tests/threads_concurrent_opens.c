@@ -0,0 +1,107 @@
+#include "../../fs/operations.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define SMALL_BLOCK_SIZE (4 * 1024)
+#define BLOCK_SIZE (1024 * 1024)
+#define READ_NS (200000000)
+
+/**
+ * Returns the current time of the monotonic clock, in nanoseconds.
+ */
+uint64_t now_ns(void) {
+    struct timespec now;
+    assert(clock_gettime(CLOCK_MONOTONIC, &now) == 0);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+/**
+ * Sleeps for a given number of milliseconds.
+ */
+void sleep_ms(long ms) {
+    struct timespec duration = {.tv_sec = 0, .tv_nsec = ms * 1000000};
+    assert(nanosleep(&duration, NULL) == 0);
+}
+
+/**
+ * Writes to the slow file, which keeps it locked while its data block is read
+ * from the device.
+ */
+void *write_slow(void *arg) {
+    int f = *(int *)arg;
+    assert(tfs_write(f, "x", 1) == 1);
+
+    return NULL;
+}
+
+/**
+ * Opens the slow file, which waits for the write to it.
+ */
+void *open_slow(void *arg) {
+    (void)arg;
+    int f = tfs_open("/slow", 0);
+    assert(f != -1);
+    assert(tfs_close(f) != -1);
+
+    return NULL;
+}
+
+/**
+ * Creates a file with size bytes.
+ */
+void write_file(char const *path, size_t size) {
+    static char contents[2 * SMALL_BLOCK_SIZE];
+    memset(contents, 'a', size);
+    int f = tfs_open(path, TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_write(f, contents, size) == size);
+    assert(tfs_close(f) != -1);
+}
+
+int main() {
+    // Reading a big block takes long, while the small blocks (which the
+    // directory and the other file take) are read right away
+    tfs_params params = tfs_default_params();
+    params.block_size = BLOCK_SIZE;
+    params.max_block_count = 4;
+    params.block_class_count = 1;
+    params.block_classes[0].block_size = SMALL_BLOCK_SIZE;
+    params.block_classes[0].block_count = 8;
+    params.device.metadata_latency_ns = 0;
+    params.device.read_latency_ns = 0;
+    params.device.bandwidth = (uint64_t)BLOCK_SIZE * 1000000000u / READ_NS;
+    params.device.wait = TFS_DEVICE_SLEEP;
+    assert(tfs_init(&params) != -1);
+    write_file("/slow", 2 * SMALL_BLOCK_SIZE);
+    write_file("/other", 1);
+
+    // While an open of the slow file waits for a write to it, other files are
+    // still opened right away
+    int slow = tfs_open("/slow", 0);
+    assert(slow != -1);
+    pthread_t writer, opener;
+    assert(pthread_create(&writer, NULL, write_slow, &slow) == 0);
+    sleep_ms(READ_NS / 1000000 / 6);
+    assert(pthread_create(&opener, NULL, open_slow, NULL) == 0);
+    sleep_ms(READ_NS / 1000000 / 6);
+
+    uint64_t start = now_ns();
+    int f = tfs_open("/other", 0);
+    uint64_t elapsed = now_ns() - start;
+    assert(f != -1);
+    assert(elapsed < READ_NS / 3);
+    assert(tfs_close(f) != -1);
+
+    assert(pthread_join(writer, NULL) == 0);
+    assert(pthread_join(opener, NULL) == 0);
+    assert(tfs_close(slow) != -1);
+
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
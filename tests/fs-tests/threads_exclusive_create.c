@@ -0,0 +1,87 @@
+#include "../../fs/operations.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+
+#define ROUNDS (50)
+#define THREAD_COUNT (4)
+
+atomic_int winners;
+
+/**
+ * Tries to create a file exclusively, counting the threads that did.
+ */
+void *create_exclusively(void *arg) {
+    char const *path = arg;
+    int f = tfs_open(path, TFS_O_CREAT | TFS_O_EXCL);
+    if (f != -1) {
+        atomic_fetch_add(&winners, 1);
+        assert(tfs_close(f) != -1);
+    }
+
+    return NULL;
+}
+
+int main() {
+    // Few file handles, which creating files without opening them spares
+    tfs_params params = tfs_default_params();
+    params.max_open_files_count = THREAD_COUNT;
+    params.open_files_count_limit = THREAD_COUNT;
+    assert(tfs_init(&params) != -1);
+
+    // Existing files (and links) make exclusive creation fail
+    int f = tfs_open("/a", TFS_O_CREAT | TFS_O_EXCL);
+    assert(f != -1);
+    assert(tfs_write(f, "A", 1) == 1);
+    assert(tfs_close(f) != -1);
+    assert(tfs_open("/a", TFS_O_CREAT | TFS_O_EXCL) == -1);
+    f = tfs_open("/a", TFS_O_EXCL); // which is ignored without TFS_O_CREAT
+    assert(f != -1);
+    assert(tfs_close(f) != -1);
+    assert(tfs_sym_link("/missing", "/link") != -1);
+    assert(tfs_open("/link", TFS_O_CREAT | TFS_O_EXCL) == -1);
+    assert(tfs_open("/missing", 0) == -1);
+
+    // Files created without opening them take no file handle
+    int handles[THREAD_COUNT];
+    for (int i = 0; i < THREAD_COUNT; i++) {
+        handles[i] = tfs_open("/a", 0);
+        assert(handles[i] != -1);
+    }
+    int inumber = tfs_create("/b", TFS_O_COMPRESS);
+    assert(inumber != -1);
+    assert(tfs_create("/b", 0) == -1);
+    assert(tfs_create("/a", 0) == -1);
+    assert(tfs_create("b", 0) == -1);
+    tfs_file_stat stat;
+    assert(tfs_stat("/b", &stat) != -1);
+    assert(stat.inumber == inumber && stat.size == 0);
+    for (int i = 0; i < THREAD_COUNT; i++) {
+        assert(tfs_close(handles[i]) != -1);
+    }
+
+    // Exactly one of the threads racing to create each file does
+    for (int round = 0; round < ROUNDS; round++) {
+        char path[MAX_FILE_NAME];
+        snprintf(path, sizeof(path), "/race%d", round);
+        atomic_store(&winners, 0);
+        pthread_t threads[THREAD_COUNT];
+        for (int i = 0; i < THREAD_COUNT; i++) {
+            assert(pthread_create(&threads[i], NULL, create_exclusively,
+                                  path) == 0);
+        }
+        for (int i = 0; i < THREAD_COUNT; i++) {
+            assert(pthread_join(threads[i], NULL) == 0);
+        }
+        assert(atomic_load(&winners) == 1);
+        assert(tfs_unlink(path) != -1);
+    }
+
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
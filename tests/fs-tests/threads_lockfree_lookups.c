@@ -0,0 +1,114 @@
+#include "../../fs/operations.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+
+#define STABLE_COUNT (8)
+#define CHURN_ROUNDS (2000)
+#define READER_COUNT (4)
+
+int stable_inumbers[STABLE_COUNT];
+atomic_int churning = 1;
+
+/**
+ * Creates and deletes files with ever different names, so the directory
+ * keeps running out of free entries and reclaiming the removed ones.
+ */
+void *churn(void *arg) {
+    (void)arg;
+    for (int i = 0; i < CHURN_ROUNDS; i++) {
+        char path[MAX_FILE_NAME];
+        snprintf(path, sizeof(path), "/churn%d", i);
+        int f = tfs_open(path, TFS_O_CREAT);
+        assert(f != -1);
+        assert(tfs_close(f) != -1);
+        if (i % 2 == 0) {
+            assert(tfs_rename(path, "/renamed") != -1);
+            assert(tfs_unlink("/renamed") != -1);
+        } else {
+            assert(tfs_unlink(path) != -1);
+        }
+    }
+    churning = 0;
+
+    return NULL;
+}
+
+/**
+ * Looks up and lists the stable files while the directory changes, which
+ * must always be found as the same files.
+ */
+void *read_stable(void *arg) {
+    (void)arg;
+    while (churning) {
+        for (int i = 0; i < STABLE_COUNT; i++) {
+            char path[MAX_FILE_NAME];
+            snprintf(path, sizeof(path), "/stable%d", i);
+            tfs_file_stat stat;
+            assert(tfs_stat(path, &stat) != -1);
+            assert(stat.inumber == stable_inumbers[i]);
+        }
+
+        int seen[STABLE_COUNT] = {0};
+        size_t cursor = 0;
+        tfs_dir_entry entries[4];
+        ssize_t count;
+        while ((count = tfs_readdir(&cursor, entries, 4)) > 0) {
+            for (ssize_t i = 0; i < count; i++) {
+                int n;
+                if (sscanf(entries[i].name, "stable%d", &n) == 1) {
+                    assert(entries[i].stat.inumber == stable_inumbers[n]);
+                    seen[n]++;
+                }
+            }
+        }
+        assert(count == 0);
+        for (int i = 0; i < STABLE_COUNT; i++) {
+            assert(seen[i] == 1);
+        }
+    }
+
+    return NULL;
+}
+
+int main() {
+    assert(tfs_init(NULL) != -1);
+
+    for (int i = 0; i < STABLE_COUNT; i++) {
+        char path[MAX_FILE_NAME];
+        snprintf(path, sizeof(path), "/stable%d", i);
+        int f = tfs_open(path, TFS_O_CREAT);
+        assert(f != -1);
+        assert(tfs_close(f) != -1);
+        tfs_file_stat stat;
+        assert(tfs_stat(path, &stat) != -1);
+        stable_inumbers[i] = stat.inumber;
+    }
+
+    pthread_t churner, readers[READER_COUNT];
+    assert(pthread_create(&churner, NULL, churn, NULL) == 0);
+    for (int i = 0; i < READER_COUNT; i++) {
+        assert(pthread_create(&readers[i], NULL, read_stable, NULL) == 0);
+    }
+    assert(pthread_join(churner, NULL) == 0);
+    for (int i = 0; i < READER_COUNT; i++) {
+        assert(pthread_join(readers[i], NULL) == 0);
+    }
+
+    // Every removed entry is reused, so the directory isn't left full
+    for (int i = 0; i < STABLE_COUNT; i++) {
+        char path[MAX_FILE_NAME];
+        snprintf(path, sizeof(path), "/extra%d", i);
+        int f = tfs_open(path, TFS_O_CREAT);
+        assert(f != -1);
+        assert(tfs_close(f) != -1);
+    }
+
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
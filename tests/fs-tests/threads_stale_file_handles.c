@@ -0,0 +1,97 @@
+#include "../../fs/operations.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+
+#define REOPENS (2000)
+
+atomic_int stale_handle = -1;
+atomic_int reopening = 1;
+
+/**
+ * Keeps closing and reopening a file (in the same entry of the open file
+ * table, since it's the only one), publishing each handle once it's closed.
+ */
+void *reopen(void *arg) {
+    (void)arg;
+    for (int i = 0; i < REOPENS; i++) {
+        int f = tfs_open("/file", 0);
+        assert(f != -1);
+        char c;
+        assert(tfs_read(f, &c, 1) == 1 && c == 'x');
+        assert(tfs_close(f) != -1);
+        atomic_store(&stale_handle, f);
+    }
+    atomic_store(&reopening, 0);
+
+    return NULL;
+}
+
+/**
+ * Uses the handles that were closed, which must never reach the file (even
+ * when its entry was reused for a new handle).
+ */
+void *use_stale(void *arg) {
+    (void)arg;
+    while (atomic_load(&reopening)) {
+        int f = atomic_load(&stale_handle);
+        if (f == -1) {
+            continue;
+        }
+        char c;
+        assert(tfs_write(f, "y", 1) == -1);
+        assert(tfs_read(f, &c, 1) == -1);
+        assert(tfs_close(f) == -1);
+    }
+
+    return NULL;
+}
+
+int main() {
+    // A single entry in the open file table, which every handle reuses
+    tfs_params params = tfs_default_params();
+    params.max_open_files_count = 1;
+    params.open_files_count_limit = 1;
+    assert(tfs_init(&params) != -1);
+
+    int f = tfs_open("/file", TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_write(f, "x", 1) == 1);
+    assert(tfs_close(f) != -1);
+
+    // Closed handles stay invalid once their entry is reused
+    int reused = tfs_open("/file", 0);
+    assert(reused != -1 && reused != f);
+    assert(tfs_close(f) == -1);
+    assert(tfs_write(f, "y", 1) == -1);
+    tfs_file_stat stat;
+    assert(tfs_fstat(f, &stat) == -1);
+    assert(tfs_fstat(reused, &stat) != -1 && stat.size == 1);
+    assert(tfs_close(reused) != -1);
+    assert(tfs_close(reused) == -1);
+
+    // Nor are made up handles valid
+    assert(tfs_close(-1) == -1);
+    assert(tfs_close(0) == -1);
+    assert(tfs_close(1) == -1);
+
+    pthread_t reopener, user;
+    assert(pthread_create(&reopener, NULL, reopen, NULL) == 0);
+    assert(pthread_create(&user, NULL, use_stale, NULL) == 0);
+    assert(pthread_join(reopener, NULL) == 0);
+    assert(pthread_join(user, NULL) == 0);
+
+    f = tfs_open("/file", 0);
+    assert(f != -1);
+    char buffer[4];
+    assert(tfs_read(f, buffer, sizeof(buffer)) == 1 && buffer[0] == 'x');
+    assert(tfs_close(f) != -1);
+
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
@@ -5,7 +5,9 @@
 #include <stdio.h>
 #include <string.h>
 
-uint8_t const file_contents[] = "AAA!";
+// Must be bigger than the inline data of an inode, so that it needs a block
+uint8_t const file_contents[] =
+    "AAA! This content is too big to be stored inside the inode itself!";
 char const target_path1[] = "/f1";
 char const target_path2[] = "/f2";
 char const target_path3[] = "/f3";
@@ -0,0 +1,74 @@
+#include "../../fs/operations.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#define FILE_COUNT (16)
+
+int main() {
+    // Just enough inodes for the root directory, the files and a link
+    tfs_params params = tfs_default_params();
+    params.max_inode_count = FILE_COUNT + 2;
+    assert(tfs_init(&params) != -1);
+
+    char paths[FILE_COUNT][MAX_FILE_NAME];
+    char const *targets[FILE_COUNT];
+    for (int i = 0; i < FILE_COUNT; i++) {
+        snprintf(paths[i], MAX_FILE_NAME, "/f%d", i);
+        targets[i] = paths[i];
+        int f = tfs_open(paths[i], TFS_O_CREAT);
+        assert(f != -1);
+        assert(tfs_write(f, paths[i], strlen(paths[i])) ==
+               strlen(paths[i]));
+        assert(tfs_close(f) != -1);
+    }
+    assert(tfs_link("/f0", "/hard") != -1);
+    assert(tfs_sym_link("/f1", "/soft") != -1);
+    int snapshot = tfs_snapshot();
+    assert(snapshot != -1);
+
+    // Missing, invalid and repeated targets are skipped
+    char const *some[] = {"/f0", "/missing", "f1", "/f1", "/f1", "/soft"};
+    assert(tfs_unlink_many(some, sizeof(some) / sizeof(*some)) == 3);
+    assert(tfs_open("/f0", 0) == -1 && tfs_open("/f1", 0) == -1);
+    assert(tfs_open("/soft", 0) == -1);
+    tfs_file_stat stat;
+    assert(tfs_stat("/hard", &stat) != -1 && stat.hard_links == 1);
+    assert(tfs_unlink_many(some, sizeof(some) / sizeof(*some)) == 0);
+    assert(tfs_unlink_many(NULL, 1) == -1);
+    assert(tfs_unlink_many(NULL, 0) == 0);
+
+    // Open files are only deleted once they're closed, and the snapshot still
+    // sees every file
+    int open = tfs_open("/f2", 0);
+    assert(open != -1);
+    assert(tfs_unlink_many(targets + 2, FILE_COUNT - 2) == FILE_COUNT - 2);
+    for (int i = 0; i < FILE_COUNT; i++) {
+        assert(tfs_open(paths[i], 0) == -1);
+        int f = tfs_snapshot_open(snapshot, paths[i]);
+        assert(f != -1);
+        assert(tfs_close(f) != -1);
+    }
+    char buffer[MAX_FILE_NAME];
+    assert(tfs_read(open, buffer, sizeof(buffer)) == strlen("/f2"));
+    assert(memcmp(buffer, "/f2", strlen("/f2")) == 0);
+    assert(tfs_close(open) != -1);
+    assert(tfs_snapshot_delete(snapshot) != -1);
+
+    // Every inode deleted is free again
+    assert(tfs_unlink("/hard") != -1);
+    assert(tfs_unlink("/hard") == -1);
+    for (int i = 0; i < FILE_COUNT + 1; i++) {
+        char path[MAX_FILE_NAME];
+        snprintf(path, sizeof(path), "/g%d", i);
+        int f = tfs_open(path, TFS_O_CREAT);
+        assert(f != -1);
+        assert(tfs_close(f) != -1);
+    }
+
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
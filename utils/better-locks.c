@@ -9,7 +9,24 @@
 #include "logging.h"
 #include <errno.h>
 #include <pthread.h>
+#include <stdbool.h>
 #include <string.h>
+#include <time.h>
+
+/**
+ * Checks if the static initializers of rwlocks and mutexes are all zeros, in
+ * which case zeroed memory already holds ready to use locks (that don't need
+ * to be destroyed either).
+ */
+bool locks_zero_initialized(void) {
+    static pthread_rwlock_t const rwlock = PTHREAD_RWLOCK_INITIALIZER;
+    static pthread_mutex_t const mutex = PTHREAD_MUTEX_INITIALIZER;
+    static pthread_rwlock_t const zeroed_rwlock;
+    static pthread_mutex_t const zeroed_mutex;
+
+    return memcmp(&rwlock, &zeroed_rwlock, sizeof(rwlock)) == 0 &&
+           memcmp(&mutex, &zeroed_mutex, sizeof(mutex)) == 0;
+}
 
 /**
  * Initializes a rwlock. When unsuccessful, it exits with failure.
@@ -119,6 +136,31 @@ void cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex) {
     }
 }
 
+/**
+ * Waits for a conditional variable, for at most timeout_ms milliseconds. When
+ * unsuccessful, it exits with failure.
+ *
+ * Returns false if it timed out, true otherwise.
+ */
+bool cond_timedwait(pthread_cond_t *cond, pthread_mutex_t *mutex,
+                    long timeout_ms) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += (timeout_ms % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+
+    int result = pthread_cond_timedwait(cond, mutex, &deadline);
+    if (result != 0 && result != ETIMEDOUT) {
+        PANIC("Failed to wait for conditional variable: %s", strerror(result));
+    }
+
+    return result == 0;
+}
+
 /**
  * Signals a conditional variable. When unsuccessful, it exits with failure.
  */
@@ -2,6 +2,9 @@
 #define __UTILS_BETTER_LOCKS_H__
 
 #include <pthread.h>
+#include <stdbool.h>
+
+bool locks_zero_initialized(void);
 
 void rwlock_init(pthread_rwlock_t *lock);
 void rwlock_destroy(pthread_rwlock_t *lock);
@@ -17,6 +20,8 @@ void mutex_unlock(pthread_mutex_t *mutex);
 void cond_init(pthread_cond_t *cond);
 void cond_destroy(pthread_cond_t *cond);
 void cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex);
+bool cond_timedwait(pthread_cond_t *cond, pthread_mutex_t *mutex,
+                    long timeout_ms);
 void cond_broadcast(pthread_cond_t *cond);
 void cond_signal(pthread_cond_t *cond);
 
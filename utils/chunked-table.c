@@ -0,0 +1,150 @@
+/*
+ *      File: chunked-table.c
+ *      Authors: Gonçalo Sampaio Bárias (ist1103124)
+ *               Pedro Perez Vieira (ist1100064)
+ *      Description: Table that grows online in fixed size chunks, without
+ *                   moving the entries it already has.
+ */
+
+// MAP_ANONYMOUS (and the other mapping options used here) are not part of
+// POSIX
+#define _DEFAULT_SOURCE
+
+#include "chunked-table.h"
+#include <stdlib.h>
+#include <sys/mman.h>
+
+/**
+ * Maps a zeroed chunk of memory. Unless it's prefaulted, its pages are only
+ * backed (and zeroed) by the kernel on first use, so this takes constant time
+ * regardless of the size.
+ *
+ * Input:
+ *   - size: size of the chunk (a multiple of the huge page size, when using
+ *     huge pages)
+ *   - flags: chunked_table_flags_t options
+ *
+ * Returns a pointer to the chunk, or NULL if unsuccessful.
+ */
+static char *chunk_map(size_t size, int flags) {
+    int mmap_flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#ifdef MAP_POPULATE
+    if (flags & CHUNKED_TABLE_PREFAULT) {
+        mmap_flags |= MAP_POPULATE;
+    }
+#endif
+
+    void *chunk = MAP_FAILED;
+#ifdef MAP_HUGETLB
+    if (flags & CHUNKED_TABLE_HUGE_PAGES) {
+        // Only succeeds when the system has enough huge pages reserved
+        chunk = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                     mmap_flags | MAP_HUGETLB, -1, 0);
+    }
+#endif
+    if (chunk == MAP_FAILED) {
+        chunk = mmap(NULL, size, PROT_READ | PROT_WRITE, mmap_flags, -1, 0);
+        if (chunk == MAP_FAILED) {
+            return NULL;
+        }
+#ifdef MADV_HUGEPAGE
+        if (flags & CHUNKED_TABLE_HUGE_PAGES) {
+            // Falls back to transparent huge pages (it's only a hint, so
+            // failing is fine)
+            madvise(chunk, size, MADV_HUGEPAGE);
+        }
+#endif
+    }
+
+    return chunk;
+}
+
+/**
+ * Initializes a table, with a first chunk of initial_size zeroed entries.
+ * The table can later grow, one chunk at a time, up to max_size entries.
+ * Chunks smaller than a huge page never use huge pages, since they wouldn't
+ * save any TLB entries.
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int chunked_table_init(chunked_table_t *table, size_t entry_size,
+                       size_t initial_size, size_t max_size, int flags) {
+    if (table == NULL || entry_size == 0 || initial_size == 0) {
+        return -1;
+    }
+    if (max_size < initial_size) {
+        max_size = initial_size;
+    }
+
+    table->entry_size = entry_size;
+    table->chunk_size = initial_size;
+    table->chunk_bytes = initial_size * entry_size;
+    table->flags = flags;
+    if (table->chunk_bytes < CHUNKED_TABLE_HUGE_PAGE_SIZE) {
+        table->flags &= ~CHUNKED_TABLE_HUGE_PAGES;
+    }
+    if (table->flags & CHUNKED_TABLE_HUGE_PAGES) {
+        // Rounds the chunks up to a whole number of huge pages
+        table->chunk_bytes = (table->chunk_bytes +
+                              CHUNKED_TABLE_HUGE_PAGE_SIZE - 1) /
+                             CHUNKED_TABLE_HUGE_PAGE_SIZE *
+                             CHUNKED_TABLE_HUGE_PAGE_SIZE;
+    }
+    table->max_size = max_size;
+    table->chunks = calloc((max_size + initial_size - 1) / initial_size,
+                           sizeof(char *));
+    atomic_init(&table->size, 0);
+    if (table->chunks == NULL) {
+        return -1;
+    }
+
+    return chunked_table_grow(table) == 0 ? 0 : -1;
+}
+
+/**
+ * Frees all the chunks of a table.
+ */
+void chunked_table_destroy(chunked_table_t *table) {
+    if (table->chunks == NULL) {
+        return;
+    }
+
+    size_t n_chunks =
+        (table->max_size + table->chunk_size - 1) / table->chunk_size;
+    for (size_t i = 0; i < n_chunks; i++) {
+        if (table->chunks[i] != NULL) {
+            munmap(table->chunks[i], table->chunk_bytes);
+        }
+    }
+    free(table->chunks);
+    table->chunks = NULL;
+    atomic_store(&table->size, 0);
+}
+
+/**
+ * Adds a new chunk of zeroed entries to the table. Concurrent calls on the
+ * same table must be serialized by the caller, but the table can be read
+ * while it grows.
+ *
+ * Returns the index of the first new entry, or -1 if the table can't grow.
+ */
+ssize_t chunked_table_grow(chunked_table_t *table) {
+    size_t size = atomic_load_explicit(&table->size, memory_order_relaxed);
+    if (size >= table->max_size) {
+        return -1; // already at its max size
+    }
+    size_t chunk_i = size / table->chunk_size;
+    size_t new_size = size + table->chunk_size;
+    if (new_size > table->max_size) {
+        new_size = table->max_size;
+    }
+
+    table->chunks[chunk_i] = chunk_map(table->chunk_bytes, table->flags);
+    if (table->chunks[chunk_i] == NULL) {
+        return -1;
+    }
+    // Only publishes the new size after the chunk is in place
+    atomic_store_explicit(&table->size, new_size, memory_order_release);
+
+    return (ssize_t)size;
+}
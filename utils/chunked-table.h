@@ -0,0 +1,64 @@
+#ifndef __UTILS_CHUNKED_TABLE_H__
+#define __UTILS_CHUNKED_TABLE_H__
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+// Size of the huge pages used by chunks mapped with CHUNKED_TABLE_HUGE_PAGES
+#define CHUNKED_TABLE_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+/**
+ * Options for the memory that backs the chunks of a table.
+ */
+typedef enum {
+    // Back chunks of at least a huge page with huge pages (explicit ones when
+    // reserved by the system, transparent ones otherwise)
+    CHUNKED_TABLE_HUGE_PAGES = 0b01,
+    // Fault in every page of a chunk as soon as it's mapped
+    CHUNKED_TABLE_PREFAULT = 0b10,
+} chunked_table_flags_t;
+
+/**
+ * Table that grows in fixed size chunks, so that pointers to its entries stay
+ * valid while it grows.
+ */
+typedef struct {
+    size_t entry_size;
+    size_t chunk_size;  // # entries per chunk
+    size_t chunk_bytes; // # bytes mapped per chunk
+    int flags;
+    size_t max_size;
+    char **chunks;
+    _Atomic size_t size; // # entries currently in the table
+} chunked_table_t;
+
+int chunked_table_init(chunked_table_t *table, size_t entry_size,
+                       size_t initial_size, size_t max_size, int flags);
+void chunked_table_destroy(chunked_table_t *table);
+ssize_t chunked_table_grow(chunked_table_t *table);
+
+/**
+ * Returns the number of entries currently in the table.
+ */
+static inline size_t chunked_table_size(chunked_table_t *table) {
+    return atomic_load_explicit(&table->size, memory_order_acquire);
+}
+
+/**
+ * Returns the max number of entries the table can grow to.
+ */
+static inline size_t chunked_table_max_size(chunked_table_t const *table) {
+    return table->max_size;
+}
+
+/**
+ * Returns a pointer to the entry with the given index (which must be smaller
+ * than the size of the table).
+ */
+static inline void *chunked_table_get(chunked_table_t const *table, size_t i) {
+    return table->chunks[i / table->chunk_size] +
+           (i % table->chunk_size) * table->entry_size;
+}
+
+#endif // __UTILS_CHUNKED_TABLE_H__